@@ -0,0 +1,630 @@
+#ifndef __M_AI_H__
+#define __M_AI_H__
+#include "util.hpp"
+#include "board.hpp"
+#include "eval.hpp"
+#include "tt.hpp"
+#include "book.hpp"
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+#define AI_UID ((uint64_t)-1)   //人机对战中AI玩家的用户ID，不对应数据库中的任何用户
+#define AI_TIME_MS 500          //每步棋的默认思考时间
+#define AI_MAX_DEPTH 12         //迭代加深的最大深度
+#define AI_MAX_PLY 48           //强制应着延伸后的最大搜索层数
+#define AI_MAX_CAND 16          //非强制局面每层最多展开的候选点数量
+#define AI_CAND_DIST 2          //候选点：距离已有棋子不超过2格的空位
+#define AI_TT_BITS 18           //置换表大小 2^18 项 * 16字节 = 4MB
+#define AI_CACHE_DEPTH 6        //求解缓存中搜索深度不低于该值的结果可以直接复用
+#define AI_CACHE_SOLVED 127     //已经证明必胜的局面写入缓存时使用的深度（8位有符号数的最大值）
+#define AI_VCF_DEPTH 12         //连续冲四搜索的最大步数
+#define AI_VCT_DEPTH 4          //冲四/活三组合搜索的最大步数
+#define AI_WIN 1000000
+#define AI_INF (AI_WIN * 2)
+#define AI_MATE (AI_WIN - 1000) //超过该分数表示已经搜索到胜负
+
+typedef enum {
+    AI_BY_OPENING = 0,   //空棋盘，下天元
+    AI_BY_FIVE,          //直接连五
+    AI_BY_BLOCK,         //堵对方的四
+    AI_BY_VCF,           //连续冲四取胜
+    AI_BY_VCT,           //冲四/活三组合取胜
+    AI_BY_SEARCH,        //alpha-beta搜索
+    AI_BY_BOOK,          //开局库
+    AI_BY_CACHE,         //求解缓存（其他房间已经算过的相同/对称局面）
+}ai_reason;
+struct ai_stats {
+    uint64_t nodes;      //alpha-beta + 威胁搜索展开的节点数
+    uint64_t us;         //本步用时
+    int depth;           //迭代加深完成的深度
+    int score;
+    ai_reason reason;
+};
+struct ai_move {
+    int row;
+    int col;
+    int value;//候选点排序用的估值
+};
+
+/*五子棋AI：
+ *  评估：所有线上所有长度为5的窗口，只包含一种颜色棋子的窗口按棋子数计分（pattern_eval），
+ *        落子/提子时只重新评估经过该点的4条线，整体评估O(1)；同时统计每种颜色"4子窗口"和"3子窗口"的数量，
+ *        可以O(1)判断是否存在成五点/冲四点
+ *  搜索：先检查成五、堵四，再做连续冲四(VCF)和冲四活三(VCT)的威胁空间搜索，
+ *        最后在时间预算内迭代加深alpha-beta，置换表以Zobrist哈希为键
+ *  候选点只取已有棋子周围的空位，按"落子后自己得分增加+破坏对方得分"排序后只展开前AI_MAX_CAND个
+ *  搜索之前先查开局库和求解缓存（按8种对称变换规范化的哈希），搜索结果写回求解缓存
+ *对象不是线程安全的，每个线程使用自己的实例；置换表可以自带，也可以通过attach与其他线程共享*/
+class gomoku_ai {
+    private:
+        board _b;
+        uint64_t _hash;
+        line_eval _lines[EVAL_LINES];//按pattern_eval::line_id编号
+        int _score[2];
+        int _fours[2];
+        int _threes[2];
+        std::unique_ptr<shared_tt> _own_tt;
+        shared_tt *_tt;//搜索用的置换表
+        shared_tt *_solved;//根局面的求解缓存，为空表示不使用
+        const opening_book *_book;//为空表示不使用
+        uint64_t _nodes;
+        uint64_t _deadline;
+        bool _timeout;
+        const std::atomic<bool> *_cancel;//外部取消标志，为空表示不可取消
+        ai_stats _stats;
+    private:
+        static int window_value(int c) { return pattern_eval::window_value(c); }
+        static int ci(int color) { return color == CHESS_WHITE ? 0 : 1; }
+        static int other(int color) { return color == CHESS_WHITE ? CHESS_BLACK : CHESS_WHITE; }
+        static uint64_t zobrist_key(int color, int row, int col) { return zobrist_util::key(color, row, col); }
+        //重新评估经过(row,col)的4条线（一次SSE2评估），更新总分
+        void update_lines(int row, int col) {
+            alignas(16) uint16_t w[8] = {0}, k[8] = {0}, v[8] = {0};
+            int ids[LINE_DIRS];
+            const uint16_t *valid = pattern_eval::valid_masks();
+            for (int d = 0; d < LINE_DIRS; d++) {
+                int idx = board::line_index(d, row, col);
+                ids[d] = pattern_eval::line_id(d, idx);
+                w[d] = _b.line_mask(CHESS_WHITE, d, idx);
+                k[d] = _b.line_mask(CHESS_BLACK, d, idx);
+                v[d] = valid[ids[d]];
+            }
+            line_eval fresh[LINE_DIRS];
+            pattern_eval::eval_lines_sse2(w, k, v, LINE_DIRS, fresh);
+            for (int d = 0; d < LINE_DIRS; d++) {
+                line_eval &le = _lines[ids[d]];
+                for (int i = 0; i < 2; i++) {
+                    _score[i] += fresh[d].score[i] - le.score[i];
+                    _fours[i] += fresh[d].fours[i] - le.fours[i];
+                    _threes[i] += fresh[d].threes[i] - le.threes[i];
+                }
+                le = fresh[d];
+            }
+        }
+        void put(int row, int col, int color) {
+            _b.put(row, col, color);
+            _hash ^= zobrist_key(color, row, col);
+            update_lines(row, col);
+        }
+        void take(int row, int col, int color) {
+            _b.take(row, col);
+            _hash ^= zobrist_key(color, row, col);
+            update_lines(row, col);
+        }
+        void load(const board &b) {
+            _b = b;
+            _hash = 0;
+            for (int r = 0; r < BOARD_ROW; r++) {
+                for (int c = 0; c < BOARD_COL; c++) {
+                    int color = _b.get(r, c);
+                    if (color != 0) {
+                        _hash ^= zobrist_key(color, r, c);
+                    }
+                }
+            }
+            memset(_score, 0, sizeof(_score));
+            memset(_fours, 0, sizeof(_fours));
+            memset(_threes, 0, sizeof(_threes));
+            pattern_eval::eval_board(_b, _lines);
+            for (int i = 0; i < EVAL_LINES; i++) {
+                for (int j = 0; j < 2; j++) {
+                    _score[j] += _lines[i].score[j];
+                    _fours[j] += _lines[i].fours[j];
+                    _threes[j] += _lines[i].threes[j];
+                }
+            }
+        }
+        /*color的窗口中有count个子、其余为空的窗口里的空位（去重），用于找成五点(count=4)、冲四点(count=3)和做三点(count=2)*/
+        int window_points(int color, int count, ai_move *out, int max) {
+            int i = ci(color), n = 0;
+            bool seen[BOARD_ROW * BOARD_COL] = {false};
+            for (int d = 0; d < LINE_DIRS; d++) {
+                for (int idx = 0; idx < board::line_count(d); idx++) {
+                    const line_eval &le = _lines[pattern_eval::line_id(d, idx)];
+                    if ((count == 4 && le.fours[i] == 0) || (count == 3 && le.threes[i] == 0)) {
+                        continue;
+                    }
+                    int lo, hi;
+                    board::line_range(d, idx, lo, hi);
+                    uint16_t own = _b.line_mask(color, d, idx), opp = _b.line_mask(other(color), d, idx);
+                    for (int s = lo; s + 4 <= hi; s++) {
+                        if (((opp >> s) & 0x1F) != 0 || __builtin_popcount((own >> s) & 0x1F) != count) {
+                            continue;
+                        }
+                        for (int p = s; p < s + 5; p++) {
+                            if ((own >> p) & 1) {
+                                continue;
+                            }
+                            int row, col;
+                            board::line_point(d, idx, p, row, col);
+                            if (seen[row * BOARD_COL + col] || n >= max) {
+                                continue;
+                            }
+                            seen[row * BOARD_COL + col] = true;
+                            out[n].row = row;
+                            out[n].col = col;
+                            out[n].value = 0;
+                            n++;
+                        }
+                    }
+                }
+            }
+            return n;
+        }
+        /*在(row,col)落子对color的价值：自己窗口得分的增加 + 破坏的对方窗口得分*/
+        int point_value(int color, int row, int col) {
+            int value = 0;
+            for (int d = 0; d < LINE_DIRS; d++) {
+                int idx = board::line_index(d, row, col), p = board::line_pos(d, row, col);
+                int lo, hi;
+                board::line_range(d, idx, lo, hi);
+                uint16_t own = _b.line_mask(color, d, idx), opp = _b.line_mask(other(color), d, idx);
+                int s0 = std::max(lo, p - 4), s1 = std::min(hi - 4, p);
+                for (int s = s0; s <= s1; s++) {
+                    int om = (own >> s) & 0x1F, pm = (opp >> s) & 0x1F;
+                    if (pm == 0) {
+                        int c = __builtin_popcount(om);
+                        value += window_value(c + 1) - window_value(c) + (c == 3 ? 3000 : 0);
+                    }else if (om == 0) {
+                        value += window_value(__builtin_popcount(pm));
+                    }
+                }
+            }
+            return value;
+        }
+        /*生成color的候选着法：对方有成五点时只能去堵，否则取已有棋子周围的空位按估值排序，limit=0表示不限数量*/
+        int gen_moves(int color, ai_move *moves, int limit, int first_move = -1) {
+            if (_fours[ci(other(color))] > 0) {
+                return window_points(other(color), 4, moves, BOARD_ROW * BOARD_COL);
+            }
+            uint16_t occ[BOARD_ROW], near[BOARD_ROW];
+            for (int r = 0; r < BOARD_ROW; r++) {
+                occ[r] = _b.row_mask(CHESS_WHITE, r) | _b.row_mask(CHESS_BLACK, r);
+            }
+            for (int r = 0; r < BOARD_ROW; r++) {
+                uint16_t acc = 0;
+                for (int dr = -AI_CAND_DIST; dr <= AI_CAND_DIST; dr++) {
+                    if (r + dr >= 0 && r + dr < BOARD_ROW) {
+                        acc |= occ[r + dr];
+                    }
+                }
+                uint16_t dil = acc;
+                for (int dc = 1; dc <= AI_CAND_DIST; dc++) {
+                    dil |= (uint16_t)(acc << dc) | (uint16_t)(acc >> dc);
+                }
+                near[r] = dil & ~occ[r] & ((1u << BOARD_COL) - 1);
+            }
+            int n = 0;
+            for (int r = 0; r < BOARD_ROW; r++) {
+                for (uint16_t m = near[r]; m; m &= m - 1) {
+                    int c = __builtin_ctz(m);
+                    moves[n].row = r;
+                    moves[n].col = c;
+                    moves[n].value = (r * BOARD_COL + c == first_move) ? AI_INF : point_value(color, r, c);
+                    n++;
+                }
+            }
+            int keep = (limit > 0 && n > limit) ? limit : n;
+            std::partial_sort(moves, moves + keep, moves + n, [](const ai_move &a, const ai_move &b) { return a.value > b.value; });
+            return keep;
+        }
+        bool check_time() {
+            if ((++_nodes & 1023) == 0 && (time_util::now_us() > _deadline ||
+                (_cancel != nullptr && _cancel->load(std::memory_order_relaxed)))) {
+                _timeout = true;
+            }
+            return _timeout;
+        }
+        /*连续冲四：color每步都冲四，对方只能堵，直到形成活四/双四或者连五*/
+        bool vcf(int color, int depth, int &row, int &col) {
+            ai_move pts[BOARD_ROW * BOARD_COL];
+            if (_fours[ci(color)] > 0) {
+                window_points(color, 4, pts, 1);
+                row = pts[0].row;
+                col = pts[0].col;
+                return true;
+            }
+            //对方已经有四，冲四之前必须先堵
+            if (depth == 0 || _fours[ci(other(color))] > 0 || check_time()) {
+                return false;
+            }
+            int n = window_points(color, 3, pts, BOARD_ROW * BOARD_COL);
+            for (int i = 0; i < n; i++) {
+                int r = pts[i].row, c = pts[i].col;
+                put(r, c, color);
+                ai_move blocks[BOARD_ROW * BOARD_COL];
+                int nb = window_points(color, 4, blocks, 2);
+                bool win = false;
+                if (nb >= 2) {
+                    win = true;//两个成五点，堵不住
+                }else if (nb == 1) {
+                    int br = blocks[0].row, bc = blocks[0].col;
+                    put(br, bc, other(color));
+                    int tr, tc;
+                    win = !_b.five(br, bc, other(color)) && vcf(color, depth - 1, tr, tc);
+                    take(br, bc, other(color));
+                }
+                take(r, c, color);
+                if (win) {
+                    row = r;
+                    col = c;
+                    return true;
+                }
+                if (_timeout) {
+                    break;
+                }
+            }
+            return false;
+        }
+        /*(row,col)落子后，经过该点的线上color的3子窗口的空位，同一方向至少两个窗口才算活三，返回空位数量*/
+        int three_defends(int color, int row, int col, ai_move *out) {
+            bool seen[BOARD_ROW * BOARD_COL] = {false};
+            int n = 0;
+            for (int d = 0; d < LINE_DIRS; d++) {
+                int idx = board::line_index(d, row, col), p = board::line_pos(d, row, col);
+                int lo, hi;
+                board::line_range(d, idx, lo, hi);
+                uint16_t own = _b.line_mask(color, d, idx), opp = _b.line_mask(other(color), d, idx);
+                int s0 = std::max(lo, p - 4), s1 = std::min(hi - 4, p), windows = 0;
+                uint16_t empties = 0;
+                for (int s = s0; s <= s1; s++) {
+                    if (((opp >> s) & 0x1F) == 0 && __builtin_popcount((own >> s) & 0x1F) == 3) {
+                        windows++;
+                        empties |= (uint16_t)(~own & (0x1F << s));
+                    }
+                }
+                if (windows < 2) {
+                    continue;
+                }
+                for (uint16_t m = empties; m; m &= m - 1) {
+                    int r, c;
+                    board::line_point(d, idx, __builtin_ctz(m), r, c);
+                    if (!seen[r * BOARD_COL + c]) {
+                        seen[r * BOARD_COL + c] = true;
+                        out[n].row = r;
+                        out[n].col = c;
+                        n++;
+                    }
+                }
+            }
+            return n;
+        }
+        /*冲四/活三组合：color每步冲四或做活三，对方的所有防守（堵点以及反冲四）之后仍然能赢*/
+        bool vct(int color, int depth, int &row, int &col) {
+            int opp = other(color);
+            if (_fours[ci(color)] > 0) {
+                return vcf(color, 1, row, col);
+            }
+            if (depth == 0 || _fours[ci(opp)] > 0 || check_time()) {
+                return false;
+            }
+            ai_move pts[BOARD_ROW * BOARD_COL];
+            int n = window_points(color, 3, pts, BOARD_ROW * BOARD_COL);
+            n += window_points(color, 2, pts + n, BOARD_ROW * BOARD_COL - n);
+            for (int i = 0; i < n; i++) {
+                int r = pts[i].row, c = pts[i].col;
+                if (_b.empty(r, c) == false) {
+                    continue;//冲四点和做三点可能重复
+                }
+                put(r, c, color);
+                bool win = false;
+                ai_move blocks[BOARD_ROW * BOARD_COL];
+                int nb = window_points(color, 4, blocks, 2);
+                if (nb >= 2) {
+                    win = true;
+                }else if (nb == 1) {
+                    int br = blocks[0].row, bc = blocks[0].col, tr, tc;
+                    put(br, bc, opp);
+                    win = !_b.five(br, bc, opp) && vct(color, depth - 1, tr, tc);
+                    take(br, bc, opp);
+                }else {
+                    //活三：对方可以堵活三的任意一个点，也可以先反冲四
+                    ai_move defends[BOARD_ROW * BOARD_COL];
+                    int nd = three_defends(color, r, c, defends);
+                    if (nd > 0) {
+                        nd += window_points(opp, 3, defends + nd, BOARD_ROW * BOARD_COL - nd);
+                        win = true;
+                        for (int j = 0; j < nd && win; j++) {
+                            int dr = defends[j].row, dc = defends[j].col, tr, tc;
+                            if (_b.empty(dr, dc) == false) {
+                                continue;
+                            }
+                            put(dr, dc, opp);
+                            if (_fours[ci(opp)] > 0) {
+                                //对方反冲四，必须先堵，堵完后继续进攻
+                                ai_move fb[2];
+                                int nfb = window_points(opp, 4, fb, 2);
+                                if (nfb == 1 && !_b.five(dr, dc, opp)) {
+                                    put(fb[0].row, fb[0].col, color);
+                                    win = vct(color, depth - 1, tr, tc);
+                                    take(fb[0].row, fb[0].col, color);
+                                }else {
+                                    win = false;
+                                }
+                            }else {
+                                win = vct(color, depth - 1, tr, tc);
+                            }
+                            take(dr, dc, opp);
+                        }
+                    }
+                }
+                take(r, c, color);
+                if (win && !_timeout) {
+                    row = r;
+                    col = c;
+                    return true;
+                }
+                if (_timeout) {
+                    break;
+                }
+            }
+            return false;
+        }
+        int evaluate(int color) {
+            return _score[ci(color)] - _score[ci(other(color))];
+        }
+        int negamax(int color, int depth, int alpha, int beta, int ply) {
+            if (check_time()) {
+                return 0;
+            }
+            if (_fours[ci(color)] > 0) {
+                return AI_WIN - ply;//轮到自己走，直接连五
+            }
+            if (_b.full()) {
+                return 0;
+            }
+            tt_data e;
+            int tt_move = -1;
+            if (_tt->probe(_hash, e)) {
+                tt_move = e.move == TT_NO_MOVE ? -1 : e.move;
+                if (e.depth >= depth) {
+                    int s = e.score;
+                    if (s > AI_MATE) s -= ply;
+                    else if (s < -AI_MATE) s += ply;
+                    if (e.flag == TT_EXACT) return s;
+                    if (e.flag == TT_LOWER && s >= beta) return s;
+                    if (e.flag == TT_UPPER && s <= alpha) return s;
+                }
+            }
+            if (depth <= 0) {
+                return evaluate(color);
+            }
+            ai_move moves[BOARD_ROW * BOARD_COL];
+            int n = gen_moves(color, moves, AI_MAX_CAND, tt_move);
+            //只有一种应着（堵四）时不消耗深度
+            int next = (n == 1 && ply < AI_MAX_PLY) ? depth : depth - 1;
+            int best = -AI_INF, best_move = TT_NO_MOVE, alpha0 = alpha;
+            for (int i = 0; i < n; i++) {
+                put(moves[i].row, moves[i].col, color);
+                int s = -negamax(other(color), next, -beta, -alpha, ply + 1);
+                take(moves[i].row, moves[i].col, color);
+                if (_timeout) {
+                    return 0;
+                }
+                if (s > best) {
+                    best = s;
+                    best_move = moves[i].row * BOARD_COL + moves[i].col;
+                }
+                if (s > alpha) {
+                    alpha = s;
+                }
+                if (alpha >= beta) {
+                    break;
+                }
+            }
+            if (n == 0) {
+                return 0;
+            }
+            int store = best;
+            if (store > AI_MATE) store += ply;
+            else if (store < -AI_MATE) store -= ply;
+            e.score = store;
+            e.depth = depth;
+            e.flag = best <= alpha0 ? TT_UPPER : (best >= beta ? TT_LOWER : TT_EXACT);
+            e.move = best_move;
+            e.extra = 0;
+            _tt->store(_hash, e);
+            return best;
+        }
+        uint64_t perft_rec(int color, int depth) {
+            if (depth == 0 || _fours[ci(color)] > 0) {
+                return 1;
+            }
+            ai_move moves[BOARD_ROW * BOARD_COL];
+            int n = gen_moves(color, moves, 0);
+            if (depth == 1) {
+                return n;
+            }
+            uint64_t total = 0;
+            for (int i = 0; i < n; i++) {
+                put(moves[i].row, moves[i].col, color);
+                total += perft_rec(other(color), depth - 1);
+                take(moves[i].row, moves[i].col, color);
+            }
+            return total;
+        }
+    public:
+        /*tt_bits<=0时不分配自己的置换表，必须先attach共享的置换表*/
+        gomoku_ai(int tt_bits = AI_TT_BITS): _tt(nullptr), _solved(nullptr), _book(nullptr),
+            _nodes(0), _deadline(0), _timeout(false), _cancel(nullptr) {
+            if (tt_bits > 0) {
+                _own_tt.reset(new shared_tt(tt_bits));
+                _tt = _own_tt.get();
+            }
+            memset(&_stats, 0, sizeof(_stats));
+            load(_b);
+        }
+        /*使用共享的开局库、置换表和求解缓存，参数为空表示不使用（置换表为空时使用自己的）*/
+        void attach(const opening_book *book, shared_tt *tt, shared_tt *solved) {
+            _book = book;
+            _tt = tt != nullptr ? tt : _own_tt.get();
+            _solved = solved;
+        }
+        const ai_stats &stats() { return _stats; }
+        /*为color在棋盘b上选择一步棋，最多思考time_ms毫秒，棋盘已满时返回false
+         *cancel被置为true时尽快停止，返回当前已经得到的最好着法*/
+        bool search(const board &b, int color, int time_ms, int &row, int &col, int max_depth = AI_MAX_DEPTH,
+                    const std::atomic<bool> *cancel = nullptr) {
+            uint64_t start = time_util::now_us();
+            _cancel = cancel;
+            load(b);
+            _nodes = 0;
+            _timeout = false;
+            memset(&_stats, 0, sizeof(_stats));
+            bool found = think(color, start, time_ms, row, col, max_depth);
+            _stats.nodes = _nodes;
+            _stats.us = time_util::now_us() - start;
+            return found;
+        }
+        /*从棋盘b出发展开候选着法到depth层，返回叶子数量，用于测试着法生成和落子/提子的速度*/
+        uint64_t perft(const board &b, int color, int depth) {
+            load(b);
+            return perft_rec(color, depth);
+        }
+    private:
+        bool think(int color, uint64_t start, int time_ms, int &row, int &col, int max_depth) {
+            ai_move pts[BOARD_ROW * BOARD_COL];
+            if (_b.full()) {
+                return false;
+            }
+            //1. 开局下天元
+            if (_b.count() == 0) {
+                row = BOARD_ROW / 2;
+                col = BOARD_COL / 2;
+                _stats.reason = AI_BY_OPENING;
+                return true;
+            }
+            //2. 能连五直接连五，对方有四必须堵
+            if (window_points(color, 4, pts, 1) > 0) {
+                row = pts[0].row;
+                col = pts[0].col;
+                _stats.reason = AI_BY_FIVE;
+                _stats.score = AI_WIN;
+                return true;
+            }
+            if (window_points(other(color), 4, pts, 1) > 0) {
+                row = pts[0].row;
+                col = pts[0].col;
+                _stats.reason = AI_BY_BLOCK;
+                return true;
+            }
+            //3. 开局库
+            if (_book != nullptr && _book->lookup(_b, row, col)) {
+                _stats.reason = AI_BY_BOOK;
+                return true;
+            }
+            //4. 已解局面缓存：其他房间（或者本房间之前）走到过相同局面（含对称）并且算得足够深
+            int sym = 0;
+            uint64_t key = 0;
+            if (_solved != nullptr) {
+                key = symmetry::canonical(_b, sym);
+                tt_data e;
+                if (_solved->probe(key, e) && e.move != TT_NO_MOVE &&
+                    (e.depth >= AI_CACHE_DEPTH || e.score > AI_MATE)) {
+                    symmetry::apply(symmetry::inverse(sym), e.move / BOARD_COL, e.move % BOARD_COL, row, col);
+                    if (_b.empty(row, col)) {
+                        _stats.reason = AI_BY_CACHE;
+                        _stats.depth = e.depth;
+                        _stats.score = e.score;
+                        return true;
+                    }
+                }
+            }
+            //5. 威胁空间搜索：VCF和VCT各用不超过四分之一的时间
+            _deadline = start + (uint64_t)time_ms * 1000 / 4;
+            if (vcf(color, AI_VCF_DEPTH, row, col)) {
+                _stats.reason = AI_BY_VCF;
+                _stats.score = AI_WIN;
+                remember(key, sym, row, col, AI_CACHE_SOLVED);
+                return true;
+            }
+            _timeout = false;
+            _deadline = time_util::now_us() + (uint64_t)time_ms * 1000 / 4;
+            if (vct(color, AI_VCT_DEPTH, row, col)) {
+                _stats.reason = AI_BY_VCT;
+                _stats.score = AI_WIN;
+                remember(key, sym, row, col, AI_CACHE_SOLVED);
+                return true;
+            }
+            //6. 剩余时间迭代加深，超时时使用上一层完整搜索的结果
+            _timeout = false;
+            _deadline = start + (uint64_t)time_ms * 1000;
+            _stats.reason = AI_BY_SEARCH;
+            ai_move moves[BOARD_ROW * BOARD_COL];
+            int n = gen_moves(color, moves, AI_MAX_CAND);
+            row = moves[0].row;
+            col = moves[0].col;
+            for (int depth = 1; depth <= max_depth; depth++) {
+                int alpha = -AI_INF, best = -AI_INF, best_i = 0;
+                for (int i = 0; i < n; i++) {
+                    put(moves[i].row, moves[i].col, color);
+                    int s = -negamax(other(color), depth - 1, -AI_INF, -alpha, 1);
+                    take(moves[i].row, moves[i].col, color);
+                    if (_timeout) {
+                        break;
+                    }
+                    if (s > best) {
+                        best = s;
+                        best_i = i;
+                    }
+                    if (s > alpha) {
+                        alpha = s;
+                    }
+                }
+                if (_timeout) {
+                    break;
+                }
+                //最好的着法放到最前面，下一层先搜索
+                std::rotate(moves, moves + best_i, moves + best_i + 1);
+                row = moves[0].row;
+                col = moves[0].col;
+                _stats.depth = depth;
+                _stats.score = best;
+                if (best > AI_MATE || best < -AI_MATE) {
+                    break;//已经分出胜负，继续加深没有意义
+                }
+            }
+            if (_stats.depth >= AI_CACHE_DEPTH || _stats.score > AI_MATE) {
+                remember(key, sym, row, col, _stats.score > AI_MATE ? AI_CACHE_SOLVED : _stats.depth);
+            }
+            return true;
+        }
+        /*把实际棋盘上的着法换算到规范局面后写入已解局面缓存*/
+        void remember(uint64_t key, int sym, int row, int col, int depth) {
+            if (_solved == nullptr) {
+                return;
+            }
+            tt_data e;
+            int r, c;
+            symmetry::apply(sym, row, col, r, c);
+            e.score = _stats.score;
+            e.depth = depth;
+            e.flag = TT_EXACT;
+            e.move = r * BOARD_COL + c;
+            e.extra = _stats.reason;
+            _solved->store(key, e);
+        }
+};
+#endif
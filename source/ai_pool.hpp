@@ -0,0 +1,254 @@
+#ifndef __M_AI_POOL_H__
+#define __M_AI_POOL_H__
+#include "util.hpp"
+#include "ai.hpp"
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#define AI_WORKERS 0          //AI工作线程数量，0表示使用CPU核心数的一半（至少1个）
+#define AI_MIN_THINK_MS 50    //在队列中等待超过预算的任务，仍然保证的最短思考时间
+#define AI_IDLE_WAIT_MS 100   //工作线程空闲时的等待时间
+#define AI_BOOK_PATH "./gobang.book" //开局库文件，由gobang_book工具离线生成，不存在时不使用开局库
+#define AI_SHARED_TT_BITS 22  //所有工作线程共享的置换表 2^22 项 * 16字节 = 64MB
+#define AI_SOLVED_BITS 16     //求解缓存 2^16 项 * 16字节 = 1MB
+
+/*一次思考任务：棋盘快照在提交时拷贝，工作线程不接触房间对象*/
+struct ai_job {
+    uint64_t room_id;
+    board b;
+    int color;
+    uint64_t enqueue_us;
+    uint64_t deadline_us;//绝对时间，包含排队时间
+    std::shared_ptr<std::atomic<bool>> cancel;
+    std::function<void(int row, int col)> done;//在事件循环线程中执行
+};
+using ai_job_ptr = std::shared_ptr<ai_job>;
+
+/*AI计算线程池：
+ *  每个工作线程一个任务队列，任务按room_id放入固定的队列，工作线程从自己队列的头部取任务，
+ *  自己的队列为空时从其他队列的尾部窃取；每个房间同一时刻最多一个任务，房间解散时取消
+ *  工作线程只负责搜索，结果通过post交给事件循环线程，在房间锁内落子和广播
+ *  所有工作线程共享一份开局库、一张置换表和一张求解缓存，一个房间算过的局面其他房间直接复用*/
+class ai_pool {
+    private:
+        struct worker {
+            std::mutex mutex;
+            std::deque<ai_job_ptr> jobs;
+            std::thread th;
+        };
+        std::vector<std::unique_ptr<worker>> _workers;
+        std::function<void(const std::function<void()> &)> _post;
+        std::mutex _mutex;//空闲等待以及房间->取消标志的映射
+        std::condition_variable _cond;
+        std::unordered_map<uint64_t, std::shared_ptr<std::atomic<bool>>> _tokens;
+        std::atomic<uint64_t> _pending;
+        bool _stop;
+        opening_book _book;
+        shared_tt _tt;
+        shared_tt _solved;
+        //统计信息
+        std::atomic<uint64_t> _submitted;
+        std::atomic<uint64_t> _completed;
+        std::atomic<uint64_t> _cancelled;
+        std::atomic<uint64_t> _expired;//出队时已经超过截止时间
+        std::atomic<uint64_t> _steals;
+        std::atomic<uint64_t> _wait_us;
+        std::atomic<uint64_t> _max_wait_us;
+        std::atomic<uint64_t> _think_us;
+        std::atomic<uint64_t> _max_think_us;
+        std::atomic<uint64_t> _nodes;
+        std::atomic<uint64_t> _book_hits;
+        std::atomic<uint64_t> _cache_hits;
+    private:
+        static void update_max(std::atomic<uint64_t> &m, uint64_t v) {
+            uint64_t cur = m;
+            while (v > cur && !m.compare_exchange_weak(cur, v)) {}
+        }
+        ai_job_ptr pop(size_t idx) {
+            //1. 自己的队列：从头部取，先提交的先思考
+            {
+                worker &w = *_workers[idx];
+                std::unique_lock<std::mutex> lock(w.mutex);
+                if (!w.jobs.empty()) {
+                    ai_job_ptr job = w.jobs.front();
+                    w.jobs.pop_front();
+                    return job;
+                }
+            }
+            //2. 其他队列：从尾部窃取
+            for (size_t i = 1; i < _workers.size(); i++) {
+                worker &w = *_workers[(idx + i) % _workers.size()];
+                std::unique_lock<std::mutex> lock(w.mutex);
+                if (!w.jobs.empty()) {
+                    ai_job_ptr job = w.jobs.back();
+                    w.jobs.pop_back();
+                    _steals++;
+                    return job;
+                }
+            }
+            return ai_job_ptr();
+        }
+        void release_token(const ai_job_ptr &job) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _tokens.find(job->room_id);
+            if (it != _tokens.end() && it->second == job->cancel) {
+                _tokens.erase(it);
+            }
+        }
+        void run(const ai_job_ptr &job) {
+            static thread_local gomoku_ai ai(0);//每个工作线程一个引擎，置换表使用共享的
+            ai.attach(&_book, &_tt, &_solved);
+            uint64_t start = time_util::now_us();
+            uint64_t wait = start - job->enqueue_us;
+            _wait_us += wait;
+            update_max(_max_wait_us, wait);
+            if (*job->cancel) {
+                _cancelled++;
+                return;
+            }
+            int budget_ms = AI_MIN_THINK_MS;
+            if (job->deadline_us > start + AI_MIN_THINK_MS * 1000) {
+                budget_ms = (job->deadline_us - start) / 1000;
+            }else {
+                _expired++;
+            }
+            int row, col;
+            bool ret = ai.search(job->b, job->color, budget_ms, row, col, AI_MAX_DEPTH, job->cancel.get());
+            uint64_t think = time_util::now_us() - start;
+            _think_us += think;
+            update_max(_max_think_us, think);
+            _nodes += ai.stats().nodes;
+            if (ai.stats().reason == AI_BY_BOOK) {
+                _book_hits++;
+            }else if (ai.stats().reason == AI_BY_CACHE) {
+                _cache_hits++;
+            }
+            release_token(job);
+            if (*job->cancel) {
+                _cancelled++;
+                return;
+            }
+            _completed++;
+            if (ret == false) {
+                return;
+            }
+            DLOG("房间:%lu AI走棋(%d,%d) 原因:%d 深度:%d 分数:%d 节点:%lu 排队:%luus 思考:%luus", job->room_id,
+                 row, col, (int)ai.stats().reason, ai.stats().depth, ai.stats().score, ai.stats().nodes, wait, think);
+            _post(std::bind(job->done, row, col));
+        }
+        void worker_entry(size_t idx) {
+            while (true) {
+                ai_job_ptr job = pop(idx);
+                if (job.get() != nullptr) {
+                    _pending--;
+                    run(job);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_stop) {
+                    break;
+                }
+                _cond.wait_for(lock, std::chrono::milliseconds(AI_IDLE_WAIT_MS),
+                    [this]() { return _stop || _pending > 0; });
+            }
+        }
+    public:
+        /*post：把任务结果交给事件循环线程执行的函数；book：开局库文件路径，为空表示不使用*/
+        ai_pool(const std::function<void(const std::function<void()> &)> &post, int workers = AI_WORKERS,
+                const std::string &book = AI_BOOK_PATH):
+            _post(post), _pending(0), _stop(false), _tt(AI_SHARED_TT_BITS), _solved(AI_SOLVED_BITS),
+            _submitted(0), _completed(0), _cancelled(0), _expired(0), _steals(0), _wait_us(0), _max_wait_us(0),
+            _think_us(0), _max_think_us(0), _nodes(0), _book_hits(0), _cache_hits(0) {
+            if (!book.empty() && _book.open(book)) {
+                ILOG("开局库加载完毕: %s, 局面数:%lu", book.c_str(), _book.size());
+            }
+            if (workers <= 0) {
+                workers = std::thread::hardware_concurrency() / 2;
+            }
+            if (workers <= 0) {
+                workers = 1;
+            }
+            for (int i = 0; i < workers; i++) {
+                _workers.push_back(std::unique_ptr<worker>(new worker()));
+            }
+            for (int i = 0; i < workers; i++) {
+                _workers[i]->th = std::thread(&ai_pool::worker_entry, this, i);
+            }
+            ILOG("AI计算线程池初始化完毕, 工作线程:%d", workers);
+        }
+        ~ai_pool() {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+                for (auto &it : _tokens) {
+                    *it.second = true;
+                }
+                _cond.notify_all();
+            }
+            for (auto &w : _workers) {
+                w->th.join();
+            }
+        }
+        /*提交房间room_id的一次思考，最多time_ms毫秒（包括排队时间），同一房间之前未完成的任务被取消*/
+        void submit(uint64_t room_id, const board &b, int color, int time_ms, const std::function<void(int, int)> &done) {
+            ai_job_ptr job(new ai_job());
+            job->room_id = room_id;
+            job->b = b;
+            job->color = color;
+            job->enqueue_us = time_util::now_us();
+            job->deadline_us = job->enqueue_us + (uint64_t)time_ms * 1000;
+            job->cancel = std::make_shared<std::atomic<bool>>(false);
+            job->done = done;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto &token = _tokens[room_id];
+                if (token) {
+                    *token = true;
+                }
+                token = job->cancel;
+            }
+            _submitted++;
+            _pending++;//先计数再入队，出队时不会减成负数
+            worker &w = *_workers[room_id % _workers.size()];
+            {
+                std::unique_lock<std::mutex> lock(w.mutex);
+                w.jobs.push_back(job);
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.notify_one();
+        }
+        /*取消房间的思考任务：排队中的直接丢弃，正在搜索的在下一次检查时停止，结果不再回调*/
+        void cancel(uint64_t room_id) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _tokens.find(room_id);
+            if (it == _tokens.end()) {
+                return;
+            }
+            *it->second = true;
+            _tokens.erase(it);
+        }
+        void stats(Json::Value &val) {
+            uint64_t done = _completed + _cancelled;
+            val["workers"] = (Json::UInt64)_workers.size();
+            val["pending"] = (Json::UInt64)_pending;
+            val["submitted"] = (Json::UInt64)_submitted;
+            val["completed"] = (Json::UInt64)_completed;
+            val["cancelled"] = (Json::UInt64)_cancelled;
+            val["expired"] = (Json::UInt64)_expired;
+            val["steals"] = (Json::UInt64)_steals;
+            val["avg_wait_us"] = (Json::UInt64)(done == 0 ? 0 : _wait_us / done);
+            val["max_wait_us"] = (Json::UInt64)_max_wait_us;
+            val["avg_think_us"] = (Json::UInt64)(done == 0 ? 0 : _think_us / done);
+            val["max_think_us"] = (Json::UInt64)_max_think_us;
+            val["nodes"] = (Json::UInt64)_nodes;
+            val["book_size"] = (Json::UInt64)_book.size();
+            val["book_hits"] = (Json::UInt64)_book_hits;
+            val["cache_hits"] = (Json::UInt64)_cache_hits;
+        }
+};
+#endif
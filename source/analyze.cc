@@ -0,0 +1,258 @@
+#include "record.hpp"
+#include "book.hpp"
+#include <iostream>
+#include <map>
+
+/*对局记录离线分析工具：
+ *  gobang_analyze <棋谱目录> [线程数] [开局手数]
+ *把所有棋谱段映射到内存，多个线程按段并行扫描，每个线程只累加自己的局部统计，全部扫描完之后再合并：
+ *  先后手胜率、平均手数、结束原因、开局胜率（开局按8种对称变换归一）、玩家最长连胜和当前连胜
+ *连胜与对局顺序有关，按段分别统计每个玩家在段内的 开头连胜/结尾连胜/段内最长连胜，最后按段序号依次合并；
+ *人机对局不计入天梯，只统计局数。不访问数据库*/
+#define ANALYZE_OPENING_PLY 3   //默认按前3手区分开局
+#define ANALYZE_TOP 20          //报告中输出的开局/玩家数量
+#define ANALYZE_MIN_GAMES 10    //开局至少有这么多局才列出胜率
+
+/*一个玩家在一段连续对局中的战绩，按对局顺序合并*/
+struct streak {
+    uint32_t games;
+    uint32_t wins;
+    uint32_t prefix;//开头的连胜
+    uint32_t suffix;//结尾的连胜（到目前为止的当前连胜）
+    uint32_t best;  //最长连胜
+    void add(bool win) {
+        if (win) {
+            wins++;
+            if (prefix == games) {
+                prefix++;
+            }
+            suffix++;
+            best = std::max(best, suffix);
+        }else {
+            suffix = 0;
+        }
+        games++;
+    }
+    //this在前，next在后
+    void merge(const streak &next) {
+        best = std::max(std::max(best, next.best), suffix + next.prefix);
+        if (prefix == games) {
+            prefix += next.prefix;
+        }
+        suffix = next.suffix == next.games ? suffix + next.games : next.suffix;
+        games += next.games;
+        wins += next.wins;
+    }
+};
+struct opening_stat {
+    uint64_t games;
+    uint64_t result[3];//和 白胜 黑胜
+};
+/*每个线程的局部统计，与顺序无关的部分*/
+struct partial {
+    uint64_t games = 0, vs_ai = 0, moves = 0, bytes = 0, bad = 0;
+    uint64_t result[3] = {0};
+    uint64_t reasons[256] = {0};
+    std::unordered_map<uint64_t, opening_stat> openings;
+};
+/*每个段的玩家战绩，与顺序有关，按段序号合并*/
+typedef std::unordered_map<uint64_t, streak> segment_streaks;
+
+void usage()
+{
+    std::cerr << "用法:\n"
+              << "  gobang_analyze <records目录> [threads=CPU核心数] [opening_ply=" << ANALYZE_OPENING_PLY << "]"
+              << std::endl;
+}
+/*开局的规范编码：前ply手在8种对称变换下字典序最小的着法序列，每手1字节*/
+uint64_t opening_key(const char *moves, int ply)
+{
+    uint64_t best = UINT64_MAX;
+    for (int s = 0; s < 8; s++) {
+        uint64_t key = 0;
+        for (int i = 0; i < ply; i++) {
+            int m = (uint8_t)moves[i], r, c;
+            symmetry::apply(s, m / BOARD_COL, m % BOARD_COL, r, c);
+            key = (key << 8) | (uint64_t)(r * BOARD_COL + c);
+        }
+        best = std::min(best, key);
+    }
+    return best;
+}
+void scan_segment(const char *base, size_t len, int ply, partial &p, segment_streaks &ss)
+{
+    size_t off = sizeof(record_segment_header);
+    record_header hdr;
+    while (off < len) {
+        if (!record_util::parse(base + off, len - off, hdr)) {
+            p.bad += len - off;//残缺的尾部
+            break;
+        }
+        const char *moves = base + off + sizeof(record_header);
+        off += hdr.size;
+        p.bytes += hdr.size;
+        if (hdr.flags & RECORD_VS_AI) {
+            p.vs_ai++;
+            continue;
+        }
+        p.games++;
+        p.moves += hdr.moves;
+        p.result[hdr.result % 3]++;
+        p.reasons[hdr.reason]++;
+        if (hdr.moves >= ply) {
+            opening_stat &os = p.openings[opening_key(moves, ply)];
+            os.games++;
+            os.result[hdr.result % 3]++;
+        }
+        ss[hdr.white].add(hdr.result == CHESS_WHITE);
+        ss[hdr.black].add(hdr.result == CHESS_BLACK);
+    }
+}
+std::string opening_name(uint64_t key, int ply)
+{
+    std::string name;
+    for (int i = ply - 1; i >= 0; i--) {
+        int m = (key >> (8 * i)) & 0xff;
+        name += "(" + std::to_string(m / BOARD_COL) + "," + std::to_string(m % BOARD_COL) + ")";
+    }
+    return name;
+}
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    std::string dir = argv[1];
+    int threads = argc > 2 ? atoi(argv[2]) : 0;
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    int ply = argc > 3 ? atoi(argv[3]) : ANALYZE_OPENING_PLY;
+    if (ply < 1 || ply > 8) {
+        usage();
+        return 1;
+    }
+    std::vector<uint32_t> seqs;
+    record_util::list_segments(dir, seqs);
+    if (seqs.empty()) {
+        std::cerr << "没有找到棋谱段: " << dir << std::endl;
+        return 1;
+    }
+    uint64_t start = time_util::now_us();
+    //1. 映射所有段
+    std::vector<const char *> bases(seqs.size(), nullptr);
+    std::vector<size_t> lens(seqs.size(), 0);
+    for (size_t i = 0; i < seqs.size(); i++) {
+        lens[i] = record_util::map_segment(record_util::segment_path(dir, seqs[i]), bases[i]);
+        if (lens[i] == 0) {
+            std::cerr << "无法读取棋谱段: " << record_util::segment_path(dir, seqs[i]) << std::endl;
+            continue;
+        }
+        madvise((void *)bases[i], lens[i], MADV_SEQUENTIAL);
+    }
+    //2. 线程池按段取任务并行扫描，局部统计各自累加
+    std::vector<partial> partials(threads);
+    std::vector<segment_streaks> streaks(seqs.size());
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t]() {
+            size_t i;
+            while ((i = next++) < seqs.size()) {
+                if (lens[i] != 0) {
+                    scan_segment(bases[i], lens[i], ply, partials[t], streaks[i]);
+                }
+            }
+        });
+    }
+    for (auto &th : pool) {
+        th.join();
+    }
+    uint64_t scan_us = time_util::now_us() - start;
+    //3. 合并：计数直接相加，玩家战绩按段序号依次合并
+    partial total;
+    for (auto &p : partials) {
+        total.games += p.games;
+        total.vs_ai += p.vs_ai;
+        total.moves += p.moves;
+        total.bytes += p.bytes;
+        total.bad += p.bad;
+        for (int r = 0; r < 3; r++) {
+            total.result[r] += p.result[r];
+        }
+        for (int r = 0; r < 256; r++) {
+            total.reasons[r] += p.reasons[r];
+        }
+        for (auto &it : p.openings) {
+            opening_stat &os = total.openings[it.first];
+            os.games += it.second.games;
+            for (int r = 0; r < 3; r++) {
+                os.result[r] += it.second.result[r];
+            }
+        }
+    }
+    std::unordered_map<uint64_t, streak> users;
+    for (auto &ss : streaks) {
+        for (auto &it : ss) {
+            auto u = users.find(it.first);
+            if (u == users.end()) {
+                users.insert(it);
+            }else {
+                u->second.merge(it.second);
+            }
+        }
+    }
+    uint64_t total_us = time_util::now_us() - start;
+    for (size_t i = 0; i < seqs.size(); i++) {
+        if (lens[i] != 0) {
+            munmap((void *)bases[i], lens[i]);
+        }
+    }
+    //4. 报告
+    uint64_t all = total.games + total.vs_ai;
+    printf("== 对局记录分析: %s\n", dir.c_str());
+    printf("段:%lu 天梯对局:%lu 人机对局:%lu 残缺字节:%lu\n", seqs.size(), total.games, total.vs_ai, total.bad);
+    if (total.games == 0) {
+        return 0;
+    }
+    double g = (double)total.games;
+    printf("平均手数: %.1f\n", total.moves / g);
+    printf("先手优势: 白(先手)胜 %.2f%%  黑胜 %.2f%%  和棋 %.2f%%\n", 100 * total.result[CHESS_WHITE] / g,
+           100 * total.result[CHESS_BLACK] / g, 100 * total.result[0] / g);
+    printf("结束原因:");
+    for (int r = 0; r < 256; r++) {
+        if (total.reasons[r] != 0) {
+            printf(" [%d]%lu", r, total.reasons[r]);
+        }
+    }
+    printf("\n");
+    std::vector<std::pair<uint64_t, opening_stat>> openings;
+    for (auto &it : total.openings) {
+        if (it.second.games >= ANALYZE_MIN_GAMES) {
+            openings.push_back(it);
+        }
+    }
+    std::sort(openings.begin(), openings.end(), [](const std::pair<uint64_t, opening_stat> &a,
+                                                  const std::pair<uint64_t, opening_stat> &b) {
+        return a.second.games > b.second.games;
+    });
+    printf("开局(前%d手，共%lu种，至少%d局的%lu种):\n", ply, total.openings.size(), ANALYZE_MIN_GAMES, openings.size());
+    for (size_t i = 0; i < openings.size() && i < ANALYZE_TOP; i++) {
+        const opening_stat &os = openings[i].second;
+        printf("  %-24s %8lu局 白胜 %5.1f%% 黑胜 %5.1f%%\n", opening_name(openings[i].first, ply).c_str(), os.games,
+               100.0 * os.result[CHESS_WHITE] / os.games, 100.0 * os.result[CHESS_BLACK] / os.games);
+    }
+    std::vector<std::pair<uint64_t, streak>> ranks(users.begin(), users.end());
+    std::sort(ranks.begin(), ranks.end(), [](const std::pair<uint64_t, streak> &a, const std::pair<uint64_t, streak> &b) {
+        return a.second.best != b.second.best ? a.second.best > b.second.best : a.first < b.first;
+    });
+    printf("最长连胜(共%lu名玩家):\n", users.size());
+    for (size_t i = 0; i < ranks.size() && i < ANALYZE_TOP; i++) {
+        const streak &s = ranks[i].second;
+        printf("  用户%-10lu 最长连胜 %4u  当前连胜 %4u  %u局%u胜\n", ranks[i].first, s.best, s.suffix, s.games, s.wins);
+    }
+    printf("扫描: %d线程 %.1fMB 扫描%lums 合计%lums, %.0f局/s %.0fMB/s\n", threads, total.bytes / 1048576.0,
+           scan_us / 1000, total_us / 1000, all * 1e6 / total_us, total.bytes / 1.048576 / total_us);
+    return 0;
+}
@@ -0,0 +1,482 @@
+#ifndef __M_ASSET_H__
+#define __M_ASSET_H__
+#include "util.hpp"
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+
+#define ASSET_COMPRESS_MIN 256 //小于这个大小的文件不生成压缩版本
+#define ASSET_FILE_MIN (64 * 1024) //不压缩的文件超过这个大小时不读入内存，响应时从打开的文件pread（页缓存），不占用常驻的堆内存
+#define ASSET_MAX_AGE "public, max-age=3600" //css/js/图片等资源的缓存时间
+#define ASSET_HTML_CACHE "no-cache" //页面每次都带ETag回源校验，内容没变只返回304
+#define ASSET_WATCH_POLL_MS 500 //监听线程检查退出标志的间隔
+/*一个静态资源：原始内容、预先压缩好的gzip/brotli版本（压缩后没有变小则为空）、强ETag、MIME类型
+ *大文件只保留一个打开的只读文件描述符（fd不为-1），body为空，响应时pread出需要的区间；
+ *文件被原地修改或截断时只会读到新内容或者读不满（按失败响应，随后inotify重新加载），不会像访问文件映射那样触发SIGBUS*/
+struct asset {
+    std::string body;
+    std::string gzip;
+    std::string br;
+    std::string etag;//不带引号和编码后缀的内容哈希，每种编码的ETag是 "etag" "etag-gz" "etag-br"
+    std::string mime;
+    const char *cache_control;
+    int fd;
+    size_t file_len;
+    asset(): cache_control(ASSET_MAX_AGE), fd(-1), file_len(0) {}
+    ~asset() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    size_t size() const { return fd >= 0 ? file_len : body.size(); }
+    /*读出原始内容的[off, off+len)，调用者保证区间在size()之内；大文件读不满（被截断）返回false*/
+    bool read(size_t off, size_t len, std::string &out) const {
+        if (fd < 0) {
+            out.assign(body, off, len);
+            return true;
+        }
+        out.resize(len);
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pread(fd, &out[done], len - done, off + done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+};
+typedef std::shared_ptr<const asset> asset_ptr;
+/*静态资源缓存：启动时把web根目录下的所有文件读入内存（大文件只保持打开）并预先压缩，之后通过inotify监听目录变化重新加载，
+ *处理请求时只查内存中的表，不访问文件系统*/
+class asset_cache {
+    private:
+        std::string _root;//不带结尾的'/'
+        std::mutex _mutex;
+        std::unordered_map<std::string, asset_ptr> _assets;//uri路径 -> 资源，例如 /js/jquery.min.js
+        int _inotify_fd;
+        std::unordered_map<int, std::string> _watch_dirs;//inotify watch描述符 -> 相对目录，只由监听线程访问
+        std::atomic<bool> _stop;
+        std::thread _watcher;
+        //统计信息
+        std::atomic<uint64_t> _hits;
+        std::atomic<uint64_t> _not_modified;
+        std::atomic<uint64_t> _reloads;
+        std::atomic<uint64_t> _ranges;
+    private:
+        static const char *mime_type(const std::string &path) {
+            static const std::unordered_map<std::string, const char *> types = {
+                {"html", "text/html; charset=utf-8"}, {"htm", "text/html; charset=utf-8"},
+                {"css", "text/css; charset=utf-8"}, {"js", "application/javascript; charset=utf-8"},
+                {"json", "application/json"}, {"txt", "text/plain; charset=utf-8"},
+                {"svg", "image/svg+xml"}, {"ico", "image/x-icon"},
+                {"png", "image/png"}, {"jpg", "image/jpeg"}, {"jpeg", "image/jpeg"},
+                {"gif", "image/gif"}, {"webp", "image/webp"},
+            };
+            size_t pos = path.rfind('.');
+            if (pos != std::string::npos) {
+                auto it = types.find(path.substr(pos + 1));
+                if (it != types.end()) {
+                    return it->second;
+                }
+            }
+            return "application/octet-stream";
+        }
+        //图片等已经压缩过的格式不再压缩
+        static bool compressible(const std::string &mime) {
+            return mime.compare(0, 5, "text/") == 0 || mime.compare(0, 22, "application/javascript") == 0 ||
+                   mime == "application/json" || mime == "image/svg+xml";
+        }
+        static bool gzip_compress(const std::string &in, std::string &out) {
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            //windowBits加16生成gzip格式而不是zlib格式
+            if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return false;
+            }
+            out.resize(deflateBound(&zs, in.size()));
+            zs.next_in = (Bytef *)in.data();
+            zs.avail_in = in.size();
+            zs.next_out = (Bytef *)&out[0];
+            zs.avail_out = out.size();
+            int ret = deflate(&zs, Z_FINISH);
+            out.resize(zs.total_out);
+            deflateEnd(&zs);
+            return ret == Z_STREAM_END;
+        }
+        static bool brotli_compress(const std::string &in, std::string &out) {
+            size_t len = BrotliEncoderMaxCompressedSize(in.size());
+            if (len == 0) {
+                return false;
+            }
+            out.resize(len);
+            if (BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                    in.size(), (const uint8_t *)in.data(), &len, (uint8_t *)&out[0]) == BROTLI_FALSE) {
+                return false;
+            }
+            out.resize(len);
+            return true;
+        }
+        //FNV-1a 64位哈希，加上长度作为强ETag；大文件分块累加
+        static uint64_t fnv1a(uint64_t h, const char *data, size_t len) {
+            for (size_t i = 0; i < len; i++) {
+                h ^= (unsigned char)data[i];
+                h *= 0x100000001b3ULL;
+            }
+            return h;
+        }
+        static std::string make_etag(uint64_t h, size_t len) {
+            char buf[48];
+            snprintf(buf, sizeof(buf), "%016lx-%zx", (unsigned long)h, len);
+            return buf;
+        }
+        //打开大文件并分块计算ETag，文件描述符交给资源保持到资源被替换
+        static bool open_file(const std::string &path, asset &a) {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                ELOG("%s file open failed!!", path.c_str());
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) < 0 || st.st_size == 0) {
+                close(fd);
+                return false;
+            }
+            a.fd = fd;
+            a.file_len = st.st_size;
+            uint64_t h = 0xcbf29ce484222325ULL;
+            std::string chunk;
+            for (size_t off = 0; off < a.file_len; off += chunk.size()) {
+                if (a.read(off, std::min<size_t>(a.file_len - off, 64 * 1024), chunk) == false) {
+                    ELOG("%s file read failed!!", path.c_str());
+                    return false;
+                }
+                h = fnv1a(h, chunk.data(), chunk.size());
+            }
+            a.etag = make_etag(h, a.file_len);
+            return true;
+        }
+        /*读取并预处理一个文件，uri为相对web根目录的路径（以'/'开头）*/
+        bool load_file(const std::string &uri) {
+            std::shared_ptr<asset> ap(new asset);
+            std::string path = _root + uri;
+            ap->mime = mime_type(uri);
+            struct stat st;
+            if (stat(path.c_str(), &st) == 0 && st.st_size >= ASSET_FILE_MIN && !compressible(ap->mime)) {
+                if (open_file(path, *ap) == false) {
+                    return false;
+                }
+            }else if (file_util::read(path, ap->body) == false) {
+                return false;
+            }else {
+                ap->etag = make_etag(fnv1a(0xcbf29ce484222325ULL, ap->body.data(), ap->body.size()), ap->body.size());
+            }
+            ap->cache_control = ap->mime.compare(0, 9, "text/html") == 0 ? ASSET_HTML_CACHE : ASSET_MAX_AGE;
+            if (ap->body.size() >= ASSET_COMPRESS_MIN && compressible(ap->mime)) {
+                if (gzip_compress(ap->body, ap->gzip) == false || ap->gzip.size() >= ap->body.size()) {
+                    ap->gzip.clear();
+                }
+                if (brotli_compress(ap->body, ap->br) == false || ap->br.size() >= ap->body.size()) {
+                    ap->br.clear();
+                }
+            }
+            DLOG("静态资源加载: %s %lu字节 gzip:%lu br:%lu 文件:%d", uri.c_str(), ap->size(),
+                ap->gzip.size(), ap->br.size(), (int)(ap->fd >= 0));
+            std::unique_lock<std::mutex> lock(_mutex);
+            _assets[uri] = ap;
+            return true;
+        }
+        void unload(const std::string &uri) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _assets.erase(uri);
+        }
+        /*递归加载目录dir（相对路径，根目录为空串）下的所有文件，并为每个目录添加监听*/
+        void load_dir(const std::string &dir) {
+            if (_inotify_fd >= 0) {
+                int wd = inotify_add_watch(_inotify_fd, (_root + dir).c_str(),
+                    IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE);
+                if (wd < 0) {
+                    ELOG("监听目录失败: %s", (_root + dir).c_str());
+                }else {
+                    _watch_dirs[wd] = dir;
+                }
+            }
+            DIR *dp = opendir((_root + dir).c_str());
+            if (dp == nullptr) {
+                ELOG("打开目录失败: %s", (_root + dir).c_str());
+                return;
+            }
+            struct dirent *ent;
+            while ((ent = readdir(dp)) != nullptr) {
+                std::string name = ent->d_name;
+                if (name == "." || name == "..") {
+                    continue;
+                }
+                std::string uri = dir + "/" + name;
+                struct stat st;
+                if (stat((_root + uri).c_str(), &st) < 0) {
+                    continue;
+                }
+                if (S_ISDIR(st.st_mode)) {
+                    load_dir(uri);
+                }else if (S_ISREG(st.st_mode)) {
+                    load_file(uri);
+                }
+            }
+            closedir(dp);
+        }
+        void watch_entry() {
+            char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            struct pollfd pfd;
+            pfd.fd = _inotify_fd;
+            pfd.events = POLLIN;
+            while (_stop == false) {
+                if (poll(&pfd, 1, ASSET_WATCH_POLL_MS) <= 0) {
+                    continue;
+                }
+                ssize_t len = read(_inotify_fd, buf, sizeof(buf));
+                for (char *p = buf; len > 0 && p < buf + len; ) {
+                    struct inotify_event *ev = (struct inotify_event *)p;
+                    p += sizeof(struct inotify_event) + ev->len;
+                    auto it = _watch_dirs.find(ev->wd);
+                    if (it == _watch_dirs.end() || ev->len == 0) {
+                        continue;
+                    }
+                    std::string uri = it->second + "/" + ev->name;
+                    if (ev->mask & IN_ISDIR) {
+                        if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                            load_dir(uri);
+                        }
+                        continue;
+                    }
+                    if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                        _reloads++;
+                        load_file(uri);
+                    }else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                        _reloads++;
+                        unload(uri);
+                    }
+                }
+            }
+        }
+        //If-None-Match中是否有与该资源匹配的ETag（弱比较，忽略W/前缀和编码后缀）
+        static bool etag_match(const std::string &header, const std::string &etag) {
+            if (header.empty()) {
+                return false;
+            }
+            std::vector<std::string> tags;
+            string_util::split(header, ",", tags);
+            for (auto &tag : tags) {
+                size_t begin = tag.find('"');
+                size_t end = tag.rfind('"');
+                if (tag.find('*') != std::string::npos && begin == std::string::npos) {
+                    return true;
+                }
+                if (begin == std::string::npos || end <= begin) {
+                    continue;
+                }
+                std::string val = tag.substr(begin + 1, end - begin - 1);
+                if (val == etag || val == etag + "-gz" || val == etag + "-br") {
+                    return true;
+                }
+            }
+            return false;
+        }
+        //Accept-Encoding中是否包含指定的编码（不处理q=0）
+        static bool accept_encoding(const std::string &header, const char *coding) {
+            std::vector<std::string> codings;
+            string_util::split(header, ",", codings);
+            size_t len = strlen(coding);
+            for (auto &c : codings) {
+                size_t begin = c.find_first_not_of(' ');
+                if (begin != std::string::npos && c.compare(begin, len, coding) == 0 &&
+                    (c.size() == begin + len || c[begin + len] == ';' || c[begin + len] == ' ')) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        /*Range中的字节位置：只含数字，超出64位的按最大值处理（起点越界 -> 416，终点/后缀越界 -> 截到文件末尾）*/
+        static size_t range_pos(const std::string &digits) {
+            errno = 0;
+            unsigned long long v = strtoull(digits.c_str(), nullptr, 10);
+            if (errno == ERANGE || v > SIZE_MAX) {
+                return SIZE_MAX;
+            }
+            return (size_t)v;
+        }
+        /*大文件读不满：文件正在被原地修改或截断，本次响应500，inotify随后重新加载*/
+        static bool read_failed(const std::string &uri, wsserver_t::connection_ptr &conn) {
+            ELOG("静态资源读取失败，文件可能正在被修改: %s", uri.c_str());
+            conn->set_status(websocketpp::http::status_code::internal_server_error);
+            return true;
+        }
+    public:
+        /*解析单个区间的Range头：bytes=start-end / bytes=start- / bytes=-suffix
+         *返回1表示得到有效区间[start, start+len)，0表示没有Range或者格式不支持（按整个文件响应），-1表示区间不可满足*/
+        static int parse_range(const std::string &header, size_t size, size_t &start, size_t &len) {
+            if (header.compare(0, 6, "bytes=") != 0 || header.find(',') != std::string::npos) {
+                return 0;
+            }
+            std::string spec = header.substr(6);
+            size_t dash = spec.find('-');
+            if (dash == std::string::npos) {
+                return 0;
+            }
+            std::string first = spec.substr(0, dash), last = spec.substr(dash + 1);
+            if (first.find_first_not_of("0123456789") != std::string::npos ||
+                last.find_first_not_of("0123456789") != std::string::npos || (first.empty() && last.empty())) {
+                return 0;
+            }
+            if (first.empty()) {
+                //后缀区间：最后N个字节
+                size_t n = range_pos(last);
+                if (n == 0 || size == 0) {
+                    return -1;
+                }
+                n = n > size ? size : n;
+                start = size - n;
+                len = n;
+                return 1;
+            }
+            start = range_pos(first);
+            if (start >= size) {
+                return -1;
+            }
+            size_t end = last.empty() ? size - 1 : range_pos(last);
+            if (end < start) {
+                return 0;
+            }
+            end = end >= size ? size - 1 : end;
+            len = end - start + 1;
+            return 1;
+        }
+    public:
+        asset_cache(const std::string &root): _root(root), _stop(false), _hits(0), _not_modified(0), _reloads(0), _ranges(0) {
+            while (!_root.empty() && _root.back() == '/') {
+                _root.pop_back();
+            }
+            _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (_inotify_fd < 0) {
+                ELOG("inotify初始化失败，静态资源修改后需要重启服务器");
+            }
+            load_dir("");
+            if (_inotify_fd >= 0) {
+                _watcher = std::thread(&asset_cache::watch_entry, this);
+            }
+            ILOG("静态资源缓存初始化完毕, 共%lu个文件", _assets.size());
+        }
+        ~asset_cache() {
+            _stop = true;
+            if (_watcher.joinable()) {
+                _watcher.join();
+            }
+            if (_inotify_fd >= 0) {
+                close(_inotify_fd);
+            }
+        }
+        asset_ptr get(const std::string &uri) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _assets.find(uri);
+            if (it == _assets.end()) {
+                return asset_ptr();
+            }
+            return it->second;
+        }
+        /*用缓存中的资源响应请求：设置Content-Type/ETag/Cache-Control，按Accept-Encoding选择预压缩版本，
+         *If-None-Match命中时返回304，资源不存在返回false*/
+        bool serve(const std::string &uri, wsserver_t::connection_ptr &conn) {
+            asset_ptr ap = get(uri);
+            if (ap.get() == nullptr) {
+                return false;
+            }
+            _hits++;
+            conn->append_header("Cache-Control", ap->cache_control);
+            conn->append_header("Vary", "Accept-Encoding");
+            if (etag_match(conn->get_request_header("If-None-Match"), ap->etag)) {
+                _not_modified++;
+                conn->append_header("ETag", "\"" + ap->etag + "\"");
+                conn->set_status(websocketpp::http::status_code::not_modified);
+                return true;
+            }
+            conn->append_header("Content-Type", ap->mime);
+            conn->append_header("Accept-Ranges", "bytes");
+            //区间请求只针对原始内容响应，不使用压缩版本
+            size_t start, len;
+            int range = parse_range(conn->get_request_header("Range"), ap->size(), start, len);
+            if (range < 0) {
+                char buf[64];
+                snprintf(buf, sizeof(buf), "bytes */%zu", ap->size());
+                conn->append_header("Content-Range", buf);
+                conn->set_status(websocketpp::http::status_code::range_not_satisfiable);
+                return true;
+            }
+            if (range > 0) {
+                _ranges++;
+                std::string body;
+                if (ap->read(start, len, body) == false) {
+                    return read_failed(uri, conn);
+                }
+                char buf[96];
+                snprintf(buf, sizeof(buf), "bytes %zu-%zu/%zu", start, start + len - 1, ap->size());
+                conn->append_header("Content-Range", buf);
+                conn->append_header("ETag", "\"" + ap->etag + "\"");
+                conn->set_body(std::move(body));
+                conn->set_status(websocketpp::http::status_code::partial_content);
+                return true;
+            }
+            const std::string &encoding = conn->get_request_header("Accept-Encoding");
+            if (!ap->br.empty() && accept_encoding(encoding, "br")) {
+                conn->append_header("Content-Encoding", "br");
+                conn->append_header("ETag", "\"" + ap->etag + "-br\"");
+                conn->set_body(ap->br);
+            }else if (!ap->gzip.empty() && accept_encoding(encoding, "gzip")) {
+                conn->append_header("Content-Encoding", "gzip");
+                conn->append_header("ETag", "\"" + ap->etag + "-gz\"");
+                conn->set_body(ap->gzip);
+            }else {
+                conn->append_header("ETag", "\"" + ap->etag + "\"");
+                if (ap->fd >= 0) {
+                    //websocketpp的响应正文只能是std::string，从页缓存pread一次后移动进去，不常驻堆内存
+                    std::string body;
+                    if (ap->read(0, ap->size(), body) == false) {
+                        return read_failed(uri, conn);
+                    }
+                    conn->set_body(std::move(body));
+                }else {
+                    conn->set_body(ap->body);
+                }
+            }
+            conn->set_status(websocketpp::http::status_code::ok);
+            return true;
+        }
+        void stats(Json::Value &val) {
+            val["hits"] = (Json::UInt64)_hits;
+            val["not_modified"] = (Json::UInt64)_not_modified;
+            val["reloads"] = (Json::UInt64)_reloads;
+            val["ranges"] = (Json::UInt64)_ranges;
+            std::unique_lock<std::mutex> lock(_mutex);
+            uint64_t bytes = 0, file_bytes = 0;
+            for (auto &it : _assets) {
+                bytes += it.second->body.size() + it.second->gzip.size() + it.second->br.size();
+                file_bytes += it.second->file_len;
+            }
+            val["files"] = (Json::UInt64)_assets.size();
+            val["bytes"] = (Json::UInt64)bytes;
+            val["file_bytes"] = (Json::UInt64)file_bytes;
+        }
+};
+#endif
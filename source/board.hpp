@@ -0,0 +1,132 @@
+#ifndef __M_BOARD_H__
+#define __M_BOARD_H__
+#include <stdint.h>
+#include <string.h>
+
+#define BOARD_ROW 15
+#define BOARD_COL 15
+#define CHESS_WHITE 1
+#define CHESS_BLACK 2
+#define BOARD_LINE (BOARD_ROW + BOARD_COL - 1)//正斜线/反斜线的数量
+#define LINE_DIRS 4 //线的方向：0横 1竖 2正斜 3反斜
+
+/*位棋盘：每种颜色按横、竖、正斜、反斜四个方向各保存一组线掩码，每条线一个16位掩码
+ *  横线 第row条，第col位
+ *  竖线 第col条，第row位
+ *  正斜线(左上->右下) 第row-col+BOARD_COL-1条，第col位
+ *  反斜线(右上->左下) 第row+col条，第col位
+ *同一条线上相邻的两个位置在掩码中也一定相邻，所以五子连珠只需要对落子所在的四条线做移位与运算，
+ *落子/提子只需要修改8个掩码，整个棋盘是一个不需要堆内存的定长对象*/
+class board {
+    private:
+        uint16_t _row[2][BOARD_ROW];
+        uint16_t _col[2][BOARD_COL];
+        uint16_t _diag[2][BOARD_LINE];
+        uint16_t _anti[2][BOARD_LINE];
+        int _count;//棋盘上的棋子数量
+    private:
+        static int color_index(int color) { return color == CHESS_WHITE ? 0 : 1; }
+        static int diag_index(int row, int col) { return row - col + BOARD_COL - 1; }
+        static int anti_index(int row, int col) { return row + col; }
+        //掩码中存在连续5个1则返回true
+        static bool has_five(uint16_t m) {
+            return (m & (m >> 1) & (m >> 2) & (m >> 3) & (m >> 4)) != 0;
+        }
+    public:
+        board() { clear(); }
+        void clear() {
+            memset(_row, 0, sizeof(_row));
+            memset(_col, 0, sizeof(_col));
+            memset(_diag, 0, sizeof(_diag));
+            memset(_anti, 0, sizeof(_anti));
+            _count = 0;
+        }
+        static bool in_range(int row, int col) {
+            return row >= 0 && row < BOARD_ROW && col >= 0 && col < BOARD_COL;
+        }
+        int count() const { return _count; }
+        bool full() const { return _count == BOARD_ROW * BOARD_COL; }
+        /*获取指定位置的棋子颜色，没有棋子返回0*/
+        int get(int row, int col) const {
+            uint16_t bit = (uint16_t)(1u << col);
+            if (_row[0][row] & bit) return CHESS_WHITE;
+            if (_row[1][row] & bit) return CHESS_BLACK;
+            return 0;
+        }
+        bool empty(int row, int col) const {
+            return ((_row[0][row] | _row[1][row]) & (1u << col)) == 0;
+        }
+        /*某种颜色在某一行上的棋子掩码，供评估/搜索模块使用*/
+        uint16_t row_mask(int color, int row) const { return _row[color_index(color)][row]; }
+        /*某种颜色在dir方向第idx条线上的棋子掩码*/
+        uint16_t line_mask(int color, int dir, int idx) const {
+            int ci = color_index(color);
+            switch (dir) {
+                case 0: return _row[ci][idx];
+                case 1: return _col[ci][idx];
+                case 2: return _diag[ci][idx];
+                default: return _anti[ci][idx];
+            }
+        }
+        /*dir方向上线的数量*/
+        static int line_count(int dir) { return dir < 2 ? BOARD_ROW : BOARD_LINE; }
+        /*(row,col)在dir方向上所在的线编号，以及在这条线掩码中的位*/
+        static int line_index(int dir, int row, int col) {
+            switch (dir) {
+                case 0: return row;
+                case 1: return col;
+                case 2: return diag_index(row, col);
+                default: return anti_index(row, col);
+            }
+        }
+        static int line_pos(int dir, int row, int col) { return dir == 1 ? row : col; }
+        /*dir方向第idx条线上第pos位对应的棋盘位置*/
+        static void line_point(int dir, int idx, int pos, int &row, int &col) {
+            switch (dir) {
+                case 0: row = idx; col = pos; break;
+                case 1: row = pos; col = idx; break;
+                case 2: row = pos + idx - (BOARD_COL - 1); col = pos; break;
+                default: row = idx - pos; col = pos; break;
+            }
+        }
+        /*dir方向第idx条线上有效位的范围[lo, hi]，斜线两端不足15个位置*/
+        static void line_range(int dir, int idx, int &lo, int &hi) {
+            if (dir < 2) {
+                lo = 0;
+                hi = (dir == 0 ? BOARD_COL : BOARD_ROW) - 1;
+            }else if (dir == 2) {
+                lo = idx < BOARD_COL - 1 ? BOARD_COL - 1 - idx : 0;
+                hi = idx > BOARD_ROW - 1 ? BOARD_LINE - 1 - idx : BOARD_COL - 1;
+            }else {
+                lo = idx > BOARD_ROW - 1 ? idx - (BOARD_ROW - 1) : 0;
+                hi = idx < BOARD_COL - 1 ? idx : BOARD_COL - 1;
+            }
+        }
+        /*落子，调用者保证位置合法且为空*/
+        void put(int row, int col, int color) {
+            int ci = color_index(color);
+            _row[ci][row] |= (uint16_t)(1u << col);
+            _col[ci][col] |= (uint16_t)(1u << row);
+            _diag[ci][diag_index(row, col)] |= (uint16_t)(1u << col);
+            _anti[ci][anti_index(row, col)] |= (uint16_t)(1u << col);
+            _count++;
+        }
+        /*提子，搜索时回退落子使用*/
+        void take(int row, int col) {
+            int ci = color_index(get(row, col));
+            _row[ci][row] &= (uint16_t)~(1u << col);
+            _col[ci][col] &= (uint16_t)~(1u << row);
+            _diag[ci][diag_index(row, col)] &= (uint16_t)~(1u << col);
+            _anti[ci][anti_index(row, col)] &= (uint16_t)~(1u << col);
+            _count--;
+        }
+        /*判断(row,col)所在的四条线上color是否形成了五子（及以上）连珠*/
+        bool five(int row, int col, int color) const {
+            int ci = color_index(color);
+            return has_five(_row[ci][row]) ||
+                   has_five(_col[ci][col]) ||
+                   has_five(_diag[ci][diag_index(row, col)]) ||
+                   has_five(_anti[ci][anti_index(row, col)]);
+        }
+};
+#endif
@@ -0,0 +1,135 @@
+#include "ai.hpp"
+#include <iostream>
+#include <fstream>
+#include <random>
+
+/*开局库离线工具：
+ *  gobang_book build <对局记录> <开局库文件> [最大手数] [最少对局数]   从对局记录生成开局库
+ *  gobang_book selfplay <局数> <每步毫秒> <对局记录>                 AI自我对弈，追加对局记录
+ *  gobang_book dump <开局库文件>                                     查看开局库
+ *对局记录每行一局：胜方颜色(0和棋 1白 2黑) 之后是白棋先行的 row,col 序列*/
+
+void usage()
+{
+    std::cerr << "用法:\n"
+              << "  gobang_book build <games.txt> <out.book> [max_ply=" << BOOK_MAX_PLY << "] [min_games="
+              << BOOK_MIN_GAMES << "]\n"
+              << "  gobang_book selfplay <games> <ms_per_move> <games.txt>\n"
+              << "  gobang_book dump <gobang.book>" << std::endl;
+}
+int build(int argc, char *argv[])
+{
+    if (argc < 4) {
+        usage();
+        return 1;
+    }
+    std::ifstream in(argv[2]);
+    if (!in.is_open()) {
+        std::cerr << "打开对局记录失败: " << argv[2] << std::endl;
+        return 1;
+    }
+    int max_ply = argc > 4 ? atoi(argv[4]) : BOOK_MAX_PLY;
+    int min_games = argc > 5 ? atoi(argv[5]) : BOOK_MIN_GAMES;
+    size_t games = 0;
+    uint64_t start = time_util::now_us();
+    if (!opening_book::build(in, argv[3], max_ply, min_games, &games)) {
+        std::cerr << "写入开局库失败: " << argv[3] << std::endl;
+        return 1;
+    }
+    opening_book book;
+    if (!book.open(argv[3])) {
+        std::cerr << "开局库校验失败: " << argv[3] << std::endl;
+        return 1;
+    }
+    std::cout << games << "局 -> " << book.size() << "个局面, 用时" << (time_util::now_us() - start) / 1000 << "ms"
+              << std::endl;
+    return 0;
+}
+/*自我对弈：前两手在天元附近随机落子保证对局多样，之后双方都由AI思考*/
+int selfplay(int argc, char *argv[])
+{
+    if (argc < 5) {
+        usage();
+        return 1;
+    }
+    int n = atoi(argv[2]), ms = atoi(argv[3]);
+    std::ofstream out(argv[4], std::ios::app);
+    if (!out.is_open()) {
+        std::cerr << "打开对局记录失败: " << argv[4] << std::endl;
+        return 1;
+    }
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<int> near(-2, 2);
+    gomoku_ai ai;
+    int wins[3] = {0};
+    for (int g = 0; g < n; g++) {
+        board b;
+        std::string moves;
+        int color = CHESS_WHITE, winner = 0;
+        while (!b.full()) {
+            int row, col;
+            if (b.count() < 2) {
+                do {
+                    row = BOARD_ROW / 2 + near(rng);
+                    col = BOARD_COL / 2 + near(rng);
+                } while (!b.empty(row, col));
+            }else if (!ai.search(b, color, ms, row, col)) {
+                break;
+            }
+            b.put(row, col, color);
+            moves += " " + std::to_string(row) + "," + std::to_string(col);
+            if (b.five(row, col, color)) {
+                winner = color;
+                break;
+            }
+            color = color == CHESS_WHITE ? CHESS_BLACK : CHESS_WHITE;
+        }
+        out << winner << moves << "\n";
+        wins[winner]++;
+        std::cout << "第" << g + 1 << "局: " << b.count() << "手 胜方:" << winner << std::endl;
+    }
+    std::cout << "白胜:" << wins[CHESS_WHITE] << " 黑胜:" << wins[CHESS_BLACK] << " 和棋:" << wins[0] << std::endl;
+    return 0;
+}
+int dump(int argc, char *argv[])
+{
+    if (argc < 3) {
+        usage();
+        return 1;
+    }
+    int fd = open(argv[2], O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "打开开局库失败: " << argv[2] << std::endl;
+        return 1;
+    }
+    book_header hdr;
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr.magic, BOOK_MAGIC, 8) != 0) {
+        std::cerr << "开局库格式错误: " << argv[2] << std::endl;
+        close(fd);
+        return 1;
+    }
+    book_entry e;
+    while (read(fd, &e, sizeof(e)) == sizeof(e)) {
+        printf("%016lx (%2d,%2d) %u/%u\n", e.key, e.move / BOARD_COL, e.move % BOARD_COL, e.wins, e.games);
+    }
+    close(fd);
+    std::cout << hdr.count << "个局面" << std::endl;
+    return 0;
+}
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    std::string cmd = argv[1];
+    if (cmd == "build") {
+        return build(argc, argv);
+    }else if (cmd == "selfplay") {
+        return selfplay(argc, argv);
+    }else if (cmd == "dump") {
+        return dump(argc, argv);
+    }
+    usage();
+    return 1;
+}
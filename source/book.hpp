@@ -0,0 +1,220 @@
+#ifndef __M_BOOK_H__
+#define __M_BOOK_H__
+#include "logger.hpp"
+#include "board.hpp"
+#include "tt.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#define BOOK_MAGIC "GBBOOK01"
+#define BOOK_MAX_PLY 12        //开局库只收录前12手
+#define BOOK_MIN_GAMES 2       //一个着法至少出现在这么多局对局中才收录
+
+/*棋盘的8种对称变换（4种旋转 x 是否镜像），同一局面的8种变换在开局库中只保存一份*/
+class symmetry {
+    public:
+        static void apply(int sym, int row, int col, int &r, int &c) {
+            const int n = BOARD_ROW - 1;
+            switch (sym) {
+                case 0: r = row;     c = col;     break;
+                case 1: r = col;     c = n - row; break;//顺时针90度
+                case 2: r = n - row; c = n - col; break;//180度
+                case 3: r = n - col; c = row;     break;//270度
+                case 4: r = row;     c = n - col; break;//左右镜像
+                case 5: r = col;     c = row;     break;//主对角线
+                case 6: r = n - row; c = col;     break;//上下镜像
+                default: r = n - col; c = n - row; break;//副对角线
+            }
+        }
+        static int inverse(int sym) {
+            static const int inv[8] = {0, 3, 2, 1, 4, 5, 6, 7};
+            return inv[sym];
+        }
+        /*局面的规范哈希：8种变换下Zobrist哈希的最小值，sym返回取到最小值的变换*/
+        static uint64_t canonical(const board &b, int &sym) {
+            uint64_t h[8] = {0};
+            for (int row = 0; row < BOARD_ROW; row++) {
+                for (int col = 0; col < BOARD_COL; col++) {
+                    int color = b.get(row, col);
+                    if (color == 0) {
+                        continue;
+                    }
+                    for (int s = 0; s < 8; s++) {
+                        int r, c;
+                        apply(s, row, col, r, c);
+                        h[s] ^= zobrist_util::key(color, r, c);
+                    }
+                }
+            }
+            sym = 0;
+            for (int s = 1; s < 8; s++) {
+                if (h[s] < h[sym]) {
+                    sym = s;
+                }
+            }
+            return h[sym];
+        }
+};
+
+/*开局库文件：16字节文件头 + 按key升序排列的定长记录，启动时直接映射到内存，二分查找，不需要解析*/
+struct book_header {
+    char magic[8];
+    uint32_t count;
+    uint32_t reserved;
+};
+struct book_entry {
+    uint64_t key;    //规范哈希
+    uint16_t games;  //规范局面下出现该着法的对局数
+    uint16_t wins;   //其中走这步棋的一方获胜的对局数
+    uint8_t move;    //规范局面中的着法 row*BOARD_COL+col
+    uint8_t pad[3];
+};
+
+class opening_book {
+    private:
+        void *_map;
+        size_t _len;
+        const book_entry *_entries;
+        uint32_t _count;
+    public:
+        opening_book(): _map(nullptr), _len(0), _entries(nullptr), _count(0) {}
+        ~opening_book() { close(); }
+        void close() {
+            if (_map != nullptr) {
+                munmap(_map, _len);
+            }
+            _map = nullptr;
+            _entries = nullptr;
+            _count = 0;
+        }
+        /*映射开局库文件，文件不存在或者格式不对时返回false，此时开局库为空*/
+        bool open(const std::string &path) {
+            close();
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(book_header)) {
+                ::close(fd);
+                return false;
+            }
+            void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (map == MAP_FAILED) {
+                return false;
+            }
+            const book_header *hdr = (const book_header *)map;
+            if (memcmp(hdr->magic, BOOK_MAGIC, 8) != 0 ||
+                sizeof(book_header) + (size_t)hdr->count * sizeof(book_entry) != (size_t)st.st_size) {
+                munmap(map, st.st_size);
+                ELOG("开局库格式错误: %s", path.c_str());
+                return false;
+            }
+            _map = map;
+            _len = st.st_size;
+            _entries = (const book_entry *)((const char *)map + sizeof(book_header));
+            _count = hdr->count;
+            return true;
+        }
+        size_t size() const { return _count; }
+        /*查找棋盘b上的库中着法，返回实际棋盘上的位置*/
+        bool lookup(const board &b, int &row, int &col) const {
+            if (_count == 0 || b.count() >= BOOK_MAX_PLY) {
+                return false;
+            }
+            int sym;
+            uint64_t key = symmetry::canonical(b, sym);
+            const book_entry *end = _entries + _count;
+            const book_entry *e = std::lower_bound(_entries, end, key,
+                [](const book_entry &e, uint64_t k) { return e.key < k; });
+            //文件中的着法不可信（损坏或者手工修改的库），越界时当作没有库中着法
+            if (e == end || e->key != key || e->move >= BOARD_ROW * BOARD_COL) {
+                return false;
+            }
+            //库中保存的是规范局面中的着法，用逆变换换回实际棋盘
+            symmetry::apply(symmetry::inverse(sym), e->move / BOARD_COL, e->move % BOARD_COL, row, col);
+            return b.empty(row, col);
+        }
+        /*离线生成开局库，输入是对局记录文本，每行一局：胜方颜色(0和棋/未知 1白 2黑) 之后是白棋先行的 row,col 序列
+         *每个规范局面只保留胜率（加一平滑）最高的着法；先写临时文件再rename替换，已经映射了旧文件的进程不受影响*/
+        static bool build(std::istream &games, const std::string &path, int max_ply = BOOK_MAX_PLY,
+                          int min_games = BOOK_MIN_GAMES, size_t *game_count = nullptr) {
+            std::map<std::pair<uint64_t, int>, std::pair<int, int>> tally;//(规范哈希, 规范着法) -> (对局数, 胜局数)
+            std::string line;
+            size_t n = 0;
+            while (std::getline(games, line)) {
+                std::istringstream in(line);
+                int winner;
+                if (!(in >> winner)) {
+                    continue;
+                }
+                board b;
+                int color = CHESS_WHITE, row, col;
+                char comma;
+                for (int ply = 0; ply < max_ply && (in >> row >> comma >> col); ply++) {
+                    if (!board::in_range(row, col) || !b.empty(row, col)) {
+                        break;
+                    }
+                    int sym, r, c;
+                    uint64_t key = symmetry::canonical(b, sym);
+                    symmetry::apply(sym, row, col, r, c);
+                    auto &t = tally[std::make_pair(key, r * BOARD_COL + c)];
+                    t.first++;
+                    t.second += (winner == color);
+                    b.put(row, col, color);
+                    color = color == CHESS_WHITE ? CHESS_BLACK : CHESS_WHITE;
+                }
+                n++;
+            }
+            std::vector<book_entry> entries;
+            for (auto &it : tally) {
+                const std::pair<int, int> &t = it.second;
+                if (t.first < min_games) {
+                    continue;
+                }
+                if (!entries.empty() && entries.back().key == it.first.first) {
+                    book_entry &best = entries.back();
+                    if ((t.second + 1) * (best.games + 2) <= (best.wins + 1) * (t.first + 2)) {
+                        continue;
+                    }
+                    entries.pop_back();
+                }
+                book_entry e;
+                memset(&e, 0, sizeof(e));
+                e.key = it.first.first;
+                e.move = it.first.second;
+                e.games = std::min(t.first, 65535);
+                e.wins = std::min(t.second, 65535);
+                entries.push_back(e);
+            }
+            std::string tmp = path + ".tmp";
+            std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+            book_header hdr;
+            memcpy(hdr.magic, BOOK_MAGIC, 8);
+            hdr.count = entries.size();
+            hdr.reserved = 0;
+            out.write((const char *)&hdr, sizeof(hdr));
+            out.write((const char *)entries.data(), entries.size() * sizeof(book_entry));
+            out.close();
+            if (out.fail() || ::rename(tmp.c_str(), path.c_str()) != 0) {
+                ::unlink(tmp.c_str());
+                ELOG("开局库写入失败: %s", path.c_str());
+                return false;
+            }
+            if (game_count != nullptr) {
+                *game_count = n;
+            }
+            return true;
+        }
+};
+#endif
@@ -0,0 +1,285 @@
+#ifndef __M_CACHE_H__
+#define __M_CACHE_H__
+#include "util.hpp"
+#include "db.hpp"
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+
+#define CACHE_FLUSH_MS 1000 //write-behind模式下的写回周期
+#define CACHE_MAX_USERS 100000 //缓存的用户数上限，超过时淘汰没有未写回增量的用户
+/*缓存中的用户信息，write-behind模式下分数/场次已经包含了尚未写回数据库的增量*/
+struct user_profile {
+    std::string username;
+    int score;
+    int total_count;
+    int win_count;
+};
+/*用户信息缓存：位于user_table之前，匹配/用户信息查询不再每次访问数据库
+ * 读：未命中时从数据库加载（read-through）
+ * 写：默认write-through，直接更新数据库后使缓存失效；
+ *     write-behind模式下只修改缓存并记录增量，由后台线程周期性合并成一条多行update写回
+ * 容量：超过上限时淘汰一批没有未写回增量的用户，下次访问时重新从数据库加载*/
+class user_cache {
+    private:
+        user_table *_ut;
+        bool _write_behind;
+        int _flush_ms;
+        size_t _max_users;
+        std::mutex _mutex;
+        std::unordered_map<uint64_t, user_profile> _users;
+        std::unordered_map<uint64_t, user_delta> _dirty;//尚未写回数据库的增量
+        uint64_t _dirty_since_ms;//最早一个未写回增量产生的时间
+        uint64_t _generation;//每次失效/淘汰递增，防止并发加载把失效前读到的旧数据放回缓存
+        int _flushing;//正在写回的次数：增量已经从_dirty取出但还没有落库，这期间不淘汰
+        bool _stop;
+        std::condition_variable _cond;
+        std::thread _flusher;
+        //统计信息
+        std::atomic<uint64_t> _hits;
+        std::atomic<uint64_t> _misses;
+        std::atomic<uint64_t> _flushes;
+        std::atomic<uint64_t> _last_batch;
+        std::atomic<uint64_t> _max_batch;
+        std::atomic<uint64_t> _last_lag_ms;
+        std::atomic<uint64_t> _evictions;
+    private:
+        static void to_json(uint64_t id, const user_profile &p, Json::Value &user) {
+            user["id"] = (Json::UInt64)id;
+            user["username"] = p.username;
+            user["score"] = (Json::UInt64)p.score;
+            user["total_count"] = p.total_count;
+            user["win_count"] = p.win_count;
+        }
+        /*超过上限时淘汰没有未写回增量的用户，一次淘汰到上限的90%，避免每次插入都扫描；调用者持有锁*/
+        void trim_locked() {
+            if (_users.size() <= _max_users || _flushing != 0 || _users.size() <= _dirty.size()) {
+                return;
+            }
+            size_t target = _max_users - _max_users / 10;
+            for (auto it = _users.begin(); it != _users.end() && _users.size() > target;) {
+                if (_dirty.count(it->first) != 0) {
+                    ++it;
+                    continue;
+                }
+                it = _users.erase(it);
+                _evictions++;
+            }
+            _generation++;
+        }
+        //write-behind模式：在缓存上应用一个玩家的一次对局结果，并累计到待写回增量中，调用者持有锁；user是刚加载的用户信息
+        void apply_locked(uint64_t id, const Json::Value &user, int score, int win) {
+            auto it = _users.find(id);
+            if (it == _users.end()) {
+                //加载期间发生了失效，以刚读到的数据库数据为准放入缓存
+                user_profile p;
+                p.username = user["username"].asString();
+                p.score = user["score"].asInt();
+                p.total_count = user["total_count"].asInt();
+                p.win_count = user["win_count"].asInt();
+                it = _users.insert(std::make_pair(id, p)).first;
+            }
+            it->second.score += score;
+            it->second.total_count += 1;
+            it->second.win_count += win;
+            if (_dirty.empty()) {
+                _dirty_since_ms = time_util::now_ms();
+            }
+            user_delta &d = _dirty[id];
+            d.id = id;
+            d.score += score;
+            d.total_count += 1;
+            d.win_count += win;
+        }
+        bool apply(uint64_t id, int score, int win) {
+            Json::Value user;
+            if (select_by_id(id, user) == false) {
+                return false;
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            apply_locked(id, user, score, win);
+            trim_locked();
+            return true;
+        }
+        /*一局对局的双方一起应用：先加载两个人的信息，任意一个加载失败则都不修改，返回false由结算队列重试，
+         *不会出现只给胜者加了分、重试时再加一次的情况*/
+        bool apply_game(const game_result &r) {
+            Json::Value winner, loser;
+            if (select_by_id(r.winner, winner) == false || select_by_id(r.loser, loser) == false) {
+                return false;
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            apply_locked(r.winner, winner, 30, 1);
+            apply_locked(r.loser, loser, -30, 0);
+            trim_locked();
+            return true;
+        }
+        void flush_entry() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_stop == false) {
+                _cond.wait_for(lock, std::chrono::milliseconds(_flush_ms));
+                lock.unlock();
+                flush();
+                lock.lock();
+            }
+        }
+    public:
+        user_cache(user_table *ut, bool write_behind = false, int flush_ms = CACHE_FLUSH_MS,
+                   size_t max_users = CACHE_MAX_USERS):
+            _ut(ut), _write_behind(write_behind), _flush_ms(flush_ms), _max_users(max_users), _dirty_since_ms(0),
+            _generation(0), _flushing(0), _stop(false), _hits(0), _misses(0), _flushes(0),
+            _last_batch(0), _max_batch(0), _last_lag_ms(0), _evictions(0) {
+            if (_write_behind) {
+                _flusher = std::thread(&user_cache::flush_entry, this);
+            }
+            ILOG("用户信息缓存初始化完毕, write-behind:%d", (int)_write_behind);
+        }
+        ~user_cache() {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+                _cond.notify_all();
+            }
+            if (_flusher.joinable()) {
+                _flusher.join();
+            }
+            flush();
+        }
+        bool write_behind() { return _write_behind; }
+        /*通过用户ID获取用户信息，未命中时从数据库加载*/
+        bool select_by_id(uint64_t id, Json::Value &user) {
+            uint64_t gen;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = _users.find(id);
+                if (it != _users.end()) {
+                    _hits++;
+                    to_json(id, it->second, user);
+                    return true;
+                }
+                gen = _generation;
+            }
+            _misses++;
+            if (_ut->select_by_id(id, user) == false) {
+                return false;
+            }
+            user_profile p;
+            p.username = user["username"].asString();
+            p.score = user["score"].asInt();
+            p.total_count = user["total_count"].asInt();
+            p.win_count = user["win_count"].asInt();
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (gen == _generation) {
+                //已经被其他线程加载过的以缓存中的为准（可能带有未写回的增量）
+                auto ret = _users.insert(std::make_pair(id, p));
+                to_json(id, ret.first->second, user);
+                trim_locked();
+            }
+            return true;
+        }
+        /*使缓存中的用户信息失效；write-behind模式下缓存比数据库新，以缓存为准，不会失效*/
+        void invalidate(uint64_t id) {
+            if (_write_behind) {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            _users.erase(id);
+            _generation++;
+        }
+        //胜利时天梯分数增加30分，战斗场次增加1，胜利场次增加1
+        bool win(uint64_t id) {
+            if (_write_behind) {
+                return apply(id, 30, 1);
+            }
+            bool ret = _ut->win(id);
+            invalidate(id);
+            return ret;
+        }
+        //失败时天梯分数减少30，战斗场次增加1，其他不变
+        bool lose(uint64_t id) {
+            if (_write_behind) {
+                return apply(id, -30, 0);
+            }
+            bool ret = _ut->lose(id);
+            invalidate(id);
+            return ret;
+        }
+        /*批量结算对局结果：write-behind模式下逐局累计到增量中，有对局失败时返回false，但成功的对局已经生效，
+         *所以结算队列在write-behind模式下每次只提交一局；否则在一个事务中写入数据库后使缓存失效*/
+        bool settle(const std::vector<game_result> &results) {
+            if (_write_behind) {
+                bool ret = true;
+                for (auto &r : results) {
+                    ret = apply_game(r) && ret;
+                }
+                return ret;
+            }
+            bool ret = _ut->settle(results);
+            for (auto &r : results) {
+                invalidate(r.winner);
+                invalidate(r.loser);
+            }
+            return ret;
+        }
+        /*把所有未写回的增量合并成一条多行update写回数据库，失败则把增量合并回去等下次重试*/
+        void flush() {
+            std::vector<user_delta> batch;
+            uint64_t since_ms;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_dirty.empty()) {
+                    return;
+                }
+                for (auto &it : _dirty) {
+                    batch.push_back(it.second);
+                }
+                _dirty.clear();
+                since_ms = _dirty_since_ms;
+                _flushing++;
+            }
+            bool ret = _ut->batch_update(batch);
+            std::unique_lock<std::mutex> lock(_mutex);
+            _flushing--;
+            if (ret == false) {
+                ELOG("用户信息写回失败，%lu个用户的增量等待下次写回", batch.size());
+                if (_dirty.empty()) {
+                    _dirty_since_ms = since_ms;
+                }
+                for (auto &d : batch) {
+                    user_delta &cur = _dirty[d.id];
+                    cur.id = d.id;
+                    cur.score += d.score;
+                    cur.total_count += d.total_count;
+                    cur.win_count += d.win_count;
+                }
+                return;
+            }
+            trim_locked();//写回成功，这一批用户都没有未写回的增量了，可以淘汰
+            lock.unlock();
+            _flushes++;
+            _last_batch = batch.size();
+            if (batch.size() > _max_batch) {
+                _max_batch = batch.size();
+            }
+            _last_lag_ms = time_util::now_ms() - since_ms;
+        }
+        /*缓存统计：命中率、写回延迟（最早的增量产生到写回完成）、写回批量大小*/
+        void stats(Json::Value &val) {
+            uint64_t hits = _hits, misses = _misses;
+            val["hits"] = (Json::UInt64)hits;
+            val["misses"] = (Json::UInt64)misses;
+            val["hit_ratio"] = hits + misses == 0 ? 0.0 : (double)hits / (hits + misses);
+            val["write_behind"] = _write_behind;
+            val["flushes"] = (Json::UInt64)_flushes;
+            val["flush_lag_ms"] = (Json::UInt64)_last_lag_ms;
+            val["last_batch"] = (Json::UInt64)_last_batch;
+            val["max_batch"] = (Json::UInt64)_max_batch;
+            val["evictions"] = (Json::UInt64)_evictions;
+            std::unique_lock<std::mutex> lock(_mutex);
+            val["size"] = (Json::UInt64)_users.size();
+            val["dirty"] = (Json::UInt64)_dirty.size();
+        }
+};
+#endif
@@ -2,36 +2,273 @@
 #define __M_DB_H__
 #include "util.hpp"
 #include <mutex>
+#include <condition_variable>
 #include <cassert>
+#include <algorithm>
+#include <mysql/errmsg.h>
 
+#define DB_POOL_SIZE 8 //数据库连接池中的连接数量
+#define DB_NAME_LEN 256 //查询结果中用户名的缓冲区大小
+/*连接参数以及每个连接上需要预处理的sql语句*/
+struct mysql_conf {
+     std::string host;
+     std::string username;
+     std::string password;
+     std::string dbname;
+     uint16_t port;
+     std::vector<std::string> stmts;
+};
+/*一个mysql连接以及在这个连接上预处理好的语句，预处理语句和连接绑定，重连后需要重新预处理*/
+class mysql_conn {
+   private:
+          const mysql_conf *_conf;
+          MYSQL *_mysql;
+          std::vector<MYSQL_STMT *> _stmts;
+   public:
+          mysql_conn(const mysql_conf *conf): _conf(conf), _mysql(NULL) {}
+          ~mysql_conn() { close(); }
+          bool open() {
+               _mysql = mysql_util::mysql_create(_conf->host, _conf->username, _conf->password,
+                    _conf->dbname, _conf->port);
+               if (_mysql == NULL) {
+                    return false;
+               }
+               for (auto &sql : _conf->stmts) {
+                    MYSQL_STMT *stmt = mysql_stmt_init(_mysql);
+                    if (stmt == NULL || mysql_stmt_prepare(stmt, sql.c_str(), sql.size()) != 0) {
+                         ELOG("prepare [%s] failed: %s", sql.c_str(), mysql_error(_mysql));
+                         if (stmt != NULL) {
+                              mysql_stmt_close(stmt);
+                         }
+                         close();
+                         return false;
+                    }
+                    _stmts.push_back(stmt);
+               }
+               return true;
+          }
+          void close() {
+               for (auto stmt : _stmts) {
+                    mysql_stmt_close(stmt);
+               }
+               _stmts.clear();
+               mysql_util::mysql_destroy(_mysql);
+               _mysql = NULL;
+          }
+          bool reconnect() {
+               close();
+               return open();
+          }
+          MYSQL *handle() { return _mysql; }
+          //获取预处理语句，连接之前断开了则先尝试重连
+          MYSQL_STMT *stmt(int id) {
+               if (_mysql == NULL && open() == false) {
+                    return NULL;
+               }
+               return _stmts[id];
+          }
+};
+/*有界连接池：连接在构造时全部建立，没有空闲连接时调用者阻塞等待*/
+class mysql_pool {
+   private:
+          mysql_conf _conf;
+          std::vector<std::unique_ptr<mysql_conn>> _conns;
+          std::vector<mysql_conn *> _idle;
+          std::mutex _mutex;
+          std::condition_variable _cond;
+   public:
+          mysql_pool(const mysql_conf &conf, size_t size): _conf(conf) {
+               for (size_t i = 0; i < size; i++) {
+                    std::unique_ptr<mysql_conn> conn(new mysql_conn(&_conf));
+                    if (conn->open() == false) {
+                         //连接失败的先放入池中，使用时会自动重连
+                         ELOG("mysql pool connection %lu open failed", i);
+                    }
+                    _idle.push_back(conn.get());
+                    _conns.push_back(std::move(conn));
+               }
+          }
+          size_t size() { return _conns.size(); }
+          mysql_conn *acquire() {
+               std::unique_lock<std::mutex> lock(_mutex);
+               _cond.wait(lock, [this]() { return !_idle.empty(); });
+               mysql_conn *conn = _idle.back();
+               _idle.pop_back();
+               return conn;
+          }
+          void release(mysql_conn *conn) {
+               std::unique_lock<std::mutex> lock(_mutex);
+               _idle.push_back(conn);
+               _cond.notify_one();
+          }
+};
+/*从连接池借出一个连接，出作用域自动归还*/
+class mysql_guard {
+   private:
+          mysql_pool *_pool;
+          mysql_conn *_conn;
+   public:
+          mysql_guard(mysql_pool *pool): _pool(pool), _conn(pool->acquire()) {}
+          ~mysql_guard() { _pool->release(_conn); }
+          mysql_conn *operator->() { return _conn; }
+};
+
+/*一个用户的战绩增量，用于批量写回*/
+struct user_delta {
+     uint64_t id;
+     int score;
+     int total_count;
+     int win_count;
+};
+/*一局对局的结果*/
+struct game_result {
+     uint64_t winner;
+     uint64_t loser;
+};
 class user_table{
    private:
-          MYSQL *_mysql; //mysql操作句柄
-          std::mutex _mutex;//互斥锁保护数据库的访问操作
+          //预处理语句编号，和下面的sql一一对应
+          enum { STMT_INSERT, STMT_LOGIN, STMT_BY_NAME, STMT_BY_ID, STMT_WIN, STMT_LOSE };
+          mysql_pool _pool;
+   private:
+          static mysql_conf make_conf(const std::string &host, const std::string &username,
+               const std::string &password, const std::string &dbname, uint16_t port) {
+               mysql_conf conf;
+               conf.host = host;
+               conf.username = username;
+               conf.password = password;
+               conf.dbname = dbname;
+               conf.port = port;
+               //注册时新增用户
+               conf.stmts.push_back("insert user values(null, ?, ?, 1000, 0, 0);");
+               //以用户名和密码共同作为查询过滤条件，查询到数据则表示用户名密码一致，没有信息则用户名密码错误
+               conf.stmts.push_back("select id, score, total_count, win_count from user where username=? and password=?;");
+               conf.stmts.push_back("select id, score, total_count, win_count from user where username=?;");
+               conf.stmts.push_back("select username, score, total_count, win_count from user where id=?;");
+               //胜利时天梯分数增加30分，战斗场次增加1，胜利场次增加1
+               conf.stmts.push_back("update user set score=score+30, total_count=total_count+1, win_count=win_count+1 where id=?;");
+               //失败时天梯分数减少30，战斗场次增加1，其他不变
+               conf.stmts.push_back("update user set score=score-30, total_count=total_count+1 where id=?;");
+               return conf;
+          }
+          /*执行预处理语句：连接断开时重连并重试一次
+           *results不为空则取出结果集的第一行到results绑定的内存中，rows返回结果行数或者影响行数*/
+          bool stmt_exec(int id, MYSQL_BIND *params, MYSQL_BIND *results, uint64_t &rows) {
+               mysql_guard conn(&_pool);
+               return stmt_exec(conn, id, params, results, rows, true);
+          }
+          //在指定连接上执行，事务中执行时不能重连重试（断线后事务已经被服务端回滚）
+          bool stmt_exec(mysql_guard &conn, int id, MYSQL_BIND *params, MYSQL_BIND *results,
+               uint64_t &rows, bool can_retry) {
+               for (int retry = 0; retry < 2; retry++) {
+                    MYSQL_STMT *stmt = conn->stmt(id);
+                    if (stmt == NULL) {
+                         ELOG("mysql connection unavailable");
+                         return false;
+                    }
+                    if (mysql_stmt_bind_param(stmt, params) != 0 || mysql_stmt_execute(stmt) != 0) {
+                         unsigned int err = mysql_stmt_errno(stmt);
+                         if (can_retry && retry == 0 && (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)) {
+                              ELOG("mysql connection lost, reconnecting: %s", mysql_stmt_error(stmt));
+                              conn->reconnect();
+                              continue;
+                         }
+                         DLOG("stmt %d execute failed: %s", id, mysql_stmt_error(stmt));
+                         return false;
+                    }
+                    if (results == NULL) {
+                         rows = mysql_stmt_affected_rows(stmt);
+                         return true;
+                    }
+                    if (mysql_stmt_bind_result(stmt, results) != 0 || mysql_stmt_store_result(stmt) != 0) {
+                         ELOG("stmt %d store result failed: %s", id, mysql_stmt_error(stmt));
+                         mysql_stmt_free_result(stmt);
+                         return false;
+                    }
+                    rows = mysql_stmt_num_rows(stmt);
+                    bool ret = true;
+                    if (rows > 0) {
+                         int fret = mysql_stmt_fetch(stmt);
+                         ret = (fret == 0 || fret == MYSQL_DATA_TRUNCATED);
+                    }
+                    mysql_stmt_free_result(stmt);
+                    return ret;
+               }
+               return false;
+          }
+          /*查询用户的score, total_count, win_count三列结果*/
+          struct user_stat {
+               int score;
+               int total_count;
+               int win_count;
+          };
+          static void bind_stat(MYSQL_BIND *bind, user_stat &st) {
+               mysql_util::bind_int(bind[0], &st.score);
+               mysql_util::bind_int(bind[1], &st.total_count);
+               mysql_util::bind_int(bind[2], &st.win_count);
+          }
+          static void fill_stat(const user_stat &st, Json::Value &user) {
+               user["score"] = (Json::UInt64)st.score;
+               user["total_count"] = st.total_count;
+               user["win_count"] = st.win_count;
+          }
+          bool update_by_id(int stmt_id, uint64_t id) {
+               MYSQL_BIND param[1];
+               mysql_util::bind_u64(param[0], &id);
+               uint64_t rows = 0;
+               return stmt_exec(stmt_id, param, NULL, rows);
+          }
+          bool update_by_id(mysql_guard &conn, int stmt_id, uint64_t id) {
+               MYSQL_BIND param[1];
+               mysql_util::bind_u64(param[0], &id);
+               uint64_t rows = 0;
+               return stmt_exec(conn, stmt_id, param, NULL, rows, false);
+          }
+          /*执行一条不需要结果集的普通sql，语句只包含数字时使用（没有用户输入，不需要预处理）*/
+          bool query_exec(const std::string &sql) {
+               mysql_guard conn(&_pool);
+               for (int retry = 0; retry < 2; retry++) {
+                    if (conn->handle() == NULL && conn->reconnect() == false) {
+                         ELOG("mysql connection unavailable");
+                         return false;
+                    }
+                    if (mysql_util::mysql_exec(conn->handle(), sql)) {
+                         return true;
+                    }
+                    unsigned int err = mysql_errno(conn->handle());
+                    if (retry == 0 && (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)) {
+                         conn->reconnect();
+                         continue;
+                    }
+                    return false;
+               }
+               return false;
+          }
    public:
           user_table(const std::string &host,
                const std::string &username,
                const std::string &password,
                const std::string &dbname,
-               uint16_t port = 3306) {
-               _mysql = mysql_util::mysql_create(host, username, password, dbname, port);
-               assert(_mysql != NULL);
-          }
-          ~user_table() {
-               mysql_util::mysql_destroy(_mysql);
-               _mysql = NULL;
+               uint16_t port = 3306,
+               size_t pool_size = DB_POOL_SIZE):
+               _pool(make_conf(host, username, password, dbname, port), pool_size) {
+               assert(_pool.size() > 0);
           }
           //注册时新增用户。注册用户，插入username和password到数据库。
           bool insert(Json::Value &user) {
-#define INSERT_USER "insert user values(null, '%s', '%s', 1000, 0, 0);"//宏定义
-               // sprintf(void *buf, char *format, ...)
                if (user["password"].isNull() || user["username"].isNull()) {//判断用户名和密码是否为空，校验
                     DLOG("INPUT PASSWORD OR USERNAME");
                     return false;
                }
-               char sql[4096] = {0};
-               sprintf(sql, INSERT_USER, user["username"].asCString(), user["password"].asCString());               bool ret = mysql_util::mysql_exec(_mysql, sql);
-               if (ret == false) {
+               std::string name = user["username"].asString();
+               std::string pass = user["password"].asString();
+               unsigned long name_len = name.size(), pass_len = pass.size();
+               MYSQL_BIND params[2];
+               mysql_util::bind_str(params[0], &name[0], name_len, &name_len);
+               mysql_util::bind_str(params[1], &pass[0], pass_len, &pass_len);
+               uint64_t rows = 0;
+               bool ret = stmt_exec(STMT_INSERT, params, NULL, rows);
+               if (ret == false || rows != 1) {
                     DLOG("insert user info failed!!\n");
                     return false;
                }
@@ -43,112 +280,86 @@ class user_table{
                     DLOG("INPUT PASSWORD OR USERNAME");
                     return false;
                }
-               //以用户名和密码共同作为查询过滤条件，查询到数据则表示用户名密码一致，没有信息则用户名密码错误
-#define LOGIN_USER "select id, score, total_count, win_count from user where username='%s' and password='%s';"
-               char sql[4096] = {0};
-               sprintf(sql, LOGIN_USER, user["username"].asCString(), user["password"].asCString());
-               MYSQL_RES *res = NULL;//
-               {//形成局部空间，在空间内都是锁进行管理，局部作用域，出作用域后自动解锁，
-                    std::unique_lock<std::mutex> lock(_mutex);//定义一个锁管理器，在查询语句中涉及进程安全，两个原子语句执行中间可能会受其他进程影响，得加锁
-                    bool ret = mysql_util::mysql_exec(_mysql, sql);
-                    if (ret == false) {
-                         DLOG("user login failed!!\n");
-                         return false;
-                    }
-                    //按理说要么有数据，要么没有数据，就算有数据也只能有一条数据
-                    res = mysql_store_result(_mysql);//但是这样会导致res变为局部变量外面无法访问，所以在前面将res放外面
-                    if (res == NULL) {
-                         DLOG("have no login user info!!");
-                         return false;
-                    }
+               std::string name = user["username"].asString();
+               std::string pass = user["password"].asString();
+               unsigned long name_len = name.size(), pass_len = pass.size();
+               MYSQL_BIND params[2];
+               mysql_util::bind_str(params[0], &name[0], name_len, &name_len);
+               mysql_util::bind_str(params[1], &pass[0], pass_len, &pass_len);
+               uint64_t id = 0;
+               user_stat st;
+               MYSQL_BIND results[4];
+               mysql_util::bind_u64(results[0], &id);
+               bind_stat(results + 1, st);
+               uint64_t rows = 0;
+               bool ret = stmt_exec(STMT_LOGIN, params, results, rows);
+               if (ret == false) {
+                    DLOG("user login failed!!\n");
+                    return false;
                }
-               int row_num = mysql_num_rows(res);
-               if (row_num != 1) {
+               //按理说要么有数据，要么没有数据，就算有数据也只能有一条数据
+               if (rows != 1) {
                     DLOG("the user information queried is not unique!!");
                     return false;
                }
-               MYSQL_ROW row = mysql_fetch_row(res);
-               user["id"] = (Json::UInt64)std::stol(row[0]);
-               user["score"] = (Json::UInt64)std::stol(row[1]);
-               user["total_count"] = std::stoi(row[2]);
-               user["win_count"] = std::stoi(row[3]);
-               mysql_free_result(res);
+               user["id"] = (Json::UInt64)id;
+               fill_stat(st, user);
                return true;
           }
           // 通过用户名获取用户信息
           bool select_by_name(const std::string &name, Json::Value &user) {
-#define USER_BY_NAME "select id, score, total_count, win_count from user where username='%s';"
-               char sql[4096] = {0};
-               sprintf(sql, USER_BY_NAME, name.c_str());
-               MYSQL_RES *res = NULL;
-               {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    bool ret = mysql_util::mysql_exec(_mysql, sql);
-                    if (ret == false) {
-                         DLOG("get user by name failed!!\n");
-                         return false;
-                    }
-                    //按理说要么有数据，要么没有数据，就算有数据也只能有一条数据
-                    res = mysql_store_result(_mysql);
-                    if (res == NULL) {
-                         DLOG("have no user info!!");
-                         return false;
-                    }
+               std::string tmp = name;
+               unsigned long name_len = tmp.size();
+               MYSQL_BIND params[1];
+               mysql_util::bind_str(params[0], &tmp[0], name_len, &name_len);
+               uint64_t id = 0;
+               user_stat st;
+               MYSQL_BIND results[4];
+               mysql_util::bind_u64(results[0], &id);
+               bind_stat(results + 1, st);
+               uint64_t rows = 0;
+               bool ret = stmt_exec(STMT_BY_NAME, params, results, rows);
+               if (ret == false) {
+                    DLOG("get user by name failed!!\n");
+                    return false;
                }
-               int row_num = mysql_num_rows(res);
-               if (row_num != 1) {
+               if (rows != 1) {
                     DLOG("the user information queried is not unique!!");
                     return false;
                }
-               MYSQL_ROW row = mysql_fetch_row(res);
-               user["id"] = (Json::UInt64)std::stol(row[0]);//Json::UInt64是一个无符号整数类型，表示64位无符号整数,强制转换为了无符号整数类型
+               user["id"] = (Json::UInt64)id;//Json::UInt64是一个无符号整数类型，表示64位无符号整数,强制转换为了无符号整数类型
                user["username"] = name;
-               user["score"] = (Json::UInt64)std::stol(row[1]);
-               user["total_count"] = std::stoi(row[2]);//std::stoi是一个函数，用于将字符串转换为整数
-               user["win_count"] = std::stoi(row[3]);
-               mysql_free_result(res);
+               fill_stat(st, user);
                return true;
           }
-          // 通过用户名获取用户信息
+          // 通过用户ID获取用户信息
           bool select_by_id(uint64_t id, Json::Value &user) {
-#define USER_BY_ID "select username, score, total_count, win_count from user where id=%lu;"
-               char sql[4096] = {0};
-               sprintf(sql, USER_BY_ID, id);
-               MYSQL_RES *res = NULL;
-               {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    bool ret = mysql_util::mysql_exec(_mysql, sql);
-                    if (ret == false) {
-                         DLOG("get user by id failed!!\n");
-                         return false;
-                    }
-                    //按理说要么有数据，要么没有数据，就算有数据也只能有一条数据
-                    res = mysql_store_result(_mysql);
-                    if (res == NULL) {
-                         DLOG("have no user info!!");
-                         return false;
-                    }
+               MYSQL_BIND params[1];
+               mysql_util::bind_u64(params[0], &id);
+               char name[DB_NAME_LEN] = {0};
+               unsigned long name_len = 0;
+               user_stat st;
+               MYSQL_BIND results[4];
+               mysql_util::bind_str(results[0], name, sizeof(name) - 1, &name_len);
+               bind_stat(results + 1, st);
+               uint64_t rows = 0;
+               bool ret = stmt_exec(STMT_BY_ID, params, results, rows);
+               if (ret == false) {
+                    DLOG("get user by id failed!!\n");
+                    return false;
                }
-               int row_num = mysql_num_rows(res);
-               if (row_num != 1) {
+               if (rows != 1) {
                     DLOG("the user information queried is not unique!!");
                     return false;
                }
-               MYSQL_ROW row = mysql_fetch_row(res);
                user["id"] = (Json::UInt64)id;
-               user["username"] = row[0];
-               user["score"] = (Json::UInt64)std::stol(row[1]);
-               user["total_count"] = std::stoi(row[2]);
-               user["win_count"] = std::stoi(row[3]);
-               mysql_free_result(res);
+               user["username"] = std::string(name, std::min<unsigned long>(name_len, sizeof(name) - 1));
+               fill_stat(st, user);
                return true;
           }
           //胜利时天梯分数增加30分，战斗场次增加1，胜利场次增加1
           bool win(uint64_t id) {
-#define USER_WIN "update user set score=score+30, total_count=total_count+1, win_count=win_count+1 where id=%lu;"
-               char sql[4096] = {0};
-               sprintf(sql, USER_WIN, id);
-               bool ret = mysql_util::mysql_exec(_mysql, sql);
+               bool ret = update_by_id(STMT_WIN, id);
                if (ret == false) {
                     DLOG("update win user info failed!!\n");
                     return false;
@@ -157,15 +368,69 @@ class user_table{
           }
           //失败时天梯分数减少30，战斗场次增加1，其他不变
           bool lose(uint64_t id) {
-#define USER_LOSE "update user set score=score-30, total_count=total_count+1 where id=%lu;"
-               char sql[4096] = {0};
-               sprintf(sql, USER_LOSE, id);
-               bool ret = mysql_util::mysql_exec(_mysql, sql);//执行sql语句
+               bool ret = update_by_id(STMT_LOSE, id);
                if (ret == false) {
                     DLOG("update lose user info failed!!\n");
                     return false;
                }
                return true;
           }
+          //对局结算：在一个事务中提交多局对局的胜负结果，要么全部生效，要么全部不生效
+          bool settle(const std::vector<game_result> &results) {
+               if (results.empty()) {
+                    return true;
+               }
+               mysql_guard conn(&_pool);
+               if (conn->handle() == NULL && conn->reconnect() == false) {
+                    ELOG("mysql connection unavailable");
+                    return false;
+               }
+               if (mysql_util::mysql_exec(conn->handle(), "start transaction;") == false) {
+                    //连接可能已经断开，重连后再开启一次事务
+                    if (conn->reconnect() == false || mysql_util::mysql_exec(conn->handle(), "start transaction;") == false) {
+                         return false;
+                    }
+               }
+               for (auto &r : results) {
+                    if (update_by_id(conn, STMT_WIN, r.winner) == false ||
+                        update_by_id(conn, STMT_LOSE, r.loser) == false) {
+                         DLOG("settle game result failed, rollback!!\n");
+                         mysql_util::mysql_exec(conn->handle(), "rollback;");
+                         return false;
+                    }
+               }
+               if (mysql_util::mysql_exec(conn->handle(), "commit;") == false) {
+                    mysql_util::mysql_exec(conn->handle(), "rollback;");
+                    return false;
+               }
+               return true;
+          }
+          //多个用户的战绩增量合并为一条多行update语句写回
+          bool batch_update(const std::vector<user_delta> &deltas) {
+               if (deltas.empty()) {
+                    return true;
+               }
+               std::string score = "score=score+case id", total = "total_count=total_count+case id";
+               std::string win = "win_count=win_count+case id", ids;
+               char buf[128];
+               for (auto &d : deltas) {
+                    snprintf(buf, sizeof(buf), " when %lu then %d", d.id, d.score);
+                    score += buf;
+                    snprintf(buf, sizeof(buf), " when %lu then %d", d.id, d.total_count);
+                    total += buf;
+                    snprintf(buf, sizeof(buf), " when %lu then %d", d.id, d.win_count);
+                    win += buf;
+                    snprintf(buf, sizeof(buf), "%s%lu", ids.empty() ? "" : ",", d.id);
+                    ids += buf;
+               }
+               std::string sql = "update user set " + score + " else 0 end, " + total + " else 0 end, " +
+                    win + " else 0 end where id in (" + ids + ");";
+               bool ret = query_exec(sql);
+               if (ret == false) {
+                    DLOG("batch update user info failed!!\n");
+                    return false;
+               }
+               return true;
+          }
 };
-#endif
\ No newline at end of file
+#endif
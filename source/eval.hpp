@@ -0,0 +1,208 @@
+#ifndef __M_EVAL_H__
+#define __M_EVAL_H__
+#include "board.hpp"
+#include <immintrin.h>
+
+#define EVAL_LINES (BOARD_ROW + BOARD_COL + 2 * BOARD_LINE) //四个方向所有的线（88条，长度不少于5的有72条）
+#define EVAL_LANES 96 //按16条一组补齐，补齐的线有效位为0
+#define EVAL_WINDOWS (BOARD_COL - 4) //每条线上最多11个窗口
+
+/*一条线的评估结果：只包含一种颜色棋子的5格窗口按棋子数计分，并统计4子/3子窗口的数量*/
+struct line_eval {
+    int score[2];//[0]白 [1]黑
+    int fours[2];//4子+1空的窗口数量
+    int threes[2];//3子+2空的窗口数量
+};
+
+/*线型评估：
+ *  把棋盘上88条线的白/黑掩码按线编号排成连续的16位数组，每条线是一个"通道"，
+ *  SSE2一次处理8条线、AVX2一次处理16条线，11个窗口位置对所有通道同时做移位、取5位、popcount和查表，
+ *  不需要按线、按窗口逐个循环；落子时只需要重新评估经过该点的4条线，正好放进一个SSE2寄存器
+ *标量实现作为参考，结果必须与向量实现完全一致*/
+class pattern_eval {
+    public:
+        //窗口中有c个同色棋子的得分，5子由搜索直接判定胜负
+        static int window_value(int c) {
+            static const int values[6] = {0, 1, 12, 120, 1200, 0};
+            return values[c];
+        }
+        /*dir方向第idx条线的全局编号：横线、竖线、正斜线、反斜线依次排列*/
+        static int line_id(int dir, int idx) {
+            static const int base[LINE_DIRS] = {0, BOARD_ROW, BOARD_ROW + BOARD_COL, BOARD_ROW + BOARD_COL + BOARD_LINE};
+            return base[dir] + idx;
+        }
+        /*每条线有效位的掩码，斜线两端不足15个位置*/
+        static const uint16_t *valid_masks() {
+            static uint16_t masks[EVAL_LANES];
+            static bool inited = [] {
+                memset(masks, 0, sizeof(masks));
+                for (int d = 0; d < LINE_DIRS; d++) {
+                    for (int i = 0; i < board::line_count(d); i++) {
+                        int lo, hi;
+                        board::line_range(d, i, lo, hi);
+                        masks[line_id(d, i)] = (uint16_t)(((1u << (hi + 1)) - 1) & ~((1u << lo) - 1));
+                    }
+                }
+                return true;
+            }();
+            (void)inited;
+            return masks;
+        }
+        /*取出棋盘上所有线的白/黑掩码，数组长度至少EVAL_LANES，补齐部分清零*/
+        static void extract(const board &b, uint16_t *w, uint16_t *k) {
+            memset(w, 0, EVAL_LANES * sizeof(uint16_t));
+            memset(k, 0, EVAL_LANES * sizeof(uint16_t));
+            for (int d = 0; d < LINE_DIRS; d++) {
+                for (int i = 0; i < board::line_count(d); i++) {
+                    w[line_id(d, i)] = b.line_mask(CHESS_WHITE, d, i);
+                    k[line_id(d, i)] = b.line_mask(CHESS_BLACK, d, i);
+                }
+            }
+        }
+        /*标量参考实现：逐个窗口评估一条线*/
+        static void eval_scalar(uint16_t w, uint16_t k, uint16_t valid, line_eval &le) {
+            memset(&le, 0, sizeof(le));
+            for (int s = 0; s < EVAL_WINDOWS; s++) {
+                if (((valid >> s) & 0x1F) != 0x1F) {
+                    continue;
+                }
+                int wm = (w >> s) & 0x1F, km = (k >> s) & 0x1F;
+                if (wm && km) {
+                    continue;
+                }
+                int c = __builtin_popcount(wm | km);
+                int i = wm ? 0 : 1;
+                le.score[i] += window_value(c);
+                le.fours[i] += (c == 4);
+                le.threes[i] += (c == 3);
+            }
+        }
+        static void eval_lines_scalar(const uint16_t *w, const uint16_t *k, const uint16_t *v, int n, line_eval *out) {
+            for (int i = 0; i < n; i++) {
+                eval_scalar(w[i], k[i], v[i], out[i]);
+            }
+        }
+        /*SSE2：8条线一组，w/k/v的长度必须补齐到8的倍数*/
+        static void eval_lines_sse2(const uint16_t *w, const uint16_t *k, const uint16_t *v, int n, line_eval *out) {
+            const __m128i m5 = _mm_set1_epi16(0x1F), zero = _mm_setzero_si128();
+            const __m128i c1 = _mm_set1_epi16(1), c2 = _mm_set1_epi16(2), c3 = _mm_set1_epi16(3), c4 = _mm_set1_epi16(4);
+            const __m128i v1 = _mm_set1_epi16(window_value(1)), v2 = _mm_set1_epi16(window_value(2));
+            const __m128i v3 = _mm_set1_epi16(window_value(3)), v4 = _mm_set1_epi16(window_value(4));
+            for (int base = 0; base < n; base += 8) {
+                __m128i W = _mm_loadu_si128((const __m128i *)(w + base));
+                __m128i K = _mm_loadu_si128((const __m128i *)(k + base));
+                __m128i V = _mm_loadu_si128((const __m128i *)(v + base));
+                __m128i acc[2][3] = {{zero, zero, zero}, {zero, zero, zero}};
+                for (int s = 0; s < EVAL_WINDOWS; s++) {
+                    __m128i sh = _mm_cvtsi32_si128(s);
+                    __m128i wm = _mm_and_si128(_mm_srl_epi16(W, sh), m5);
+                    __m128i km = _mm_and_si128(_mm_srl_epi16(K, sh), m5);
+                    __m128i ok = _mm_cmpeq_epi16(_mm_and_si128(_mm_srl_epi16(V, sh), m5), m5);
+                    __m128i masks[2] = {wm, km};
+                    __m128i only[2] = {_mm_and_si128(ok, _mm_cmpeq_epi16(km, zero)),
+                                       _mm_and_si128(ok, _mm_cmpeq_epi16(wm, zero))};
+                    for (int i = 0; i < 2; i++) {
+                        //5位以内的popcount：两位一组相加，再四位一组相加，最后加上第5位
+                        __m128i x = masks[i];
+                        x = _mm_sub_epi16(x, _mm_and_si128(_mm_srli_epi16(x, 1), _mm_set1_epi16(0x5)));
+                        x = _mm_add_epi16(_mm_and_si128(x, _mm_set1_epi16(0x13)), _mm_and_si128(_mm_srli_epi16(x, 2), _mm_set1_epi16(0x3)));
+                        x = _mm_add_epi16(_mm_and_si128(x, _mm_set1_epi16(0x7)), _mm_srli_epi16(x, 4));
+                        __m128i e1 = _mm_cmpeq_epi16(x, c1), e2 = _mm_cmpeq_epi16(x, c2);
+                        __m128i e3 = _mm_cmpeq_epi16(x, c3), e4 = _mm_cmpeq_epi16(x, c4);
+                        __m128i val = _mm_or_si128(_mm_or_si128(_mm_and_si128(e1, v1), _mm_and_si128(e2, v2)),
+                                                   _mm_or_si128(_mm_and_si128(e3, v3), _mm_and_si128(e4, v4)));
+                        acc[i][0] = _mm_add_epi16(acc[i][0], _mm_and_si128(only[i], val));
+                        acc[i][1] = _mm_sub_epi16(acc[i][1], _mm_and_si128(only[i], e4));//比较结果为-1，减去即加1
+                        acc[i][2] = _mm_sub_epi16(acc[i][2], _mm_and_si128(only[i], e3));
+                    }
+                }
+                store(acc[0], acc[1], base, n, out, 8);
+            }
+        }
+        /*AVX2：16条线一组，w/k/v的长度必须补齐到16的倍数*/
+        __attribute__((target("avx2")))
+        static void eval_lines_avx2(const uint16_t *w, const uint16_t *k, const uint16_t *v, int n, line_eval *out) {
+            const __m256i m5 = _mm256_set1_epi16(0x1F), zero = _mm256_setzero_si256();
+            const __m256i c1 = _mm256_set1_epi16(1), c2 = _mm256_set1_epi16(2), c3 = _mm256_set1_epi16(3), c4 = _mm256_set1_epi16(4);
+            const __m256i v1 = _mm256_set1_epi16(window_value(1)), v2 = _mm256_set1_epi16(window_value(2));
+            const __m256i v3 = _mm256_set1_epi16(window_value(3)), v4 = _mm256_set1_epi16(window_value(4));
+            for (int base = 0; base < n; base += 16) {
+                __m256i W = _mm256_loadu_si256((const __m256i *)(w + base));
+                __m256i K = _mm256_loadu_si256((const __m256i *)(k + base));
+                __m256i V = _mm256_loadu_si256((const __m256i *)(v + base));
+                __m256i acc[2][3] = {{zero, zero, zero}, {zero, zero, zero}};
+                for (int s = 0; s < EVAL_WINDOWS; s++) {
+                    __m128i sh = _mm_cvtsi32_si128(s);
+                    __m256i wm = _mm256_and_si256(_mm256_srl_epi16(W, sh), m5);
+                    __m256i km = _mm256_and_si256(_mm256_srl_epi16(K, sh), m5);
+                    __m256i ok = _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_srl_epi16(V, sh), m5), m5);
+                    __m256i masks[2] = {wm, km};
+                    __m256i only[2] = {_mm256_and_si256(ok, _mm256_cmpeq_epi16(km, zero)),
+                                       _mm256_and_si256(ok, _mm256_cmpeq_epi16(wm, zero))};
+                    for (int i = 0; i < 2; i++) {
+                        __m256i x = masks[i];
+                        x = _mm256_sub_epi16(x, _mm256_and_si256(_mm256_srli_epi16(x, 1), _mm256_set1_epi16(0x5)));
+                        x = _mm256_add_epi16(_mm256_and_si256(x, _mm256_set1_epi16(0x13)), _mm256_and_si256(_mm256_srli_epi16(x, 2), _mm256_set1_epi16(0x3)));
+                        x = _mm256_add_epi16(_mm256_and_si256(x, _mm256_set1_epi16(0x7)), _mm256_srli_epi16(x, 4));
+                        __m256i e1 = _mm256_cmpeq_epi16(x, c1), e2 = _mm256_cmpeq_epi16(x, c2);
+                        __m256i e3 = _mm256_cmpeq_epi16(x, c3), e4 = _mm256_cmpeq_epi16(x, c4);
+                        __m256i val = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(e1, v1), _mm256_and_si256(e2, v2)),
+                                                      _mm256_or_si256(_mm256_and_si256(e3, v3), _mm256_and_si256(e4, v4)));
+                        acc[i][0] = _mm256_add_epi16(acc[i][0], _mm256_and_si256(only[i], val));
+                        acc[i][1] = _mm256_sub_epi16(acc[i][1], _mm256_and_si256(only[i], e4));
+                        acc[i][2] = _mm256_sub_epi16(acc[i][2], _mm256_and_si256(only[i], e3));
+                    }
+                }
+                __m128i lo[2][3], hi[2][3];
+                for (int i = 0; i < 2; i++) {
+                    for (int j = 0; j < 3; j++) {
+                        lo[i][j] = _mm256_castsi256_si128(acc[i][j]);
+                        hi[i][j] = _mm256_extracti128_si256(acc[i][j], 1);
+                    }
+                }
+                store(lo[0], lo[1], base, n, out, 8);
+                if (base + 8 < n) {
+                    store(hi[0], hi[1], base + 8, n, out, 8);
+                }
+            }
+        }
+        static bool has_avx2() {
+            static bool avx2 = __builtin_cpu_supports("avx2");
+            return avx2;
+        }
+        /*评估n条线，按CPU支持选择实现，输入数组补齐到16的倍数*/
+        static void eval_lines(const uint16_t *w, const uint16_t *k, const uint16_t *v, int n, line_eval *out) {
+            if (n > 8 && has_avx2()) {
+                return eval_lines_avx2(w, k, v, n, out);
+            }
+            return eval_lines_sse2(w, k, v, n, out);
+        }
+        /*评估整个棋盘，out按line_id编号，长度至少EVAL_LINES*/
+        static void eval_board(const board &b, line_eval *out) {
+            alignas(32) uint16_t w[EVAL_LANES], k[EVAL_LANES];
+            extract(b, w, k);
+            eval_lines(w, k, valid_masks(), EVAL_LINES, out);
+        }
+        static void eval_board_scalar(const board &b, line_eval *out) {
+            alignas(32) uint16_t w[EVAL_LANES], k[EVAL_LANES];
+            extract(b, w, k);
+            eval_lines_scalar(w, k, valid_masks(), EVAL_LINES, out);
+        }
+    private:
+        static void store(const __m128i *white, const __m128i *black, int base, int n, line_eval *out, int lanes) {
+            alignas(16) int16_t v[2][3][8];
+            for (int j = 0; j < 3; j++) {
+                _mm_store_si128((__m128i *)v[0][j], white[j]);
+                _mm_store_si128((__m128i *)v[1][j], black[j]);
+            }
+            for (int l = 0; l < lanes && base + l < n; l++) {
+                line_eval &le = out[base + l];
+                for (int i = 0; i < 2; i++) {
+                    le.score[i] = v[i][0][l];
+                    le.fours[i] = v[i][1][l];
+                    le.threes[i] = v[i][2][l];
+                }
+            }
+        }
+};
+#endif
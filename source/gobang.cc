@@ -1,10 +1,18 @@
 #include "server.hpp"
+#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <websocketpp/client.hpp>
+#include <sys/resource.h>
+#include <random>
+#include <algorithm>
+#include <malloc.h>
 
 #define HOST "127.0.0.1"
 #define PORT 3306
 #define USER "root"
 #define PASS "Gh12345."
 #define DBNAME "gobang"
+#define LOOP_THREADS 0
+#define LOG_FILE "./gobang.log" //日志文件，超过LOG_ROTATE_BYTES后轮转
 
 void mysql_test(){
     MYSQL*mysql=mysql_util::mysql_create(HOST,USER,PASS,DBNAME,PORT);
@@ -93,9 +101,1660 @@ void online_test()
     }
 
 }
+//原房间模块使用的二维数组棋盘+逐格扫描的胜负判断，作为位棋盘的对照组
+class vector_board {
+    private:
+        std::vector<std::vector<int>> _board;
+        bool five(int row, int col, int row_off, int col_off, int color) {
+            int count = 1;
+            int search_row = row + row_off;
+            int search_col = col + col_off;
+            while(search_row >= 0 && search_row < BOARD_ROW &&
+                  search_col >= 0 && search_col < BOARD_COL &&
+                  _board[search_row][search_col] == color) {
+                count++;
+                search_row += row_off;
+                search_col += col_off;
+            }
+            search_row = row - row_off;
+            search_col = col - col_off;
+            while(search_row >= 0 && search_row < BOARD_ROW &&
+                  search_col >= 0 && search_col < BOARD_COL &&
+                  _board[search_row][search_col] == color) {
+                count++;
+                search_row -= row_off;
+                search_col -= col_off;
+            }
+            return (count >= 5);
+        }
+    public:
+        vector_board(): _board(BOARD_ROW, std::vector<int>(BOARD_COL, 0)) {}
+        bool put(int row, int col, int color) {
+            _board[row][col] = color;
+            return five(row, col, 0, 1, color) || five(row, col, 1, 0, color) ||
+                   five(row, col, -1, 1, color) || five(row, col, -1, -1, color);
+        }
+};
+void board_bench()
+{
+    //1. 预先生成随机对局：打乱所有位置作为落子顺序，双方交替落子直到一方五连或者下满
+    const int games = 20000;
+    std::mt19937 rng(20250101);
+    std::vector<std::vector<uint8_t>> records;
+    std::vector<uint8_t> cells(BOARD_ROW * BOARD_COL);
+    for (size_t i = 0; i < cells.size(); i++) cells[i] = i;
+    size_t total_moves = 0;
+    for (int g = 0; g < games; g++) {
+        std::shuffle(cells.begin(), cells.end(), rng);
+        board b;
+        std::vector<uint8_t> moves;
+        for (size_t i = 0; i < cells.size(); i++) {
+            int color = i % 2 == 0 ? CHESS_WHITE : CHESS_BLACK;
+            b.put(cells[i] / BOARD_COL, cells[i] % BOARD_COL, color);
+            moves.push_back(cells[i]);
+            if (b.five(cells[i] / BOARD_COL, cells[i] % BOARD_COL, color)) break;
+        }
+        total_moves += moves.size();
+        records.push_back(moves);
+    }
+    //2. 两种实现分别重放全部对局（包括创建棋盘），每一步都做胜负判断
+    uint64_t start = time_util::now_us();
+    size_t vector_wins = 0;
+    for (auto &moves : records) {
+        vector_board vb;
+        for (size_t i = 0; i < moves.size(); i++) {
+            vector_wins += vb.put(moves[i] / BOARD_COL, moves[i] % BOARD_COL, i % 2 == 0 ? CHESS_WHITE : CHESS_BLACK);
+        }
+    }
+    uint64_t vector_us = time_util::now_us() - start;
+    start = time_util::now_us();
+    size_t board_wins = 0;
+    for (auto &moves : records) {
+        board b;
+        for (size_t i = 0; i < moves.size(); i++) {
+            int color = i % 2 == 0 ? CHESS_WHITE : CHESS_BLACK;
+            b.put(moves[i] / BOARD_COL, moves[i] % BOARD_COL, color);
+            board_wins += b.five(moves[i] / BOARD_COL, moves[i] % BOARD_COL, color);
+        }
+    }
+    uint64_t board_us = time_util::now_us() - start;
+    std::cout << "对局:" << games << " 总步数:" << total_moves << std::endl;
+    std::cout << "vector+five: " << vector_us << "us " << vector_us * 1000.0 / total_moves << "ns/步 胜局:" << vector_wins << std::endl;
+    std::cout << "board位棋盘: " << board_us << "us " << board_us * 1000.0 / total_moves << "ns/步 胜局:" << board_wins << std::endl;
+    std::cout << "棋盘对象大小: board=" << sizeof(board) << "字节" << std::endl;
+}
+//连接池压测：不同并发数下的登录QPS与p99延迟，需要本地mysql/mariadb中已经导入db.sql
+void db_pool_bench()
+{
+    user_table ut(HOST, USER, PASS, DBNAME, PORT);
+    Json::Value user;
+    user["username"] = "bench_user";
+    user["password"] = "bench_pass";
+    ut.insert(user);//已经存在时插入失败，不影响压测
+    const int callers[] = {1, 4, 16};
+    const int per_caller = 2000;
+    for (int n : callers) {
+        std::vector<std::vector<uint64_t>> lat(n);
+        std::vector<std::thread> threads;
+        uint64_t start = time_util::now_us();
+        for (int i = 0; i < n; i++) {
+            threads.push_back(std::thread([&ut, &lat, i, per_caller]() {
+                for (int k = 0; k < per_caller; k++) {
+                    Json::Value u;
+                    u["username"] = "bench_user";
+                    u["password"] = "bench_pass";
+                    uint64_t t = time_util::now_us();
+                    ut.login(u);
+                    lat[i].push_back(time_util::now_us() - t);
+                }
+            }));
+        }
+        for (auto &th : threads) th.join();
+        uint64_t cost_us = time_util::now_us() - start;
+        std::vector<uint64_t> all;
+        for (auto &v : lat) all.insert(all.end(), v.begin(), v.end());
+        std::sort(all.begin(), all.end());
+        std::cout << "并发:" << n << " QPS:" << all.size() * 1000000.0 / cost_us
+                  << " p50:" << all[all.size() / 2] << "us p99:" << all[all.size() * 99 / 100] << "us" << std::endl;
+    }
+}
+//撮合模拟：按泊松过程产生到达的玩家（分数正态分布），用虚拟时钟驱动撮合引擎，统计匹配等待时间和分差分布
+static uint64_t percentile(std::vector<uint64_t> &v, int p)
+{
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, v.size() * p / 100)];
+}
+void match_sim()
+{
+    const double rates[] = {0.2, 1, 5, 50};//每秒到达的玩家数量
+    const uint64_t duration_ms = 3600 * 1000;
+    for (double rate : rates) {
+        std::mt19937_64 rng(42);
+        std::exponential_distribution<double> gap(rate);
+        std::normal_distribution<double> score_dist(1500, 400);
+        match_engine engine;
+        std::unordered_map<uint64_t, std::pair<uint64_t, int>> arrivals;//uid -> (到达时间, 分数)
+        std::vector<uint64_t> waits, diffs;
+        double next_arrival = gap(rng) * 1000;
+        uint64_t next_uid = 1;
+        uint64_t tick_cost_us = 0, ticks = 0;
+        for (uint64_t now = 0; now < duration_ms; now += MATCH_TICK_MS) {
+            while (next_arrival < now + MATCH_TICK_MS) {
+                int score = std::max(0, (int)score_dist(rng));
+                uint64_t at = (uint64_t)next_arrival;
+                engine.add(next_uid, score, at);
+                arrivals[next_uid] = std::make_pair(at, score);
+                next_uid++;
+                next_arrival += gap(rng) * 1000;
+            }
+            std::vector<match_pair> pairs;
+            uint64_t t = time_util::now_us();
+            engine.tick(now + MATCH_TICK_MS, pairs);
+            tick_cost_us += time_util::now_us() - t;
+            ticks++;
+            for (auto &mp : pairs) {
+                waits.push_back(now + MATCH_TICK_MS - arrivals[mp.uid1].first);
+                waits.push_back(now + MATCH_TICK_MS - arrivals[mp.uid2].first);
+                diffs.push_back(std::abs(mp.score1 - mp.score2));
+            }
+        }
+        size_t matched = waits.size();
+        std::cout << "到达率:" << rate << "/s 到达:" << next_uid - 1 << " 匹配:" << matched
+                  << " 仍在等待:" << engine.size() << " 平均撮合耗时:" << tick_cost_us / (double)ticks << "us" << std::endl;
+        std::cout << "  等待时间(ms) p50:" << percentile(waits, 50) << " p90:" << percentile(waits, 90)
+                  << " p99:" << percentile(waits, 99) << std::endl;
+        std::cout << "  分差 p50:" << percentile(diffs, 50) << " p90:" << percentile(diffs, 90)
+                  << " p99:" << percentile(diffs, 99) << " max:" << percentile(diffs, 100) << std::endl;
+    }
+}
+//原来的单锁在线用户管理，作为分片+无锁读实现的对照组
+class mutex_online_manager {
+    private:
+        std::mutex _mutex;
+        std::unordered_map<uint64_t, wsserver_t::connection_ptr> _room_user;
+    public:
+        void enter_game_room(uint64_t uid, wsserver_t::connection_ptr &conn) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _room_user.insert(std::make_pair(uid, conn));
+        }
+        void exit_game_room(uint64_t uid) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _room_user.erase(uid);
+        }
+        bool is_in_game_room(uint64_t uid) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _room_user.find(uid) != _room_user.end();
+        }
+        wsserver_t::connection_ptr get_conn_from_room(uint64_t uid) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _room_user.find(uid);
+            return it == _room_user.end() ? wsserver_t::connection_ptr() : it->second;
+        }
+};
+//模拟走棋热路径：每步两次is_in_game_room+一次广播取连接，1%的操作是进出房间
+template <class OM>
+double online_bench_run(OM &om, int threads, int ops_per_thread)
+{
+    const uint64_t users = 10000;
+    wsserver_t::connection_ptr conn;
+    for (uint64_t uid = 1; uid <= users; uid++) om.enter_game_room(uid, conn);
+    std::vector<std::thread> ths;
+    std::atomic<uint64_t> found(0);
+    uint64_t start = time_util::now_us();
+    for (int t = 0; t < threads; t++) {
+        ths.push_back(std::thread([&om, &found, t, ops_per_thread, users]() {
+            std::mt19937_64 rng(t);
+            wsserver_t::connection_ptr c;
+            uint64_t hit = 0;
+            for (int i = 0; i < ops_per_thread; i++) {
+                uint64_t uid = rng() % users + 1;
+                if (i % 100 == 99) {
+                    om.exit_game_room(uid);
+                    om.enter_game_room(uid, c);
+                    continue;
+                }
+                hit += om.is_in_game_room(uid);
+                hit += om.is_in_game_room(uid + 1);
+                om.get_conn_from_room(uid);
+            }
+            found += hit;
+        }));
+    }
+    for (auto &th : ths) th.join();
+    uint64_t cost_us = time_util::now_us() - start;
+    return (double)threads * ops_per_thread / cost_us;//每微秒操作数 = 百万次/秒
+}
+void online_bench()
+{
+    const int thread_counts[] = {1, 2, 4, 8, 16, 32};
+    const int ops = 200000;
+    for (int n : thread_counts) {
+        mutex_online_manager mom;
+        online_manager om;
+        double mutex_mops = online_bench_run(mom, n, ops);
+        double shard_mops = online_bench_run(om, n, ops);
+        std::cout << "线程:" << n << " 单锁:" << mutex_mops << "M次/秒 分片无锁读:" << shard_mops << "M次/秒" << std::endl;
+    }
+}
+//重连顶替连接：一个线程不断用新连接顶替房间连接，另一个线程同时查询，顶替过程中用户任何时刻都应该在线
+void online_replace_test()
+{
+    online_manager om;
+    wsserver_t::connection_ptr conn;
+    om.enter_game_room(1, conn);
+    std::atomic<bool> stop(false);
+    uint64_t checks = 0, offline = 0;
+    std::thread reader([&]() {
+        while (stop == false) {
+            checks++;
+            offline += om.is_in_game_room(1) == false;
+        }
+    });
+    for (int i = 0; i < 100000; i++) {
+        om.replace_game_room(1, conn);
+    }
+    stop = true;
+    reader.join();
+    std::cout << "顶替10万次 查询:" << checks << "次 其中不在线:" << offline << "次" << (offline == 0 ? " 通过" : " 失败") << std::endl;
+}
+//压测中的内存分配统计：需要以 -DALLOC_BENCH 编译，由下面计数的operator new按线程统计（次数和字节数）
+#ifdef ALLOC_BENCH
+static thread_local uint64_t t_alloc_count = 0;
+static thread_local uint64_t t_alloc_bytes = 0;
+void *operator new(size_t size)
+{
+    t_alloc_count++;
+    t_alloc_bytes += size;
+    void *p = malloc(size);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+static uint64_t alloc_count() { return t_alloc_count; }
+static uint64_t alloc_bytes() { return t_alloc_bytes; }
+#else
+static uint64_t alloc_count() { return 0; }
+static uint64_t alloc_bytes() { return 0; }
+#endif
+//房间协议压测：一步棋的请求解析+结果编码，JSON与二进制子协议的CPU耗时和线上字节数
+//线上字节数 = 客户端请求帧（2字节帧头+4字节掩码）+ 两个玩家各一帧结果（服务器帧头2或4字节）
+static size_t ws_frame_size(size_t payload, bool masked)
+{
+    size_t header = payload < 126 ? 2 : (payload <= 0xFFFF ? 4 : 10);
+    return header + (masked ? 4 : 0) + payload;
+}
+void proto_bench()
+{
+    const int moves = 200000;
+    const int recipients = 2;
+    move_result mr;
+    mr.status = MOVE_OK;
+    mr.uid = 10086;
+    mr.row = 7;
+    mr.col = 8;
+    mr.color = CHESS_WHITE;
+    mr.move_no = 1;
+    mr.winner = 0;
+    //1. JSON：解析请求、填入uid，编码结果
+    std::string json_req = "{\"optype\":\"put_chess\",\"room_id\":1024,\"row\":7,\"col\":8}";
+    size_t json_bytes = 0;
+    uint64_t start = time_util::now_us();
+    for (int i = 0; i < moves; i++) {
+        Json::Value req;
+        json_util::unserialize(json_req, req);
+        req["uid"] = (Json::UInt64)mr.uid;
+        mr.row = req["row"].asInt();
+        mr.col = req["col"].asInt();
+        Json::Value resp;
+        proto_util::move_result_json(mr, req["room_id"].asUInt64(), resp);
+        std::string body;
+        json_util::serialize(resp, body);
+        json_bytes = ws_frame_size(json_req.size(), true) + recipients * ws_frame_size(body.size(), false);
+    }
+    uint64_t json_us = time_util::now_us() - start;
+    //2. 二进制：固定格式的请求帧与结果帧
+    std::string bin_req;
+    bin_req.push_back((char)PROTO_MOVE);
+    bin_req.push_back((char)7);
+    bin_req.push_back((char)8);
+    bin_req.push_back((char)0);
+    size_t bin_bytes = 0;
+    start = time_util::now_us();
+    for (int i = 0; i < moves; i++) {
+        int row, col;
+        proto_util::decode_move(bin_req, row, col);
+        mr.row = row;
+        mr.col = col;
+        std::string frame;
+        proto_util::encode_move_result(mr, frame);
+        bin_bytes = ws_frame_size(bin_req.size(), true) + recipients * ws_frame_size(frame.size(), false);
+    }
+    uint64_t bin_us = time_util::now_us() - start;
+    std::cout << "步数:" << moves << " 接收者:" << recipients << std::endl;
+    std::cout << "JSON:   " << json_bytes << "字节/步 " << json_us * 1000.0 / moves << "ns/步" << std::endl;
+    std::cout << "二进制: " << bin_bytes << "字节/步 " << bin_us * 1000.0 / moves << "ns/步" << std::endl;
+}
+//JSON编解码压测：原实现（每次新建Builder/Writer/stringstream，4空格缩进）与现在的缓存+紧凑输出+扁平对象快速路径对比
+static void legacy_serialize(const Json::Value &root, std::string &str)
+{
+    Json::StreamWriterBuilder swb;
+    swb.settings_["emitUTF8"] = true;
+    swb.settings_["indentation"] = "    ";
+    std::unique_ptr<Json::StreamWriter> sw(swb.newStreamWriter());
+    std::stringstream ss;
+    sw->write(root, &ss);
+    str = ss.str();
+}
+static bool legacy_unserialize(const std::string &str, Json::Value &root)
+{
+    Json::CharReaderBuilder crb;
+    std::unique_ptr<Json::CharReader> cr(crb.newCharReader());
+    std::string err;
+    return cr->parse(str.c_str(), str.c_str() + str.size(), &root, &err);
+}
+void json_bench()
+{
+    const int rounds = 200000;
+    Json::Value shapes[3];
+    shapes[0]["optype"] = "put_chess";
+    shapes[0]["result"] = true;
+    shapes[0]["room_id"] = (Json::UInt64)1024;
+    shapes[0]["uid"] = (Json::UInt64)10086;
+    shapes[0]["row"] = 7;
+    shapes[0]["col"] = 8;
+    shapes[0]["winner"] = (Json::UInt64)0;
+    shapes[0]["chess_color"] = CHESS_WHITE;
+    shapes[1]["optype"] = "chat";
+    shapes[1]["result"] = true;
+    shapes[1]["room_id"] = (Json::UInt64)1024;
+    shapes[1]["uid"] = (Json::UInt64)10086;
+    shapes[1]["message"] = "你好，\"来一局\"";
+    shapes[2]["optype"] = "room_ready";
+    shapes[2]["result"] = true;
+    shapes[2]["room_id"] = (Json::UInt64)1024;
+    shapes[2]["uid"] = (Json::UInt64)10086;
+    shapes[2]["white_id"] = (Json::UInt64)10086;
+    shapes[2]["black_id"] = (Json::UInt64)10087;
+    const char *names[3] = {"put_chess", "chat", "room_ready"};
+    for (int k = 0; k < 3; k++) {
+        std::string old_body, new_body;
+        uint64_t start = time_util::now_us();
+        for (int i = 0; i < rounds; i++) {
+            legacy_serialize(shapes[k], old_body);
+        }
+        uint64_t old_ser = time_util::now_us() - start;
+        start = time_util::now_us();
+        for (int i = 0; i < rounds; i++) {
+            json_util::serialize(shapes[k], new_body);
+        }
+        uint64_t new_ser = time_util::now_us() - start;
+        Json::Value val;
+        start = time_util::now_us();
+        for (int i = 0; i < rounds; i++) {
+            legacy_unserialize(new_body, val);
+        }
+        uint64_t old_par = time_util::now_us() - start;
+        start = time_util::now_us();
+        for (int i = 0; i < rounds; i++) {
+            json_util::unserialize(new_body, val);
+        }
+        uint64_t new_par = time_util::now_us() - start;
+        std::string check;
+        json_util::serialize(val, check);
+        std::cout << names[k] << (check == new_body ? "" : " 解析结果不一致!") << std::endl;
+        std::cout << "  序列化: 原 " << old_ser * 1000.0 / rounds << "ns " << old_body.size() << "字节, 现 "
+                  << new_ser * 1000.0 / rounds << "ns " << new_body.size() << "字节" << std::endl;
+        std::cout << "  反序列化: 原 " << old_par * 1000.0 / rounds << "ns, 现 " << new_par * 1000.0 / rounds << "ns" << std::endl;
+    }
+}
+//大文件静态资源压测：多个线程同时请求同一张大图，对比每次读文件再拷贝进响应正文（原实现）
+//与从缓存中打开的文件pread进响应正文的吞吐量、进程RSS峰值（由采样线程每毫秒读取一次）和每个请求的堆分配（-DALLOC_BENCH）
+//websocketpp的响应正文是std::string，两种方式每个请求都要分配一块文件大小的正文，省掉的是open/fstat和中间缓冲
+static uint64_t rss_kb()
+{
+    std::ifstream ifs("/proc/self/status");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            return std::stoull(line.substr(6));
+        }
+    }
+    return 0;
+}
+template <class F>
+static void static_bench_run(const char *name, int threads, int requests, F serve)
+{
+    std::atomic<bool> done(false);
+    uint64_t base_kb = rss_kb(), peak_kb = base_kb;
+    std::thread sampler([&]() {
+        while (done == false) {
+            uint64_t kb = rss_kb();
+            peak_kb = kb > peak_kb ? kb : peak_kb;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    std::atomic<uint64_t> bytes(0), allocs(0), alloc_size(0);
+    std::vector<std::thread> workers;
+    uint64_t start = time_util::now_us();
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&]() {
+            uint64_t count = alloc_count(), size = alloc_bytes();
+            for (int i = 0; i < requests; i++) {
+                bytes += serve();
+            }
+            allocs += alloc_count() - count;
+            alloc_size += alloc_bytes() - size;
+        }));
+    }
+    for (auto &th : workers) th.join();
+    uint64_t us = time_util::now_us() - start;
+    done = true;
+    sampler.join();
+    std::cout << name << ": " << threads * requests * 1000000.0 / us << "请求/s "
+              << bytes / 1024.0 / 1024 / (us / 1000000.0) << "MB/s RSS峰值增长:" << (peak_kb - base_kb) << "KB"
+              << " 分配:" << allocs * 1.0 / (threads * requests) << "次/请求 " << alloc_size / (threads * requests)
+              << "字节/请求" << std::endl;
+}
+void static_bench()
+{
+    const int threads = 8, requests = 500;
+    const std::string uri = "/image/sky.jpeg";
+    static_bench_run("读文件+拷贝", threads, requests, [&]() {
+        std::string body;
+        file_util::read(std::string(WWWROOT) + uri, body);
+        std::string resp = body;//set_body拷贝一份
+        return resp.size();
+    });
+    asset_cache ac(WWWROOT);
+    static_bench_run("打开的文件pread", threads, requests, [&]() {
+        asset_ptr ap = ac.get(uri);
+        std::string body;
+        ap->read(0, ap->size(), body);//与serve()相同：从页缓存读一次，再移动进响应
+        std::string resp = std::move(body);
+        return resp.size();
+    });
+}
+//静态资源的Range解析和大文件读取：超出64位的位置不能抛异常（http回调中没有捕获，会终止服务器），
+//服务中的大文件被原地截断时读取失败而不是SIGBUS
+void asset_test()
+{
+    struct range_case {
+        const char *header;
+        int ret;
+        size_t start, len;
+    } cases[] = {
+        {"bytes=0-99", 1, 0, 100},
+        {"bytes=100-", 1, 100, 900},
+        {"bytes=-10", 1, 990, 10},
+        {"bytes=1000-", -1, 0, 0},
+        {"bytes=99999999999999999999-", -1, 0, 0},
+        {"bytes=18446744073709551616-", -1, 0, 0},
+        {"bytes=10-99999999999999999999", 1, 10, 990},
+        {"bytes=-99999999999999999999", 1, 0, 1000},
+        {"bytes=00000000000000000000000000001-2", 1, 1, 2},
+        {"bytes=5-1", 0, 0, 0},
+        {"bytes=a-1", 0, 0, 0},
+    };
+    int failed = 0;
+    for (auto &c : cases) {
+        size_t start = 0, len = 0;
+        int ret = asset_cache::parse_range(c.header, 1000, start, len);
+        if (ret != c.ret || (ret == 1 && (start != c.start || len != c.len))) {
+            std::cout << "Range解析错误: " << c.header << " 返回" << ret << " " << start << "+" << len << std::endl;
+            failed++;
+        }
+    }
+    std::cout << "Range: " << sizeof(cases) / sizeof(cases[0]) << "个用例 失败" << failed << std::endl;
+    const std::string dir = "./asset_test_root";
+    mkdir(dir.c_str(), 0755);
+    std::string big(ASSET_FILE_MIN * 2, 'x');
+    {
+        std::ofstream ofs(dir + "/big.bin", std::ios::binary | std::ios::trunc);
+        ofs.write(big.data(), big.size());
+        if (!ofs) {
+            std::cout << "写测试文件失败" << std::endl;
+            return;
+        }
+    }
+    {
+        asset_cache ac(dir);
+        asset_ptr ap = ac.get("/big.bin");
+        std::string body;
+        bool before = ap.get() != nullptr && ap->fd >= 0 && ap->read(0, ap->size(), body) && body == big;
+        if (truncate((dir + "/big.bin").c_str(), 100) != 0) {
+            std::cout << "截断测试文件失败: " << strerror(errno) << std::endl;
+        }
+        bool after = ap->read(0, ap->size(), body);
+        std::cout << "大文件: 截断前读取" << (before ? "成功" : "失败") << " 截断后读取" << (after ? "成功(错误)" : "失败(正确)")
+                  << std::endl;
+    }
+    unlink((dir + "/big.bin").c_str());
+    rmdir(dir.c_str());
+}
+//session过期管理压测：原实现每个session一个asio定时器，刷新时取消旧定时器、投递一个0ms定时器、再创建新定时器；
+//现在由时间轮统一管理，刷新只写过期时间。对比每次刷新的耗时和每个session的堆内存（glibc mallinfo2统计的已分配字节数）
+static uint64_t heap_bytes()
+{
+    return mallinfo2().uordblks;
+}
+void session_bench()
+{
+    const int sessions = 100000, rounds = 10;
+    //1. 原实现：每个session一个定时器
+    {
+        boost::asio::io_service ios;
+        std::vector<std::shared_ptr<boost::asio::steady_timer>> timers(sessions);
+        auto arm = [&](int i) {
+            timers[i] = std::make_shared<boost::asio::steady_timer>(ios);
+            timers[i]->expires_from_now(std::chrono::milliseconds(SESSION_TIMEOUT));
+            timers[i]->async_wait([](const boost::system::error_code &) {});
+        };
+        uint64_t base = heap_bytes();
+        for (int i = 0; i < sessions; i++) arm(i);
+        uint64_t mem = heap_bytes() - base;
+        uint64_t start = time_util::now_us();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < sessions; i++) {
+                timers[i]->cancel();
+                auto zero = std::make_shared<boost::asio::steady_timer>(ios);
+                zero->expires_from_now(std::chrono::milliseconds(0));
+                zero->async_wait([zero](const boost::system::error_code &) {});
+                arm(i);
+            }
+            ios.poll();//执行被取消的回调和0ms定时器
+        }
+        uint64_t us = time_util::now_us() - start;
+        std::cout << "asio定时器: 刷新 " << us * 1000.0 / (sessions * rounds) << "ns/次 定时器内存 "
+                  << mem * 1.0 / sessions << "字节/session" << std::endl;
+        for (auto &tp : timers) tp->cancel();
+        ios.poll();
+    }
+    //2. 时间轮
+    {
+        uint64_t base = heap_bytes();
+        session_manager sm;
+        std::vector<session_ptr> ssps;
+        for (int i = 0; i < sessions; i++) {
+            session_ptr ssp = sm.create_session(i + 1, LOGIN);
+            sm.set_session_expire_time(ssp, SESSION_TIMEOUT);
+            ssps.push_back(ssp);
+        }
+        uint64_t mem = heap_bytes() - base;
+        uint64_t start = time_util::now_us();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < sessions; i++) {
+                sm.set_session_expire_time(ssps[i], SESSION_TIMEOUT);
+            }
+        }
+        uint64_t us = time_util::now_us() - start;
+        std::cout << "时间轮: 刷新 " << us * 1000.0 / (sessions * rounds) << "ns/次 session总内存(含session对象和索引) "
+                  << mem * 1.0 / sessions << "字节/session" << std::endl;
+        //3. 多线程按ssid字符串并发查找（解析16进制+无锁查表）
+        const int threads = 4, lookups = 1000000;
+        std::atomic<uint64_t> found(0);
+        std::vector<std::thread> workers;
+        start = time_util::now_us();
+        for (int t = 0; t < threads; t++) {
+            workers.push_back(std::thread([&, t]() {
+                uint64_t n = 0;
+                for (int i = 0; i < lookups; i++) {
+                    n += sm.get_session_by_ssid(ssps[(i * 7 + t) % sessions]->ssid()).get() != nullptr;
+                }
+                found += n;
+            }));
+        }
+        for (auto &th : workers) th.join();
+        us = time_util::now_us() - start;
+        std::cout << "并发查找: " << threads << "线程 " << threads * (uint64_t)lookups * 1000000.0 / us << "次/s 命中:"
+                  << found << std::endl;
+    }
+}
+//原实现：每条日志都在调用线程里格式化时间戳并同步写出
+#define SYNC_LOG(fp, format, ...) do { \
+    time_t t = time(NULL); \
+    struct tm *ltm = localtime(&t); \
+    char tmp[32] = {0}; \
+    strftime(tmp, 31, "%H:%M:%S", ltm); \
+    fprintf(fp, "[%s %s:%d] " format "\n", tmp, __FILE__, __LINE__, ##__VA_ARGS__); \
+} while(0)
+void log_bench()
+{
+    const int count = 100000;
+    const char *sync_path = "/tmp/gobang_log_bench_sync.log";
+    const char *async_path = "/tmp/gobang_log_bench_async.log";
+    //1. 同步写文件，和原来写stdout一样每条都经过stdio加锁
+    FILE *fp = fopen(sync_path, "w");
+    uint64_t start = time_util::now_us();
+    for (int i = 0; i < count; i++) {
+        SYNC_LOG(fp, "房间:%lu 玩家:%lu 走棋 row:%d col:%d", (uint64_t)i, (uint64_t)i * 7, i % 15, i % 13);
+        fflush(fp);
+    }
+    uint64_t us = time_util::now_us() - start;
+    fclose(fp);
+    std::cout << "同步日志: " << us * 1000.0 / count << "ns/条" << std::endl;
+    //2. 异步日志，每批写满一部分环形缓冲区后让写线程追上，统计丢弃数
+    async_logger &logger = async_logger::instance();
+    logger.set_file(async_path);
+    uint64_t dropped = logger.dropped();
+    uint64_t base_total = logger.written() + dropped;
+    us = 0;
+    for (int i = 0; i < count; ) {
+        uint64_t base = logger.written() + logger.dropped();
+        start = time_util::now_us();
+        for (int j = 0; j < LOG_RING_SIZE / 2 && i < count; j++, i++) {
+            ILOG("房间:%lu 玩家:%lu 走棋 row:%d col:%d", (uint64_t)i, (uint64_t)i * 7, i % 15, i % 13);
+        }
+        us += time_util::now_us() - start;
+        while (logger.written() + logger.dropped() < base + LOG_RING_SIZE / 2 && i < count) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    std::cout << "异步日志: " << us * 1000.0 / count << "ns/条 丢弃:" << logger.dropped() - dropped << std::endl;
+    //3. 被运行期级别过滤掉的调试日志
+    start = time_util::now_us();
+    for (int i = 0; i < count; i++) {
+        DLOG("房间:%lu 玩家:%lu 走棋 row:%d col:%d", (uint64_t)i, (uint64_t)i * 7, i % 15, i % 13);
+    }
+    us = time_util::now_us() - start;
+    std::cout << "过滤掉的DLOG: " << us * 1000.0 / count << "ns/条" << std::endl;
+    while (logger.written() + logger.dropped() < base_total + count) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    logger.set_file("");
+    unlink(sync_path);
+    unlink(async_path);
+}
+//固定局面：从天元开始白黑交替落子
+static board ai_bench_board(const std::vector<std::pair<int, int>> &moves, int &next_color)
+{
+    board b;
+    next_color = CHESS_WHITE;
+    for (auto &m : moves) {
+        b.put(m.first, m.second, next_color);
+        next_color = next_color == CHESS_WHITE ? CHESS_BLACK : CHESS_WHITE;
+    }
+    return b;
+}
+void ai_bench()
+{
+    std::vector<std::vector<std::pair<int, int>>> positions = {
+        {{7, 7}, {8, 8}, {7, 8}},
+        {{7, 7}, {7, 5}, {9, 5}, {8, 6}, {9, 7}, {5, 7}, {9, 6}, {9, 8}},
+        {{7, 7}, {6, 8}, {8, 8}, {6, 6}, {6, 7}, {8, 6}, {5, 7}, {4, 7}, {7, 6}, {7, 9}, {9, 9}, {10, 10}},
+    };
+    gomoku_ai ai;
+    //1. perft：只测着法生成+落子/提子
+    for (size_t i = 0; i < positions.size(); i++) {
+        int color;
+        board b = ai_bench_board(positions[i], color);
+        uint64_t start = time_util::now_us();
+        uint64_t leaves = ai.perft(b, color, 3);
+        uint64_t us = time_util::now_us() - start;
+        std::cout << "perft 局面" << i << " 深度3: " << leaves << "叶子 " << us / 1000 << "ms "
+                  << leaves * 1000000.0 / us << "节点/s" << std::endl;
+    }
+    //2. 固定深度搜索：威胁空间搜索+迭代加深alpha-beta
+    for (size_t i = 0; i < positions.size(); i++) {
+        int color, row, col;
+        board b = ai_bench_board(positions[i], color);
+        for (int depth = 4; depth <= 8; depth += 2) {
+            gomoku_ai fresh;//每次从空置换表开始
+            fresh.search(b, color, 60000, row, col, depth);
+            const ai_stats &st = fresh.stats();
+            std::cout << "局面" << i << " 深度" << depth << ": (" << row << "," << col << ") 原因:" << st.reason
+                      << " 完成深度:" << st.depth << " 分数:" << st.score << " 节点:" << st.nodes << " "
+                      << st.us / 1000 << "ms " << st.nodes * 1000000.0 / (st.us + 1) << "节点/s" << std::endl;
+        }
+    }
+}
+void eval_bench()
+{
+    //随机局面：每个局面20~80个棋子
+    const int boards = 1000, rounds = 200;
+    std::mt19937 rng(12345);
+    std::vector<board> positions(boards);
+    for (auto &b : positions) {
+        int stones = 20 + rng() % 60, color = CHESS_WHITE;
+        while (stones > 0) {
+            int r = rng() % BOARD_ROW, c = rng() % BOARD_COL;
+            if (b.empty(r, c)) {
+                b.put(r, c, color);
+                color = color == CHESS_WHITE ? CHESS_BLACK : CHESS_WHITE;
+                stones--;
+            }
+        }
+    }
+    //1. 正确性：三种实现逐条线比较
+    size_t mismatch = 0;
+    for (auto &b : positions) {
+        alignas(32) uint16_t w[EVAL_LANES], k[EVAL_LANES];
+        pattern_eval::extract(b, w, k);
+        line_eval ref[EVAL_LINES], sse[EVAL_LINES], avx[EVAL_LINES];
+        pattern_eval::eval_lines_scalar(w, k, pattern_eval::valid_masks(), EVAL_LINES, ref);
+        pattern_eval::eval_lines_sse2(w, k, pattern_eval::valid_masks(), EVAL_LINES, sse);
+        memcpy(avx, sse, sizeof(avx));
+        if (pattern_eval::has_avx2()) {
+            pattern_eval::eval_lines_avx2(w, k, pattern_eval::valid_masks(), EVAL_LINES, avx);
+        }
+        mismatch += memcmp(ref, sse, sizeof(ref)) != 0;
+        mismatch += memcmp(ref, avx, sizeof(ref)) != 0;
+    }
+    std::cout << "评估一致性: " << boards << "个随机局面 不一致:" << mismatch << std::endl;
+    //2. 整盘评估（88条线）
+    typedef void (*eval_fn)(const uint16_t *, const uint16_t *, const uint16_t *, int, line_eval *);
+    std::vector<std::pair<const char *, eval_fn>> impls = {
+        {"标量", pattern_eval::eval_lines_scalar},
+        {"SSE2", pattern_eval::eval_lines_sse2},
+    };
+    if (pattern_eval::has_avx2()) {
+        impls.push_back(std::make_pair("AVX2", pattern_eval::eval_lines_avx2));
+    }
+    std::vector<uint16_t> ws(boards * EVAL_LANES), ks(boards * EVAL_LANES);
+    for (int i = 0; i < boards; i++) {
+        pattern_eval::extract(positions[i], &ws[i * EVAL_LANES], &ks[i * EVAL_LANES]);
+    }
+    int sink = 0;
+    for (auto &impl : impls) {
+        line_eval out[EVAL_LINES];
+        uint64_t start = time_util::now_us();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < boards; i++) {
+                impl.second(&ws[i * EVAL_LANES], &ks[i * EVAL_LANES], pattern_eval::valid_masks(), EVAL_LINES, out);
+                sink += out[r % EVAL_LINES].score[0];
+            }
+        }
+        uint64_t us = time_util::now_us() - start;
+        std::cout << "整盘评估 " << impl.first << ": " << (uint64_t)boards * rounds * 1000000.0 / us << "次/s "
+                  << us * 1000.0 / ((uint64_t)boards * rounds) << "ns/次" << std::endl;
+    }
+    //3. 增量评估：落子后重新评估经过该点的4条线
+    for (int use_simd = 0; use_simd < 2; use_simd++) {
+        line_eval out[8];
+        uint64_t start = time_util::now_us();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < boards; i++) {
+                int row = (i + r) % BOARD_ROW, col = (i * 7 + r) % BOARD_COL;
+                alignas(16) uint16_t w[8] = {0}, k[8] = {0}, v[8] = {0};
+                for (int d = 0; d < LINE_DIRS; d++) {
+                    int idx = board::line_index(d, row, col);
+                    w[d] = positions[i].line_mask(CHESS_WHITE, d, idx);
+                    k[d] = positions[i].line_mask(CHESS_BLACK, d, idx);
+                    v[d] = pattern_eval::valid_masks()[pattern_eval::line_id(d, idx)];
+                }
+                if (use_simd) {
+                    pattern_eval::eval_lines_sse2(w, k, v, LINE_DIRS, out);
+                }else {
+                    pattern_eval::eval_lines_scalar(w, k, v, LINE_DIRS, out);
+                }
+                sink += out[r % LINE_DIRS].score[1];
+            }
+        }
+        uint64_t us = time_util::now_us() - start;
+        std::cout << "增量评估(4条线) " << (use_simd ? "SSE2" : "标量") << ": "
+                  << us * 1000.0 / ((uint64_t)boards * rounds) << "ns/次" << std::endl;
+    }
+    std::cout << "(校验和 " << sink << ")" << std::endl;
+}
+void ai_pool_bench()
+{
+    const int rooms = 8, think_ms = 200;
+    int color;
+    board b = ai_bench_board({{7, 7}, {7, 5}, {9, 5}, {8, 6}, {9, 7}, {5, 7}, {9, 6}, {9, 8}}, color);
+    //1. 事件循环线程上同步思考：整个思考时间内该线程上的其他房间都在等待
+    {
+        gomoku_ai ai;
+        int row, col;
+        uint64_t start = time_util::now_us();
+        ai.search(b, color, think_ms, row, col);
+        std::cout << "同步思考: 事件循环阻塞 " << (time_util::now_us() - start) / 1000 << "ms/步" << std::endl;
+    }
+    //2. 线程池：事件循环只拷贝棋盘、入队；结果回调直接在完成的线程上执行
+    std::atomic<int> done(0);
+    std::mutex mutex;
+    std::vector<uint64_t> latency;
+    ai_pool pool([](const std::function<void()> &task) { task(); }, 2);
+    uint64_t submit_us = 0, start = time_util::now_us();
+    for (int i = 0; i < rooms; i++) {
+        uint64_t t = time_util::now_us();
+        pool.submit(i + 1, b, color, think_ms, [&, t](int, int) {
+            std::unique_lock<std::mutex> lock(mutex);
+            latency.push_back(time_util::now_us() - t);
+            done++;
+        });
+        submit_us += time_util::now_us() - t;
+    }
+    while (done < rooms) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    uint64_t max_latency = *std::max_element(latency.begin(), latency.end());
+    Json::Value st;
+    pool.stats(st);
+    std::cout << "线程池: " << rooms << "个房间 提交 " << submit_us * 1000 / rooms << "ns/次 全部完成 "
+              << (time_util::now_us() - start) / 1000 << "ms 最大响应 " << max_latency / 1000 << "ms 平均排队 "
+              << st["avg_wait_us"].asUInt64() / 1000 << "ms 平均思考 " << st["avg_think_us"].asUInt64() / 1000
+              << "ms 超时出队 " << st["expired"].asUInt64() << " 窃取 " << st["steals"].asUInt64() << std::endl;
+    //3. 取消：所有房间解散，排队中和思考中的任务都应该很快结束
+    for (int i = 0; i < rooms; i++) {
+        pool.submit(i + 1, b, color, 5000, [&](int, int) { done++; });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    start = time_util::now_us();
+    for (int i = 0; i < rooms; i++) {
+        pool.cancel(i + 1);
+    }
+    while (true) {
+        pool.stats(st);
+        if (st["pending"].asUInt64() == 0 && st["completed"].asUInt64() + st["cancelled"].asUInt64() == (uint64_t)rooms * 2) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::cout << "取消: " << rooms << "个任务 " << (time_util::now_us() - start) / 1000 << "ms内全部结束 回调:"
+              << done - rooms << std::endl;
+}
+void book_bench()
+{
+    //1. 离线生成：AI自我对弈（前两手随机）得到对局记录，再生成开局库
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> near(-2, 2);
+    std::stringstream games;
+    gomoku_ai ai;
+    uint64_t start = time_util::now_us();
+    for (int g = 0; g < 40; g++) {
+        board b;
+        int color = CHESS_WHITE, winner = 0, row, col;
+        std::string moves;
+        while (b.count() < BOOK_MAX_PLY + 2) {
+            if (b.count() < 2) {
+                do {
+                    row = BOARD_ROW / 2 + near(rng);
+                    col = BOARD_COL / 2 + near(rng);
+                } while (!b.empty(row, col));
+            }else {
+                ai.search(b, color, 20, row, col, 4);
+            }
+            b.put(row, col, color);
+            moves += " " + std::to_string(row) + "," + std::to_string(col);
+            if (b.five(row, col, color)) {
+                winner = color;
+                break;
+            }
+            color = color == CHESS_WHITE ? CHESS_BLACK : CHESS_WHITE;
+        }
+        games << winner << moves << "\n";
+    }
+    uint64_t play_us = time_util::now_us() - start;
+    start = time_util::now_us();
+    opening_book::build(games, "./bench.book", BOOK_MAX_PLY, 1);
+    uint64_t build_us = time_util::now_us() - start;
+    opening_book book;
+    start = time_util::now_us();
+    book.open("./bench.book");
+    std::cout << "开局库: 自我对弈40局 " << play_us / 1000 << "ms 生成 " << build_us / 1000 << "ms 加载(mmap) "
+              << time_util::now_us() - start << "us 局面数:" << book.size() << std::endl;
+    //2. 查表：对库中每一局的前几手以及它们的8种对称变换查询，命中率应该相同
+    std::vector<board> probes;
+    games.clear();
+    games.seekg(0);
+    std::string line;
+    while (std::getline(games, line)) {
+        std::istringstream in(line);
+        int winner, row, col;
+        char comma;
+        in >> winner;
+        board b[8];
+        for (int ply = 0, color = CHESS_WHITE; ply < 6 && (in >> row >> comma >> col); ply++) {
+            for (int s = 0; s < 8; s++) {
+                int r, c;
+                symmetry::apply(s, row, col, r, c);
+                b[s].put(r, c, color);
+                probes.push_back(b[s]);
+            }
+            color = color == CHESS_WHITE ? CHESS_BLACK : CHESS_WHITE;
+        }
+    }
+    size_t hits = 0;
+    const int rounds = 50;
+    start = time_util::now_us();
+    for (int i = 0; i < rounds; i++) {
+        for (auto &b : probes) {
+            int row, col;
+            hits += book.lookup(b, row, col);
+        }
+    }
+    uint64_t us = time_util::now_us() - start;
+    std::cout << "查表: " << probes.size() * rounds << "次 " << us * 1000 / (probes.size() * rounds) << "ns/次 命中率 "
+              << hits * 100 / (probes.size() * rounds) << "%" << std::endl;
+    //映射着旧库时在同一路径重新生成（这里生成一个空库），旧映射的查表结果应该不变
+    std::stringstream empty;
+    opening_book::build(empty, "./bench.book", BOOK_MAX_PLY, 1);
+    size_t rehits = 0;
+    for (auto &b : probes) {
+        int row, col;
+        rehits += book.lookup(b, row, col);
+    }
+    std::cout << "重新生成后旧映射命中:" << rehits << "/" << hits / rounds << (rehits * rounds == hits ? " 通过" : " 失败") << std::endl;
+    //3. 共享置换表：多线程同时读写同一张表
+    shared_tt tt(20);
+    for (int threads = 1; threads <= 4; threads *= 2) {
+        const int ops = 2000000;
+        std::vector<std::thread> ths;
+        start = time_util::now_us();
+        for (int t = 0; t < threads; t++) {
+            ths.push_back(std::thread([&, t]() {
+                uint64_t x = t + 1;
+                tt_data d = {0, 0, TT_EXACT, 0, 0};
+                for (int i = 0; i < ops; i++) {
+                    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+                    uint64_t key = x >> 12;//只用少量不同的键，让各线程频繁访问相同的槽位
+                    if (i & 1) {
+                        d.score = (int)key;
+                        tt.store(key, d);
+                    }else if (tt.probe(key, d) && d.score != (int)key) {
+                        abort();//撕裂的写入不能被当作命中
+                    }
+                }
+            }));
+        }
+        for (auto &th : ths) {
+            th.join();
+        }
+        us = time_util::now_us() - start;
+        std::cout << "共享置换表: " << threads << "线程 " << (uint64_t)ops * threads * 1000 / us << "K次/s" << std::endl;
+    }
+    //4. 求解缓存：多个房间走到相同（含对称）局面，只有第一个房间需要搜索
+    int color;
+    std::vector<std::pair<int, int>> moves = {{7, 7}, {7, 5}, {9, 5}, {8, 6}, {9, 7}, {5, 7}, {9, 6}, {9, 8}};
+    ai_pool pool([](const std::function<void()> &task) { task(); }, 1, "./bench.book");
+    std::atomic<int> done(0);
+    for (int s = 0; s < 8; s++) {
+        std::vector<std::pair<int, int>> m;
+        for (auto &p : moves) {
+            int r, c;
+            symmetry::apply(s, p.first, p.second, r, c);
+            m.push_back(std::make_pair(r, c));
+        }
+        board b = ai_bench_board(m, color);
+        uint64_t t = time_util::now_us();
+        pool.submit(s + 1, b, color, 300, [&, s, t](int row, int col) {
+            std::cout << "房间" << s + 1 << " (" << row << "," << col << ") " << (time_util::now_us() - t) / 1000
+                      << "ms" << std::endl;
+            done++;
+        });
+        while (done <= s) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    Json::Value st;
+    pool.stats(st);
+    std::cout << "求解缓存: 8个对称局面 命中 " << st["cache_hits"].asUInt64() << " 开局库命中 "
+              << st["book_hits"].asUInt64() << std::endl;
+    unlink("./bench.book");
+}
+void rules_bench()
+{
+    //1. 禁手判断的正确性：在空棋盘上摆出局面，最后一手是否是禁手
+    struct renju_case { const char *name; std::vector<std::pair<int, int>> own, opp; int row, col; bool forbidden; };
+    std::vector<renju_case> cases = {
+        {"三三", {{7, 5}, {7, 6}, {5, 7}, {6, 7}}, {}, 7, 7, true},
+        {"四四", {{7, 4}, {7, 5}, {7, 6}, {4, 7}, {5, 7}, {6, 7}}, {}, 7, 7, true},
+        {"长连", {{7, 2}, {7, 3}, {7, 4}, {7, 6}, {7, 7}}, {}, 7, 5, true},
+        {"五连", {{7, 3}, {7, 4}, {7, 6}, {7, 7}, {4, 5}, {5, 5}}, {}, 7, 5, false},
+        {"四三", {{7, 4}, {7, 5}, {7, 6}, {5, 7}, {6, 7}}, {}, 7, 7, false},
+        {"一边被堵的三", {{7, 5}, {7, 6}, {5, 7}, {6, 7}}, {{7, 8}}, 7, 7, false},
+    };
+    for (auto &c : cases) {
+        board b;
+        for (auto &st : c.own) {
+            b.put(st.first, st.second, CHESS_WHITE);
+        }
+        for (auto &st : c.opp) {
+            b.put(st.first, st.second, CHESS_BLACK);
+        }
+        b.put(c.row, c.col, CHESS_WHITE);
+        bool f = renju::forbidden(b, c.row, c.col, CHESS_WHITE);
+        std::cout << "禁手 " << c.name << ": " << (f ? "是" : "否") << (f == c.forbidden ? "" : " (错误!)") << std::endl;
+    }
+    //2. 禁手判断的速度：随机局面上的随机空位
+    std::mt19937 rng(2024);
+    std::uniform_int_distribution<int> pos(0, BOARD_ROW - 1);
+    std::vector<board> boards(64);
+    for (auto &b : boards) {
+        for (int i = 0; i < 40; i++) {
+            int r = pos(rng), c = pos(rng);
+            if (b.empty(r, c)) {
+                b.put(r, c, i % 2 ? CHESS_BLACK : CHESS_WHITE);
+            }
+        }
+    }
+    const int checks = 1000000;
+    int forbidden = 0;
+    uint64_t start = time_util::now_us();
+    for (int i = 0; i < checks; i++) {
+        board &b = boards[i & 63];
+        int r = pos(rng), c = pos(rng);
+        if (!b.empty(r, c)) {
+            continue;
+        }
+        b.put(r, c, CHESS_WHITE);
+        forbidden += renju::forbidden(b, r, c, CHESS_WHITE);
+        b.take(r, c);
+    }
+    uint64_t us = time_util::now_us() - start;
+    std::cout << "禁手判断: " << us * 1000 / checks << "ns/次 禁手 " << forbidden << std::endl;
+    //3. 刷屏：白方连续发送走棋帧，限流在解码之前丢弃多余的帧；被放行的帧中不是自己回合的在状态机的第一组检查被拒绝
+    online_manager om;
+    wsserver_t::connection_ptr none;
+    om.enter_game_room(1, none);
+    om.enter_game_room(2, none);
+    room_ptr rp(new room(1, nullptr, &om, nullptr));
+    rp->add_white_user(1);
+    rp->add_black_user(2);
+    rp->set_renju(true);
+    const int frames = 1000000;
+    int admitted = 0;
+    start = time_util::now_us();
+    for (int i = 0; i < frames; i++) {
+        if (rp->admit(1)) {
+            admitted++;
+            rp->handle_move(1, 7, 7 + admitted % 2);
+        }
+    }
+    us = time_util::now_us() - start;
+    std::cout << "刷屏: " << frames << "帧 放行 " << admitted << " 平均 " << us * 1000 / frames << "ns/帧" << std::endl;
+    //4. 正常对局：每一手都经过完整的状态机检查（含禁手判断）
+    std::vector<std::pair<int, int>> order;
+    for (int r = 0; r < BOARD_ROW; r++) {
+        for (int c = 0; c < BOARD_COL; c++) {
+            order.push_back(std::make_pair(r, c));
+        }
+    }
+    const int games = 200;
+    uint64_t moves = 0, rejected = 0;
+    us = 0;
+    for (int g = 0; g < games; g++) {
+        room_ptr gp(new room(g + 2, nullptr, &om, nullptr));
+        gp->add_white_user(1);
+        gp->add_black_user(2);
+        gp->set_renju(true);
+        std::shuffle(order.begin(), order.end(), rng);
+        uint64_t uid = 1;
+        start = time_util::now_us();
+        for (auto &m : order) {
+            move_result mr;
+            gp->handle_chess(uid, m.first, m.second, mr);
+            if (mr.status == MOVE_FORBIDDEN) {
+                rejected++;
+                continue;//禁手位置留给黑方
+            }
+            moves++;
+            if (mr.status != MOVE_OK) {
+                break;
+            }
+            uid = uid == 1 ? 2 : 1;
+        }
+        us += time_util::now_us() - start;
+    }
+    std::cout << "状态机: " << games << "局 " << moves << "手 禁手 " << rejected << " 平均 "
+              << us * 1000 / (moves + rejected) << "ns/次" << std::endl;
+}
+//观战扇出压测：1个房间 x 5000个观战连接，服务端和客户端都是回环地址上真实的websocket连接
+//每一步记录 扇出耗时（服务端把一条已组帧的消息交给所有连接的时间）和 送达延迟（开始扇出到最后一个观战者收到）
+typedef websocketpp::client<websocketpp::config::asio_client> wsclient_t;
+void watch_bench()
+{
+    const int watchers = 5000, moves = 30, batch = 500;
+    const uint16_t port = 9100;
+    //服务端和客户端各5000个连接，需要调高文件描述符上限
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    //1. 服务端：只有观战者集合，不需要数据库
+    wsserver_t srv;
+    srv.clear_access_channels(websocketpp::log::alevel::all);
+    srv.clear_error_channels(websocketpp::log::elevel::all);
+    srv.init_asio();
+    srv.set_reuse_addr(true);
+    watch_group group(1);
+    std::atomic<int> opened(0);
+    srv.set_validate_handler([&](websocketpp::connection_hdl hdl) {
+        wsserver_t::connection_ptr conn = srv.get_con_from_hdl(hdl);
+        for (auto &proto : conn->get_requested_subprotocols()) {
+            if (proto == GOBANG_BIN_PROTO) {
+                conn->select_subprotocol(proto);
+            }
+        }
+        return true;
+    });
+    srv.set_open_handler([&](websocketpp::connection_hdl hdl) {
+        group.add(srv.get_con_from_hdl(hdl));
+        opened++;
+    });
+    srv.set_close_handler([&](websocketpp::connection_hdl hdl) { group.remove(srv.get_con_from_hdl(hdl)); });
+    srv.listen(port);
+    srv.start_accept();
+    std::thread srv_th([&]() { srv.run(); });
+    //2. 客户端：收到增量时按move_no记录最后一个观战者收到的时间
+    std::vector<std::atomic<int>> received(moves + 1);
+    std::vector<std::atomic<uint64_t>> last_us(moves + 1);
+    for (int m = 0; m <= moves; m++) {
+        received[m] = 0;
+        last_us[m] = 0;
+    }
+    wsclient_t cli;
+    cli.clear_access_channels(websocketpp::log::alevel::all);
+    cli.clear_error_channels(websocketpp::log::elevel::all);
+    cli.init_asio();
+    cli.start_perpetual();
+    cli.set_message_handler([&](websocketpp::connection_hdl, wsclient_t::message_ptr msg) {
+        const std::string &p = msg->get_payload();
+        if (msg->get_opcode() != websocketpp::frame::opcode::binary || p.size() != PROTO_MOVE_RESULT_LEN) {
+            return;//快照
+        }
+        int m = ((uint8_t)p[5] << 8) | (uint8_t)p[6];
+        if (m <= 0 || m > moves) {
+            return;
+        }
+        uint64_t now = time_util::now_us(), cur = last_us[m];
+        while (now > cur && !last_us[m].compare_exchange_weak(cur, now)) {}
+        received[m]++;
+    });
+    std::thread cli_th([&]() { cli.run(); });
+    uint64_t start = time_util::now_us();
+    for (int i = 0; i < watchers; i++) {
+        websocketpp::lib::error_code ec;
+        wsclient_t::connection_ptr con = cli.get_connection("ws://127.0.0.1:" + std::to_string(port) + "/watch", ec);
+        if (ec) {
+            std::cout << "创建连接失败: " << ec.message() << std::endl;
+            break;
+        }
+        con->add_subprotocol(GOBANG_BIN_PROTO);
+        cli.connect(con);
+        //分批连接，避免超出监听队列
+        while ((i + 1) % batch == 0 && opened < i + 1 && time_util::now_us() - start < 30000000) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    while (opened < watchers && time_util::now_us() - start < 30000000) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::cout << "观战连接: " << opened << "/" << watchers << " 建立用时 " << (time_util::now_us() - start) / 1000
+              << "ms" << std::endl;
+    //3. 逐步扇出，等所有观战者都收到再走下一步
+    int n = opened > 0 ? (int)opened : 1;
+    std::vector<uint64_t> fanout, latency;
+    int incomplete = 0;//5秒内没有送达全部观战者的步数，不计入延迟
+    for (int m = 1; m <= moves; m++) {
+        move_result mr;
+        mr.status = MOVE_OK;
+        mr.uid = 10086;
+        mr.row = m / BOARD_COL;
+        mr.col = m % BOARD_COL;
+        mr.color = m % 2 ? CHESS_WHITE : CHESS_BLACK;
+        mr.move_no = m;
+        mr.winner = 0;
+        start = time_util::now_us();
+        group.push(mr);
+        group.flush([](std::string &body) { body = "{}"; });
+        fanout.push_back(time_util::now_us() - start);
+        while (received[m] < n && time_util::now_us() - start < 5000000) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        if (received[m] < n || last_us[m] < start) {
+            incomplete++;
+            continue;
+        }
+        latency.push_back(last_us[m] - start);
+    }
+    //4. 最后一步时还在积压的观战者没有下一步棋可以触发补发，由定时检查（房间中是WATCH_RESYNC_MS的定时器）补发快照
+    start = time_util::now_us();
+    while (group.stale() != 0 && time_util::now_us() - start < 5000000) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_RESYNC_MS));
+        group.resync([](std::string &body) { body = "{}"; });
+    }
+    std::cout << "最后一步后仍积压的观战者: " << group.stale() << std::endl;
+    std::sort(fanout.begin(), fanout.end());
+    std::sort(latency.begin(), latency.end());
+    Json::Value st;
+    watch_group::stats(st);
+    std::cout << "扇出: " << moves << "步 x " << n << "个观战者 扇出耗时 p50 " << fanout[moves / 2] << "us 最大 "
+              << fanout.back() << "us (" << fanout[moves / 2] * 1000 / n << "ns/连接)"
+              << std::endl;
+    if (latency.empty()) {
+        std::cout << "送达延迟: 没有一步在5秒内送达全部观战者";
+    }else {
+        std::cout << "送达延迟: p50 " << latency[latency.size() / 2] / 1000.0 << "ms p99 "
+                  << latency[latency.size() * 99 / 100] / 1000.0 << "ms 最大 " << latency.back() / 1000.0 << "ms";
+    }
+    std::cout << " 未全部送达 " << incomplete << "步 丢弃 " << st["dropped"].asUInt64() << " 补发快照 "
+              << st["resynced"].asUInt64() << std::endl;
+    cli.stop_perpetual();
+    cli.stop();
+    srv.stop();
+    cli_th.join();
+    srv_th.join();
+}
+//广播压测：回环地址上1000个真实的websocket连接，对比 逐个连接conn->send(body) 与 ws_util::send_all共享一条已组帧的消息，
+//按连接数统计每一步在发送线程上的堆分配次数和字节数（-DALLOC_BENCH），每一步等所有连接都收到后再发下一步；
+//每种方式用两种正文长度各跑一次，分配字节之差除以长度之差就是每一步分配并拷贝的正文份数
+void broadcast_bench()
+{
+    const int max_conns = 1000, moves = 200, batch = 500;
+    const int conn_counts[] = {10, 100, 1000};
+    const size_t sizes[] = {128, 4096};//4096时帧头是16位长度
+    const uint16_t port = 9101;
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    //1. 服务端：记录所有建立的连接
+    wsserver_t srv;
+    srv.clear_access_channels(websocketpp::log::alevel::all);
+    srv.clear_error_channels(websocketpp::log::elevel::all);
+    srv.init_asio();
+    srv.set_reuse_addr(true);
+    std::mutex mutex;
+    std::vector<wsserver_t::connection_ptr> all;
+    srv.set_open_handler([&](websocketpp::connection_hdl hdl) {
+        std::unique_lock<std::mutex> lock(mutex);
+        all.push_back(srv.get_con_from_hdl(hdl));
+    });
+    srv.listen(port);
+    srv.start_accept();
+    std::thread srv_th([&]() { srv.run(); });
+    //2. 客户端：只统计收到的消息数
+    std::atomic<int> received(0);
+    wsclient_t cli;
+    cli.clear_access_channels(websocketpp::log::alevel::all);
+    cli.clear_error_channels(websocketpp::log::elevel::all);
+    cli.init_asio();
+    cli.start_perpetual();
+    cli.set_message_handler([&](websocketpp::connection_hdl, wsclient_t::message_ptr) { received++; });
+    std::thread cli_th([&]() { cli.run(); });
+    auto opened = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        return (int)all.size();
+    };
+    uint64_t start = time_util::now_us();
+    for (int i = 0; i < max_conns; i++) {
+        websocketpp::lib::error_code ec;
+        wsclient_t::connection_ptr con = cli.get_connection("ws://127.0.0.1:" + std::to_string(port) + "/", ec);
+        if (ec) {
+            std::cout << "创建连接失败: " << ec.message() << std::endl;
+            break;
+        }
+        cli.connect(con);
+        while ((i + 1) % batch == 0 && opened() < i + 1 && time_util::now_us() - start < 30000000) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    while (opened() < max_conns && time_util::now_us() - start < 30000000) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::vector<wsserver_t::connection_ptr> conns;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        conns = all;
+    }
+    std::cout << "广播连接: " << conns.size() << "/" << max_conns << std::endl;
+    //3. 每种方式、每种连接数、每种正文长度发送moves步，返回每一步的分配次数和字节数
+    auto run = [&](bool shared, int n, size_t size, double &count, double &bytes) {
+        std::vector<wsserver_t::connection_ptr> targets(conns.begin(), conns.begin() + n);
+        std::string body(size, 'x');
+        uint64_t c = 0, b = 0;
+        for (int m = 0; m < moves; m++) {
+            received = 0;
+            std::string payload = body;//房间中每一步的正文是新编码的，这份拷贝不计入
+            uint64_t c0 = alloc_count(), b0 = alloc_bytes();
+            if (shared) {
+                ws_util::send_all(targets, websocketpp::frame::opcode::text, payload);
+            }else {
+                for (auto &conn : targets) {
+                    conn->send(payload, websocketpp::frame::opcode::text);
+                }
+            }
+            c += alloc_count() - c0;
+            b += alloc_bytes() - b0;
+            uint64_t wait = time_util::now_us();
+            while (received < n && time_util::now_us() - wait < 5000000) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+        count = (double)c / moves;
+        bytes = (double)b / moves;
+    };
+    for (int n : conn_counts) {
+        if (n > (int)conns.size()) {
+            break;
+        }
+        for (int shared = 0; shared < 2; shared++) {
+            double count[2], bytes[2];
+            for (int i = 0; i < 2; i++) {
+                run(shared, n, sizes[i], count[i], bytes[i]);
+            }
+            double copies = (bytes[1] - bytes[0]) / (sizes[1] - sizes[0]);
+            std::cout << "连接:" << n << (shared ? " 共享已组帧消息" : " 逐个连接send") << " 每步分配 "
+                      << count[0] << "次/" << bytes[0] << "字节(" << sizes[0] << "字节正文) "
+                      << count[1] << "次/" << bytes[1] << "字节(" << sizes[1] << "字节正文) 正文拷贝 "
+                      << copies << "份/步 (" << copies * sizes[1] << "字节)" << std::endl;
+        }
+    }
+    cli.stop_perpetual();
+    cli.stop();
+    srv.stop();
+    cli_th.join();
+    srv_th.join();
+}
+//断线重连：1000个对局中每局下10手后白方断线，宽限期内重连，定时器到期时不判负、不产生结算；
+//另外100个人机房间断线后不重连，定时器到期判负并销毁房间（人机对局不结算）
+//定时器用一个队列代替，全部断线/重连完成后再统一触发，相当于所有重连都发生在宽限期内
+void reconnect_bench()
+{
+    std::vector<std::function<void()>> timers;
+    online_manager om;
+    ai_pool pool([](const std::function<void()> &task) { task(); }, 1);
+    room_manager rm(nullptr, &om, &pool, nullptr, [&timers](int, const std::function<void()> &task) {
+        timers.push_back(task);
+    });
+    wsserver_t::connection_ptr none;
+    const int games = 1000, ai_games = 100;
+    std::vector<room_ptr> rooms;
+    for (int i = 0; i < games; i++) {
+        uint64_t w = 2 * i + 1, b = 2 * i + 2;
+        om.enter_game_hall(w, none);
+        om.enter_game_hall(b, none);
+        room_ptr rp = rm.create_room(w, b);
+        om.exit_game_hall(w);
+        om.exit_game_hall(b);
+        om.enter_game_room(w, none);
+        om.enter_game_room(b, none);
+        for (int m = 0; m < 10; m++) {
+            rp->handle_move(m % 2 ? b : w, m, m % 2 ? 9 : 5);
+        }
+        rooms.push_back(rp);
+    }
+    //1. 白方断线：保留座位，注册宽限期定时器
+    uint64_t start = time_util::now_us();
+    for (int i = 0; i < games; i++) {
+        om.exit_game_room(2 * i + 1);
+        rm.user_disconnect(2 * i + 1);
+    }
+    uint64_t leave_us = time_util::now_us() - start;
+    //2. 宽限期内对方走棋不会因为"对方掉线"而直接获胜（还没轮到黑方，被按回合拒绝）
+    int offline_wins = 0;
+    for (int i = 0; i < games; i++) {
+        move_result mr;
+        rooms[i]->handle_chess(2 * i + 2, 14, 14, mr);
+        offline_wins += mr.status == MOVE_OFFLINE_WIN;
+    }
+    //3. 重连：新连接拿到着法序列恢复棋局
+    size_t bytes = 0;
+    int resumed = 0;
+    start = time_util::now_us();
+    for (int i = 0; i < games; i++) {
+        uint64_t uid = 2 * i + 1;
+        om.enter_game_room(uid, none);
+        room_ptr rp = rm.get_room_by_uid(uid);
+        Json::Value resp;
+        rm.user_enter(rp, uid, resp);
+        resumed += resp["resumed"].asBool() && resp["moves"].size() == 10;
+        if (i == 0) {
+            std::string body;
+            json_util::serialize(resp, body);
+            bytes = body.size();
+        }
+    }
+    uint64_t enter_us = time_util::now_us() - start;
+    //4. 人机房间断线不重连
+    for (int i = 0; i < ai_games; i++) {
+        uint64_t uid = 100000 + i;
+        om.enter_game_hall(uid, none);
+        rm.create_ai_room(uid);
+        om.exit_game_hall(uid);
+        rm.user_disconnect(uid);
+    }
+    //5. 宽限期结束
+    size_t fired = timers.size();
+    for (auto &t : timers) {
+        t();
+    }
+    int alive = 0, ai_alive = 0;
+    for (int i = 0; i < games; i++) {
+        alive += rooms[i]->statu() == GAME_START;
+    }
+    for (int i = 0; i < ai_games; i++) {
+        ai_alive += rm.get_room_by_uid(100000 + i).get() != nullptr;
+    }
+    //6. 对局结束后离开再匹配：先离开的玩家回到大厅不会被带回已经结束的房间，可以马上开始新的对局，
+    //   对方还在结束的房间里时房间保留，对方离开后房间销毁；下满棋盘和棋结束，不经过结算
+    int rematched = 0, kept = 0, removed = 0;
+    for (int i = 0; i < games; i++) {
+        uint64_t w = 200000 + 2 * i, b = w + 1;
+        om.enter_game_hall(w, none);
+        om.enter_game_hall(b, none);
+        room_ptr rp = rm.create_room(w, b);
+        om.exit_game_hall(w);
+        om.exit_game_hall(b);
+        om.enter_game_room(w, none);
+        om.enter_game_room(b, none);
+        rp->set_renju(false);
+        std::vector<int> cells[2];
+        for (int r = 0; r < BOARD_ROW; r++) {
+            for (int c = 0; c < BOARD_COL; c++) {
+                cells[((c + 2 * (r % 2) + (r / 2) % 2) / 2) % 2 ? 0 : 1].push_back(r * BOARD_COL + c);//没有五连的排列，白113子 黑112子
+            }
+        }
+        for (int m = 0; m < BOARD_ROW * BOARD_COL; m++) {
+            int cell = cells[m % 2][m / 2];
+            rp->handle_move(m % 2 ? b : w, cell / BOARD_COL, cell % BOARD_COL);
+        }
+        if (rp->statu() != GAME_OVER) {
+            continue;
+        }
+        om.exit_game_room(w);
+        rm.user_disconnect(w);
+        rm.user_disconnect(w);//重复的断开不会让房间人数再减一
+        om.enter_game_hall(w, none);
+        kept += rm.resume_room(w).get() == nullptr && rm.get_room_by_rid(rp->id()).get() != nullptr &&
+                rm.get_room_by_uid(b) == rp;
+        om.enter_game_hall(w + 2 * games, none);
+        room_ptr next = rm.create_room(w, w + 2 * games);
+        rematched += next.get() != nullptr;
+        om.exit_game_room(b);
+        rm.user_disconnect(b);
+        removed += rm.get_room_by_rid(rp->id()).get() == nullptr && next.get() != nullptr && rm.get_room_by_uid(w) == next;
+    }
+    Json::Value st;
+    rm.stats(st);
+    std::cout << "断线: " << games << "局 平均 " << leave_us * 1000 / games << "ns/次, 宽限期内对方掉线获胜 " << offline_wins
+              << std::endl;
+    std::cout << "重连: 恢复 " << resumed << "/" << games << "局 平均 " << enter_us * 1000 / games
+              << "ns/次 room_ready " << bytes << "字节" << std::endl;
+    std::cout << "结束后再匹配: 先离开的玩家不回到旧房间且对方房间保留 " << kept << "/" << games << " 重新匹配成功 "
+              << rematched << "/" << games << " 双方离开后旧房间销毁 " << removed << "/" << games << std::endl;
+    std::cout << "定时器: " << fired << "个 对局继续 " << alive << "/" << games << " 人机房间剩余 " << ai_alive
+              << " 统计 " << st.toStyledString();
+}
+//棋谱存储：10万局随机对局写入（小段，验证切换段），按ID随机回放，重启扫描重建索引，模拟崩溃时写了一半的尾部记录
+void record_bench()
+{
+    const std::string dir = "./bench_records";
+    const int games = 100000;
+    if (system(("rm -rf " + dir).c_str()) != 0) {
+        std::cout << "清理目录失败: " << dir << std::endl;
+        return;
+    }
+    std::mt19937 rng(2024);
+    std::uniform_int_distribution<int> len(9, 120), pos(0, BOARD_ROW * BOARD_COL - 1);
+    uint64_t moves_total = 0;
+    {
+        record_store rs(dir, 4 * 1024 * 1024);
+        uint64_t start = time_util::now_us();
+        for (int i = 0; i < games; i++) {
+            record_header hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.white = 1 + i % 1000;
+            hdr.black = 1001 + i % 997;
+            hdr.result = 1 + i % 2;
+            hdr.reason = MOVE_WIN;
+            hdr.start = (uint32_t)time(nullptr);
+            std::vector<uint8_t> moves(len(rng));
+            for (auto &m : moves) {
+                m = (uint8_t)pos(rng);
+            }
+            moves_total += moves.size();
+            rs.push(hdr, moves);
+        }
+        uint64_t push_us = time_util::now_us() - start;
+        Json::Value st;
+        do {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            st.clear();
+            rs.stats(st);
+        } while (st["written"].asUInt64() < (uint64_t)games);//写盘失败会整批重试，failures记录重试次数
+        uint64_t write_us = time_util::now_us() - start;
+        std::cout << "写入: " << games << "局 入队 " << push_us * 1000 / games << "ns/局, 全部落盘 " << write_us / 1000
+                  << "ms (" << (uint64_t)games * 1000000 / write_us << "局/s) " << st["batches"].asUInt64() << "批 "
+                  << st["segment"].asUInt() << "个段 平均 " << st["bytes"].asUInt64() * 10 / games / 10.0 << "字节/局 ("
+                  << moves_total / games << "手) 写盘失败 " << st["failures"].asUInt64() << "次" << std::endl;
+        std::string rec;
+        int ok = 0;
+        const int reads = 100000;
+        start = time_util::now_us();
+        for (int i = 0; i < reads; i++) {
+            ok += rs.read(1 + rng() % games, rec);
+        }
+        uint64_t us = time_util::now_us() - start;
+        std::vector<uint64_t> ids;
+        rs.games_of(7, ids);
+        std::cout << "回放: " << reads << "次 成功 " << ok << " 平均 " << us * 1000 / reads << "ns/次, 用户7最近 "
+                  << ids.size() << "局 最新ID " << (ids.empty() ? 0 : ids[0]) << std::endl;
+    }
+    //模拟崩溃：最后一个段的最后一条记录只写了一半
+    std::vector<uint32_t> seqs;
+    record_util::list_segments(dir, seqs);
+    if (seqs.empty()) {
+        std::cout << "没有找到棋谱段: " << dir << std::endl;
+        return;
+    }
+    std::string last = record_util::segment_path(dir, seqs.back());
+    struct stat sb;
+    if (stat(last.c_str(), &sb) != 0 || truncate(last.c_str(), sb.st_size - 20) != 0) {
+        std::cout << "截断棋谱段失败: " << last << " " << strerror(errno) << std::endl;
+        return;
+    }
+    uint64_t start = time_util::now_us();
+    record_store rs(dir, 4 * 1024 * 1024);
+    uint64_t scan_ms = (time_util::now_us() - start) / 1000;
+    Json::Value st;
+    rs.stats(st);
+    std::string rec;
+    record_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    uint64_t id = rs.push(hdr, std::vector<uint8_t>(3, 112));
+    while (rs.read(id, rec) == false) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    uint64_t recovered = st["games"].asUInt64();
+    st.clear();
+    rs.stats(st);
+    std::cout << "重启: 扫描" << seqs.size() << "个段 " << scan_ms << "ms 恢复 " << recovered
+              << "局（最后一局不完整）, 新对局ID " << id << " 写入新段 " << st["segment"].asUInt() << std::endl;
+    if (system(("rm -rf " + dir).c_str()) != 0) {
+        std::cout << "清理目录失败: " << dir << std::endl;
+    }
+}
+//匹配延迟：撮合引擎中已有1万名等待的玩家（分数间隔400，压测期间彼此不会配对），
+//4个生产者线程（模拟事件循环线程）成对加入分数相近的玩家，测量 后一个玩家入队 -> 配对回调 的延迟，以及入队本身的耗时
+void match_bench()
+{
+    const int backlog = 10000, producers = 4, pairs_per_producer = 2500;
+    const int total = producers * pairs_per_producer * 2;
+    std::vector<std::atomic<uint64_t>> enq_us(backlog + total + 1);
+    std::vector<uint64_t> latency;
+    std::mutex lat_mutex;
+    std::atomic<int> backlog_matched(0);
+    match_loop loop([&](const match_pair &mp) {
+        uint64_t now = time_util::now_us();
+        if (mp.uid1 <= (uint64_t)backlog || mp.uid2 <= (uint64_t)backlog) {
+            backlog_matched++;
+            return;
+        }
+        uint64_t at = std::max(enq_us[mp.uid1].load(), enq_us[mp.uid2].load());
+        std::unique_lock<std::mutex> lock(lat_mutex);
+        latency.push_back(now - at);
+    });
+    uint64_t now_ms = time_util::now_ms();
+    for (int i = 1; i <= backlog; i++) {
+        loop.add(i, i * 400, now_ms);
+    }
+    Json::Value st;
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        st.clear();
+        loop.stats(st);
+    } while (st["waiting"].asUInt64() < (uint64_t)backlog);
+    std::vector<uint64_t> enq_cost[producers];
+    std::vector<std::thread> threads;
+    uint64_t start = time_util::now_us();
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p]() {
+            for (int j = 0; j < pairs_per_producer; j++) {
+                uint64_t uid = backlog + 1 + 2 * (p * pairs_per_producer + j);
+                int score = (1 + (p * pairs_per_producer + j) % backlog) * 400 + 200;
+                for (int k = 0; k < 2; k++) {
+                    uint64_t t = time_util::now_us();
+                    enq_us[uid + k] = t;
+                    loop.add(uid + k, score + k * 10, time_util::now_ms());
+                    enq_cost[p].push_back(time_util::now_us() - t);
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        });
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(lat_mutex);
+            if (latency.size() >= (size_t)producers * pairs_per_producer) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    uint64_t us = time_util::now_us() - start;
+    std::vector<uint64_t> costs;
+    for (auto &c : enq_cost) {
+        costs.insert(costs.end(), c.begin(), c.end());
+    }
+    st.clear();
+    loop.stats(st);
+    std::cout << "匹配: 等待中 " << backlog << "人, 新加入 " << total << "人 用时 " << us / 1000 << "ms, 配对 "
+              << latency.size() << "对 (与积压玩家配对 " << backlog_matched << ") 批次 " << st["batches"].asUInt64()
+              << std::endl;
+    std::cout << "  入队->配对延迟(us) p50:" << percentile(latency, 50) << " p90:" << percentile(latency, 90)
+              << " p99:" << percentile(latency, 99) << " max:" << percentile(latency, 100) << std::endl;
+    std::cout << "  入队耗时(us) p50:" << percentile(costs, 50) << " p99:" << percentile(costs, 99)
+              << " max:" << percentile(costs, 100) << std::endl;
+    //对照：原来的实现加入匹配要与撮合周期抢同一把锁，最坏情况下等待一次完整撮合，配对最多要等一个撮合周期
+    match_engine engine;
+    for (int i = 1; i <= backlog; i++) {
+        engine.add(i, i * 400, now_ms);
+    }
+    std::vector<match_pair> pairs;
+    uint64_t t = time_util::now_us();
+    engine.tick(now_ms, pairs);
+    std::cout << "  对照: " << backlog << "人等待时一次完整撮合 " << time_util::now_us() - t << "us（持锁期间加入匹配被阻塞），"
+              << "撮合周期 " << MATCH_TICK_MS << "ms" << std::endl;
+}
 int main()
 {
+    async_logger::instance().set_file(LOG_FILE);
     gobang_server _server(HOST, USER, PASS, DBNAME, PORT);
-    _server.start(8085);
+    _server.start(8085, LOOP_THREADS);
     return 0;
 }
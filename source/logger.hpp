@@ -22,33 +22,243 @@
 #ifndef M_LOGGER_H  // 头文件守卫（避免使用双下划线开头）
 #define M_LOGGER_H 
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <time.h>
 #include <string.h>  // 添加strftime函数依赖 
+#include <errno.h>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <string>
  
 /* 日志级别定义 
- * INF: 信息级（最高优先级）
- * DBG: 调试级 
- * ERR: 错误级（最低优先级）
- * 数值越小优先级越高 */
-#define INF 0 
-#define DBG 1 
+ * DBG: 调试级（最低优先级）
+ * INF: 信息级 
+ * ERR: 错误级（最高优先级）
+ * 数值越大优先级越高，只输出不低于过滤级别的日志 */
+#define DBG 0 
+#define INF 1 
 #define ERR 2 
  
-/* 默认日志输出级别 
- * 仅显示高于等于该级别的日志 */
+/* 编译期过滤级别：低于该级别的日志调用在编译时就被去掉，发布构建可以 -DLOG_COMPILE_LEVEL=INF */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL DBG
+#endif
+/* 运行期默认过滤级别，可以通过 async_logger::instance().set_level() 修改 */
 #define DEFAULT_LEVEL INF 
+#define LOG_RING_SIZE 8192        //环形缓冲区的记录数，必须是2的幂
+#define LOG_MSG_LEN 232           //单条日志正文的最大长度，超出部分截断
+#define LOG_IDLE_SLEEP_US 1000    //缓冲区为空时写线程的休眠时间
+#define LOG_ROTATE_BYTES (64 * 1024 * 1024) //日志文件超过这个大小时轮转
+#define LOG_ROTATE_FILES 5        //保留的历史日志文件数量 xxx.log.1 ~ xxx.log.5
+
+/* 异步日志：
+ *  调用线程只把级别、位置、粗粒度时间戳和格式化好的正文写入无锁环形缓冲区（多生产者单消费者），
+ *  缓冲区满时丢弃并计数，从不阻塞调用线程；
+ *  后台写线程批量取出记录，时间戳每秒只格式化一次，写入标准输出或按大小轮转的日志文件 */
+class async_logger {
+    private:
+        struct record {
+            std::atomic<uint64_t> seq;//槽位序号，判断槽位是否可写/可读
+            int level;
+            int line;
+            const char *file;
+            time_t sec;
+            uint16_t len;
+            char msg[LOG_MSG_LEN];
+        };
+        record *_ring;
+        char _pad0[64];
+        std::atomic<uint64_t> _enqueue_pos;//生产者之间通过CAS竞争
+        char _pad1[64];
+        uint64_t _dequeue_pos;//只有写线程访问
+        std::atomic<int> _level;
+        std::atomic<bool> _running;
+        std::atomic<uint64_t> _written;
+        std::atomic<uint64_t> _dropped;
+        FILE *_fp;
+        std::string _path;//为空表示输出到标准输出
+        size_t _max_bytes;
+        int _max_files;
+        size_t _file_bytes;
+        std::mutex _sink_mutex;//保护输出目标，写线程只在取出一批记录时加锁
+        std::thread _writer;
+        //时间戳缓存，只由写线程访问
+        time_t _cached_sec;
+        char _cached_ts[16];
+    private:
+        async_logger(): _enqueue_pos(0), _dequeue_pos(0), _level(DEFAULT_LEVEL), _running(true),
+            _written(0), _dropped(0), _fp(stdout), _max_bytes(LOG_ROTATE_BYTES), _max_files(LOG_ROTATE_FILES),
+            _file_bytes(0), _cached_sec(0) {
+            _ring = new record[LOG_RING_SIZE];
+            for (uint64_t i = 0; i < LOG_RING_SIZE; i++) {
+                _ring[i].seq.store(i, std::memory_order_relaxed);
+            }
+            _cached_ts[0] = '\0';
+            _writer = std::thread(&async_logger::writer_entry, this);
+        }
+        ~async_logger() {
+            _running = false;
+            _writer.join();
+            if (_fp != stdout) {
+                fclose(_fp);
+            }
+            delete[] _ring;
+        }
+        const char *timestamp(time_t sec) {
+            if (sec != _cached_sec) {
+                struct tm lt;
+                localtime_r(&sec, &lt);
+                strftime(_cached_ts, sizeof(_cached_ts), "%H:%M:%S", &lt);
+                _cached_sec = sec;
+            }
+            return _cached_ts;
+        }
+        void open_sink() {
+            if (_fp != stdout) {
+                fclose(_fp);
+                _fp = stdout;
+            }
+            _file_bytes = 0;
+            if (_path.empty()) {
+                return;
+            }
+            FILE *fp = fopen(_path.c_str(), "a");
+            if (fp == nullptr) {
+                fprintf(stderr, "open log file %s failed: %s\n", _path.c_str(), strerror(errno));
+                return;
+            }
+            _fp = fp;
+            fseek(_fp, 0, SEEK_END);
+            _file_bytes = ftell(_fp);
+        }
+        //xxx.log -> xxx.log.1 -> ... -> xxx.log.N，最旧的被覆盖
+        void rotate() {
+            fclose(_fp);
+            _fp = stdout;
+            for (int i = _max_files - 1; i >= 1; i--) {
+                std::string from = _path + "." + std::to_string(i);
+                std::string to = _path + "." + std::to_string(i + 1);
+                rename(from.c_str(), to.c_str());
+            }
+            if (_max_files > 0) {
+                rename(_path.c_str(), (_path + ".1").c_str());
+            }
+            open_sink();
+        }
+        void emit(record &r) {
+            static const char *names[] = {"DBG", "INF", "ERR"};
+            int n = fprintf(_fp, "[%s %s %s:%d] %.*s\n", timestamp(r.sec), names[r.level], r.file, r.line, (int)r.len, r.msg);
+            _written++;
+            if (_fp != stdout && n > 0) {
+                _file_bytes += n;
+                if (_file_bytes >= _max_bytes) {
+                    rotate();
+                }
+            }
+        }
+        //取出当前所有可读的记录，返回取出的数量
+        size_t drain() {
+            size_t count = 0;
+            while (true) {
+                record &r = _ring[_dequeue_pos & (LOG_RING_SIZE - 1)];
+                if (r.seq.load(std::memory_order_acquire) != _dequeue_pos + 1) {
+                    break;
+                }
+                emit(r);
+                r.seq.store(_dequeue_pos + LOG_RING_SIZE, std::memory_order_release);
+                _dequeue_pos++;
+                count++;
+            }
+            return count;
+        }
+        void writer_entry() {
+            while (true) {
+                size_t count;
+                {
+                    std::unique_lock<std::mutex> lock(_sink_mutex);
+                    count = drain();
+                    if (count > 0) {
+                        fflush(_fp);
+                        continue;
+                    }
+                }
+                if (_running == false) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(LOG_IDLE_SLEEP_US));
+            }
+            std::unique_lock<std::mutex> lock(_sink_mutex);
+            drain();
+            fflush(_fp);
+        }
+    public:
+        static async_logger &instance() {
+            static async_logger logger;
+            return logger;
+        }
+        int level() { return _level.load(std::memory_order_relaxed); }
+        void set_level(int level) { _level = level; }
+        /*输出到按大小轮转的日志文件，path为空时输出到标准输出；调用之前已经写入的日志仍然写到原来的目标*/
+        void set_file(const std::string &path, size_t max_bytes = LOG_ROTATE_BYTES, int max_files = LOG_ROTATE_FILES) {
+            std::unique_lock<std::mutex> lock(_sink_mutex);
+            drain();
+            fflush(_fp);
+            _path = path;
+            _max_bytes = max_bytes;
+            _max_files = max_files;
+            open_sink();
+        }
+        uint64_t written() { return _written; }
+        uint64_t dropped() { return _dropped; }
+        void write(int level, const char *file, int line, const char *format, ...) __attribute__((format(printf, 5, 6))) {
+            //1. 抢占一个槽位，缓冲区满时丢弃
+            uint64_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+            record *r;
+            while (true) {
+                r = &_ring[pos & (LOG_RING_SIZE - 1)];
+                int64_t diff = (int64_t)r->seq.load(std::memory_order_acquire) - (int64_t)pos;
+                if (diff == 0) {
+                    if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }else if (diff < 0) {
+                    _dropped++;
+                    return;
+                }else {
+                    pos = _enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            //2. 填写记录后发布给写线程
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+            r->level = level;
+            r->file = file;
+            r->line = line;
+            r->sec = ts.tv_sec;
+            va_list ap;
+            va_start(ap, format);
+            int n = vsnprintf(r->msg, LOG_MSG_LEN, format, ap);
+            va_end(ap);
+            n = n < 0 ? 0 : (n >= LOG_MSG_LEN ? LOG_MSG_LEN - 1 : n);
+            //去掉正文结尾多余的换行，每条记录由写线程统一换行
+            while (n > 0 && r->msg[n - 1] == '\n') {
+                n--;
+            }
+            r->len = n;
+            r->seq.store(pos + 1, std::memory_order_release);
+        }
+};
  
 /* 核心日志宏 
- * 功能：根据级别过滤并格式化输出日志 
- * 特性：自动添加时间戳、文件名、行号 */
-#define LOG(level, format, ...) do { \
-    if (level < DEFAULT_LEVEL) break; /* 级别过滤 */ \
-    time_t t = time(NULL); /* 获取当前时间戳 */ \
-    struct tm *lt = localtime(&t); /* 转换为本地时间 */ \
-    char buf[32] = {0}; \
-    strftime(buf, 31, "%H:%M:%S", lt); /* 格式化时间 */ \
-    fprintf(stdout, "[%s %s:%d] " format "\n", \
-        buf, __FILE__, __LINE__, ##__VA_ARGS__); \
+ * 功能：先按编译期级别、再按运行期级别过滤，通过的日志交给异步日志器
+ * 特性：自动添加时间戳、级别、文件名、行号 */
+#define LOG(lv, format, ...) do { \
+    if (lv < LOG_COMPILE_LEVEL) break; /* 编译期过滤 */ \
+    if (lv < async_logger::instance().level()) break; /* 运行期过滤 */ \
+    async_logger::instance().write(lv, __FILE__, __LINE__, format, ##__VA_ARGS__); \
 } while(0)
  
 /* 各级别快捷调用宏 
@@ -57,4 +267,4 @@
 #define DLOG(format, ...) LOG(DBG, format, ##__VA_ARGS__)
 #define ELOG(format, ...) LOG(ERR, format, ##__VA_ARGS__)
  
-#endif // M_LOGGER_H 
\ No newline at end of file
+#endif // M_LOGGER_H
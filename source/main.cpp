@@ -6,17 +6,18 @@
 #define PASS "Gh12345."
 #define DBNAME "gobang"
 #define WEB_PORT 8085    // Web服务器端口
+#define LOOP_THREADS 0   // 事件循环线程数量，0表示使用CPU核心数
 
 int main() {
     // 创建服务器实例
     gobang_server server(HOST, USER, PASS, DBNAME, PORT);
     
     // 启动Web服务器
-    DLOG("五子棋服务器启动中...");
-    DLOG("访问地址: http://localhost:%d", WEB_PORT);
-    DLOG("如果在云服务器，请访问: http://您的公网IP:%d", WEB_PORT);
+    ILOG("五子棋服务器启动中...");
+    ILOG("访问地址: http://localhost:%d", WEB_PORT);
+    ILOG("如果在云服务器，请访问: http://您的公网IP:%d", WEB_PORT);
     
-    server.start(WEB_PORT);
+    server.start(WEB_PORT, LOOP_THREADS);
     
     return 0;
 }
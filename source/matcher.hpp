@@ -4,152 +4,325 @@
 #include "util.hpp"
 #include "online.hpp"
 #include "db.hpp"
+#include "cache.hpp"
 #include "room.hpp"
-#include <list>
+#include "mpmc.hpp"
+#include <set>
 #include <mutex>
+#include <thread>
 #include <condition_variable>
-template <class T>
-class match_queue {
+
+#define MATCH_TICK_MS 200        //撮合周期，每个周期对所有等待中的玩家批量撮合一次
+#define MATCH_BASE_WINDOW 100    //刚开始匹配时可以接受的最大分差
+#define MATCH_WIDEN_PER_SEC 50   //每多等待一秒，可接受的分差放宽多少
+#define MATCH_MAX_WINDOW 1000    //可接受分差的上限
+#define MATCH_QUEUE_SIZE 65536   //加入/取消匹配请求队列的容量（2的幂）
+/*一次配对的结果，带上双方的分数和开始等待时间，创建房间失败时可以原样放回*/
+struct match_pair {
+    uint64_t uid1;
+    uint64_t uid2;
+    int score1;
+    int score2;
+    uint64_t enter1;
+    uint64_t enter2;
+};
+/*撮合引擎：按天梯分数有序索引所有等待中的玩家，与网络/房间无关，可以单独用来做模拟
+ *每个玩家的可接受分差随等待时间线性放宽，两个玩家的分差同时在双方的可接受范围内才能配对*/
+class match_engine {
     private:
-        /*用链表而不直接使用queue是因为我们有中间删除数据的需要*/
-        std::list<T> _list;
-        /*实现线程安全*/
-        std::mutex _mutex;
-        /*这个条件变量主要为了阻塞消费者，后边使用的时候：队列中元素个数<2则阻塞*/
-        std::condition_variable _cond;
+        struct waiter {
+            int score;
+            uint64_t enter_ms;//开始等待的时间
+        };
+        std::unordered_map<uint64_t, waiter> _waiters;
+        std::set<std::pair<int, uint64_t>> _by_score;//(分数, 用户ID)
+        std::set<std::pair<uint64_t, uint64_t>> _by_time;//(开始等待时间, 用户ID)，撮合时等待最久的优先
+    private:
+        static int window(const waiter &w, uint64_t now_ms) {
+            uint64_t wait_ms = now_ms > w.enter_ms ? now_ms - w.enter_ms : 0;
+            uint64_t win = MATCH_BASE_WINDOW + wait_ms * MATCH_WIDEN_PER_SEC / 1000;
+            return win > MATCH_MAX_WINDOW ? MATCH_MAX_WINDOW : (int)win;
+        }
+        //在分数索引中从uid的位置向两侧交替查找分差最小且双方都能接受的对手，找不到返回0
+        uint64_t find_opponent(uint64_t uid, const waiter &w, uint64_t now_ms) {
+            int win = window(w, now_ms);
+            auto self = _by_score.find(std::make_pair(w.score, uid));
+            auto lo = self, hi = self;
+            bool lo_end = (lo == _by_score.begin());
+            ++hi;
+            while (true) {
+                int lo_diff = lo_end ? -1 : w.score - std::prev(lo)->first;
+                int hi_diff = hi == _by_score.end() ? -1 : hi->first - w.score;
+                if ((lo_diff < 0 || lo_diff > win) && (hi_diff < 0 || hi_diff > win)) {
+                    return 0;
+                }
+                uint64_t cand;
+                int diff;
+                if (hi_diff < 0 || (lo_diff >= 0 && lo_diff <= hi_diff)) {
+                    --lo;
+                    cand = lo->second;
+                    diff = lo_diff;
+                    lo_end = (lo == _by_score.begin());
+                }else {
+                    cand = hi->second;
+                    diff = hi_diff;
+                    ++hi;
+                }
+                if (diff <= window(_waiters[cand], now_ms)) {
+                    return cand;
+                }
+            }
+        }
+        //uid与opp配对，两个人都移出等待
+        void pair_up(uint64_t uid, uint64_t opp, std::vector<match_pair> &pairs) {
+            const waiter &w = _waiters[uid], &ow = _waiters[opp];
+            match_pair mp;
+            mp.uid1 = uid;
+            mp.uid2 = opp;
+            mp.score1 = w.score;
+            mp.score2 = ow.score;
+            mp.enter1 = w.enter_ms;
+            mp.enter2 = ow.enter_ms;
+            pairs.push_back(mp);
+            remove(uid);
+            remove(opp);
+        }
     public:
-        /*获取元素个数*/
-        int size() {  
-            std::unique_lock<std::mutex> lock(_mutex);
-            return _list.size(); 
-        }
-        /*判断是否为空*/
-        bool empty() {
-            std::unique_lock<std::mutex> lock(_mutex);
-            return _list.empty();
-        }
-        /*阻塞线程*/
-        void wait() {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _cond.wait(lock);
-        }
-        /*入队数据，并唤醒线程*/
-        void push(const T &data) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _list.push_back(data);
-            _cond.notify_all();
-        }
-        /*出队数据*/
-        bool pop(T &data) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            if (_list.empty() == true) {
+        size_t size() { return _waiters.size(); }
+        bool exists(uint64_t uid) { return _waiters.find(uid) != _waiters.end(); }
+        /*加入等待，enter_ms为开始等待的时间（重新入队的玩家沿用原来的时间，不会失去优先级）*/
+        bool add(uint64_t uid, int score, uint64_t enter_ms) {
+            if (exists(uid)) {
+                return false;
+            }
+            waiter w;
+            w.score = score;
+            w.enter_ms = enter_ms;
+            _waiters.insert(std::make_pair(uid, w));
+            _by_score.insert(std::make_pair(score, uid));
+            _by_time.insert(std::make_pair(enter_ms, uid));
+            return true;
+        }
+        /*取消等待，O(log n)*/
+        bool remove(uint64_t uid) {
+            auto it = _waiters.find(uid);
+            if (it == _waiters.end()) {
                 return false;
             }
-            data = _list.front();
-            _list.pop_front();
+            _by_score.erase(std::make_pair(it->second.score, uid));
+            _by_time.erase(std::make_pair(it->second.enter_ms, uid));
+            _waiters.erase(it);
             return true;
         }
-        /*移除指定的数据*/
-        void remove(T &data) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _list.remove(data);
+        /*一个撮合周期：按等待时间从久到短依次为每个玩家寻找对手，配对成功的两个玩家移出等待*/
+        void tick(uint64_t now_ms, std::vector<match_pair> &pairs) {
+            auto it = _by_time.begin();
+            while (it != _by_time.end()) {
+                std::pair<uint64_t, uint64_t> key = *it;
+                uint64_t uid = key.second;
+                waiter &w = _waiters[uid];
+                uint64_t opp = find_opponent(uid, w, now_ms);
+                if (opp == 0) {
+                    ++it;
+                    continue;
+                }
+                pair_up(uid, opp, pairs);
+                //对手可能就是下一个位置，删除后从当前位置之后重新定位
+                it = _by_time.upper_bound(key);
+            }
+        }
+        /*只为一个刚加入的玩家寻找对手（不必等到下一个撮合周期），配对成功返回true*/
+        bool match(uint64_t uid, uint64_t now_ms, std::vector<match_pair> &pairs) {
+            auto it = _waiters.find(uid);
+            if (it == _waiters.end()) {
+                return false;
+            }
+            uint64_t opp = find_opponent(uid, it->second, now_ms);
+            if (opp == 0) {
+                return false;
+            }
+            pair_up(uid, opp, pairs);
+            return true;
         }
 };
 
-class matcher {
+/*一条加入/取消匹配的请求；取消不去队列中查找原来的加入请求，而是追加一条墓碑，由撮合线程按顺序应用*/
+struct match_op {
+    uint64_t uid;
+    int score;
+    uint64_t enter_ms;
+    bool tombstone;
+};
+/*撮合线程：
+ *  事件循环线程加入/取消匹配只是向无锁队列追加一条请求，从不等待撮合；
+ *  撮合引擎只由撮合线程访问，不需要加锁：每次醒来先把队列中积攒的请求整批取出应用，
+ *  新加入的玩家立即尝试配对，每MATCH_TICK_MS再对所有等待者做一次完整撮合（可接受分差随等待时间放宽）；
+ *  撮合线程空闲时在条件变量上等待，生产者只在它空闲时才加锁唤醒*/
+class match_loop {
     private:
-        /*普通选手匹配队列*/
-        match_queue<uint64_t> _q_normal;//uint64_t是用户ID，<>表示模板参数，表示队列中存储的数据类型
-        /*高手匹配队列*/
-        match_queue<uint64_t> _q_high;
-        /*大神匹配队列*/
-        match_queue<uint64_t> _q_super;
-        /*对应三个匹配队列的处理线程*/
-        std::thread _th_normal;
-        std::thread _th_high;
-        std::thread _th_super;
-        room_manager *_rm;
-        user_table *_ut;
-        online_manager *_om;
+        match_engine _engine;
+        mpmc_queue<match_op, MATCH_QUEUE_SIZE> _queue;
+        std::function<void(const match_pair &)> _on_pair;//配对成功的回调，在撮合线程中执行
+        std::mutex _mutex;//只用于休眠/唤醒
+        std::condition_variable _cond;
+        std::atomic<bool> _idle;
+        bool _stop;
+        //统计信息
+        std::atomic<uint64_t> _waiting;
+        std::atomic<uint64_t> _matched;
+        std::atomic<uint64_t> _batches;
+        std::atomic<uint64_t> _rejected;//队列满被拒绝的请求
+        std::thread _th;
     private:
-        void handle_match(match_queue<uint64_t> &mq) {
-            while(1) {
-                //1. 判断队列人数是否大于2，<2则阻塞等待
-                while (mq.size() < 2) {
-                    mq.wait();
-                }    
-                //2. 走下来代表人数够了，出队两个玩家
-                uint64_t uid1, uid2;
-                bool ret = mq.pop(uid1);
-                if (ret == false) { 
-                    continue; 
+        void wakeup() {
+            if (_idle.load()) {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond.notify_one();
+            }
+        }
+        bool enqueue(const match_op &op) {
+            if (_queue.push(op) == false) {
+                _rejected++;
+                return false;
+            }
+            wakeup();
+            return true;
+        }
+        //取出队列中积攒的请求，按顺序应用；新加入的玩家记到fresh中
+        size_t drain(std::vector<uint64_t> &fresh) {
+            match_op op;
+            size_t n = 0;
+            while (_queue.pop(op)) {
+                n++;
+                if (op.tombstone) {
+                    _engine.remove(op.uid);
+                }else if (_engine.add(op.uid, op.score, op.enter_ms)) {
+                    fresh.push_back(op.uid);
                 }
-                ret = mq.pop(uid2);
-                if (ret == false) { 
-                    this->add(uid1); 
-                    continue; 
+            }
+            return n;
+        }
+        void entry() {
+            std::vector<uint64_t> fresh;
+            std::vector<match_pair> pairs;
+            uint64_t next_tick = time_util::now_ms() + MATCH_TICK_MS;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _idle = true;
+                    _cond.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::milliseconds(next_tick)),
+                        [this]() { return _stop || !_queue.empty(); });
+                    _idle = false;
+                    if (_stop) {
+                        break;
+                    }
                 }
-                //3. 校验两个玩家是否在线，如果有人掉线，则要把另一个人重新添加入队列
-                wsserver_t::connection_ptr conn1 = _om->get_conn_from_hall(uid1);
-                if (conn1.get() == nullptr) {
-                    this->add(uid2); 
-                    continue;
+                if (drain(fresh) != 0) {
+                    _batches++;
                 }
-                wsserver_t::connection_ptr conn2 = _om->get_conn_from_hall(uid2);
-                if (conn2.get() == nullptr) {
-                    this->add(uid1); 
-                    continue;
+                uint64_t now = time_util::now_ms();
+                if (now >= next_tick) {
+                    _engine.tick(now, pairs);
+                    next_tick = now + MATCH_TICK_MS;
+                }else {
+                    for (uint64_t uid : fresh) {
+                        _engine.match(uid, now, pairs);
+                    }
                 }
-                //4. 为两个玩家创建房间，并将玩家加入房间中
-                room_ptr rp = _rm->create_room(uid1, uid2);
-                if (rp.get() == nullptr) {
-                    this->add(uid1);
-                    this->add(uid2);
-                    continue;
+                fresh.clear();
+                _waiting = _engine.size();
+                _matched += pairs.size();
+                for (auto &mp : pairs) {
+                    _on_pair(mp);
                 }
-                //5. 对两个玩家进行响应
-                Json::Value resp;
-                resp["optype"] = "match_success";
-                resp["result"] = true;
-                resp["room_id"] = (Json::UInt64)rp->id();
-                std::string body;
-                json_util::serialize(resp, body);
-                conn1->send(body);
-                conn2->send(body);
+                pairs.clear();
             }
         }
-        void th_normal_entry() { return handle_match(_q_normal); }
-        void th_high_entry() { return handle_match(_q_high); }
-        void th_super_entry() { return handle_match(_q_super); }
     public:
-        matcher(room_manager *rm, user_table *ut, online_manager *om): 
-            _rm(rm), _ut(ut), _om(om),
-            _th_normal(std::thread(&matcher::th_normal_entry, this)),
-            _th_high(std::thread(&matcher::th_high_entry, this)),
-            _th_super(std::thread(&matcher::th_super_entry, this)){
-            DLOG("游戏匹配模块初始化完毕....");
+        match_loop(const std::function<void(const match_pair &)> &on_pair):
+            _on_pair(on_pair), _idle(false), _stop(false), _waiting(0), _matched(0), _batches(0), _rejected(0),
+            _th(std::thread(&match_loop::entry, this)) {}
+        ~match_loop() {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+                _cond.notify_all();
+            }
+            _th.join();
         }
-        bool add(uint64_t uid) {
-            //根据玩家的天梯分数，来判定玩家档次，添加到不同的匹配队列
-            // 1. 根据用户ID，获取玩家信息
-            Json::Value user;
-            bool ret = _ut->select_by_id(uid, user);
-            if (ret == false) {
-                DLOG("获取玩家:%lu 信息失败！！", uid);
-                return false;
+        /*加入匹配，任意线程调用，不阻塞；队列满返回false*/
+        bool add(uint64_t uid, int score, uint64_t enter_ms) {
+            match_op op;
+            op.uid = uid;
+            op.score = score;
+            op.enter_ms = enter_ms;
+            op.tombstone = false;
+            return enqueue(op);
+        }
+        /*取消匹配，任意线程调用，不阻塞*/
+        bool cancel(uint64_t uid) {
+            match_op op;
+            op.uid = uid;
+            op.score = 0;
+            op.enter_ms = 0;
+            op.tombstone = true;
+            return enqueue(op);
+        }
+        /*只能在配对回调中（撮合线程）调用：房间没有建成时把玩家按原来的分数和等待时间直接放回引擎*/
+        void requeue(uint64_t uid, int score, uint64_t enter_ms) {
+            _engine.add(uid, score, enter_ms);
+            _waiting = _engine.size();
+        }
+        void stats(Json::Value &val) {
+            val["waiting"] = (Json::UInt64)_waiting;
+            val["matched"] = (Json::UInt64)_matched;
+            val["batches"] = (Json::UInt64)_batches;
+            val["rejected"] = (Json::UInt64)_rejected;
+            val["queued"] = (Json::UInt64)_queue.size();
+        }
+};
+
+class matcher {
+    private:
+        room_manager *_rm;
+        user_cache *_ut;
+        online_manager *_om;
+        match_loop _loop;//放在最后：析构时先停止撮合线程
+    private:
+        //为配对成功的两个玩家创建房间，有人掉线则把另一个人按原来的等待时间放回等待；在撮合线程中执行，不访问数据库
+        void handle_pair(const match_pair &mp) {
+            //1. 校验两个玩家是否在线，如果有人掉线，则要把另一个人重新添加入等待
+            wsserver_t::connection_ptr conn1 = _om->get_conn_from_hall(mp.uid1);
+            wsserver_t::connection_ptr conn2 = _om->get_conn_from_hall(mp.uid2);
+            if (conn1.get() == nullptr || conn2.get() == nullptr) {
+                if (conn1.get() != nullptr) _loop.requeue(mp.uid1, mp.score1, mp.enter1);
+                if (conn2.get() != nullptr) _loop.requeue(mp.uid2, mp.score2, mp.enter2);
+                return;
             }
-            int score = user["score"].asInt();
-            // 2. 添加到指定的队列中
-            if (score < 2000) {
-                _q_normal.push(uid);
-            }else if (score >= 2000 && score < 3000) {
-                _q_high.push(uid);
-            }else {
-                _q_super.push(uid);
+            //2. 为两个玩家创建房间，并将玩家加入房间中
+            room_ptr rp = _rm->create_room(mp.uid1, mp.uid2);
+            if (rp.get() == nullptr) {
+                _loop.requeue(mp.uid1, mp.score1, mp.enter1);
+                _loop.requeue(mp.uid2, mp.score2, mp.enter2);
+                return;
             }
-            return true;
+            //3. 对两个玩家进行响应
+            Json::Value resp;
+            resp["optype"] = "match_success";
+            resp["result"] = true;
+            resp["room_id"] = (Json::UInt64)rp->id();
+            std::string body;
+            json_util::serialize(resp, body);
+            std::vector<wsserver_t::connection_ptr> conns = {conn1, conn2};
+            ws_util::send_all(conns, websocketpp::frame::opcode::text, body);
         }
-        bool del(uint64_t uid) {
+    public:
+        matcher(room_manager *rm, user_cache *ut, online_manager *om):
+            _rm(rm), _ut(ut), _om(om), _loop(std::bind(&matcher::handle_pair, this, std::placeholders::_1)) {
+            ILOG("游戏匹配模块初始化完毕....");
+        }
+        bool add(uint64_t uid) {
+            // 1. 根据用户ID，获取玩家的天梯分数（在调用者的事件循环线程中从用户缓存读取，撮合线程不访问数据库）
             Json::Value user;
             bool ret = _ut->select_by_id(uid, user);
             if (ret == false) {
@@ -157,15 +330,12 @@ class matcher {
                 return false;
             }
             int score = user["score"].asInt();
-            // 2. 添加到指定的队列中
-            if (score < 2000) {
-                _q_normal.remove(uid);
-            }else if (score >= 2000 && score < 3000) {
-                _q_high.remove(uid);
-            }else {
-                _q_super.remove(uid);
-            }
-            return true;
+            // 2. 追加到撮合线程的请求队列，不等待撮合
+            return _loop.add(uid, score, time_util::now_ms());
+        }
+        bool del(uint64_t uid) {
+            return _loop.cancel(uid);
         }
+        void stats(Json::Value &val) { _loop.stats(val); }
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,81 @@
+#ifndef __M_MPMC_H__
+#define __M_MPMC_H__
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+/*有界多生产者多消费者无锁队列（Vyukov）：
+ *  每个槽位带一个序号，生产者/消费者各自用CAS抢占位置，再通过槽位序号交接数据，
+ *  不加锁、不分配内存；队列满时push返回false，空时pop返回false，由调用者决定如何处理。SIZE必须是2的幂*/
+template <class T, size_t SIZE>
+class mpmc_queue {
+    private:
+        static_assert((SIZE & (SIZE - 1)) == 0, "SIZE必须是2的幂");
+        struct cell {
+            std::atomic<uint64_t> seq;
+            T data;
+        };
+        cell *_cells;//放在堆上，队列对象可以直接作为其他对象的成员
+        char _pad0[64];
+        std::atomic<uint64_t> _enqueue_pos;
+        char _pad1[64];
+        std::atomic<uint64_t> _dequeue_pos;
+        char _pad2[64];
+    public:
+        mpmc_queue(): _cells(new cell[SIZE]), _enqueue_pos(0), _dequeue_pos(0) {
+            for (size_t i = 0; i < SIZE; i++) {
+                _cells[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+        ~mpmc_queue() { delete[] _cells; }
+        mpmc_queue(const mpmc_queue &) = delete;
+        mpmc_queue &operator=(const mpmc_queue &) = delete;
+        bool push(const T &val) {
+            uint64_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+            cell *c;
+            while (true) {
+                c = &_cells[pos & (SIZE - 1)];
+                int64_t diff = (int64_t)c->seq.load(std::memory_order_acquire) - (int64_t)pos;
+                if (diff == 0) {
+                    if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }else if (diff < 0) {
+                    return false;//满
+                }else {
+                    pos = _enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            c->data = val;
+            c->seq.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+        bool pop(T &val) {
+            uint64_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+            cell *c;
+            while (true) {
+                c = &_cells[pos & (SIZE - 1)];
+                int64_t diff = (int64_t)c->seq.load(std::memory_order_acquire) - (int64_t)(pos + 1);
+                if (diff == 0) {
+                    if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }else if (diff < 0) {
+                    return false;//空
+                }else {
+                    pos = _dequeue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            val = c->data;
+            c->seq.store(pos + SIZE, std::memory_order_release);
+            return true;
+        }
+        /*近似的元素个数，并发修改时只作参考*/
+        size_t size() {
+            uint64_t e = _enqueue_pos.load(std::memory_order_acquire);
+            uint64_t d = _dequeue_pos.load(std::memory_order_acquire);
+            return e > d ? e - d : 0;
+        }
+        bool empty() { return size() == 0; }
+};
+#endif
@@ -1,70 +1,65 @@
 #ifndef __M_ONLINE_H__
 #define __M_ONLINE_H__
 #include "util.hpp"
+#include "rcu.hpp"
 #include <mutex>
+#include <atomic>
+#include <thread>
 #include <unordered_map>
 
+#define ONLINE_SHARDS 32 //在线用户表按用户ID分片的数量
+/*在线用户管理：按用户ID分片，每个分片一个大厅表一个房间表
+ *走棋/广播/匹配时的查询是热点，读路径不加锁；进入/离开大厅和房间时才写，写只锁对应分片*/
 class online_manager{
    private:
-        std::mutex _mutex;
-        //用于建立游戏大厅用户的用户ID与通信连接的关系
-        std::unordered_map<uint64_t,  wsserver_t::connection_ptr>  _hall_user;//unordered_map是一个哈希表，key是用户ID，value是通信连接
-        //用于建立游戏房间用户的用户ID与通信连接的关系
-        std::unordered_map<uint64_t,  wsserver_t::connection_ptr>  _room_user;
+        struct shard {
+            //用于建立游戏大厅用户的用户ID与通信连接的关系
+            rcu_map<wsserver_t::connection_ptr> hall_user;
+            //用于建立游戏房间用户的用户ID与通信连接的关系
+            rcu_map<wsserver_t::connection_ptr> room_user;
+        };
+        shard _shards[ONLINE_SHARDS];
+   private:
+        shard &get_shard(uint64_t uid) { return _shards[uid % ONLINE_SHARDS]; }
    public:
         //websocket连接建立的时候才会加入游戏大厅&游戏房间在线用户管理
         void enter_game_hall(uint64_t uid,   wsserver_t::connection_ptr &conn) {
-            std::unique_lock<std::mutex> lock(_mutex);//加锁,自动锁定和解锁
-            _hall_user.insert(std::make_pair(uid, conn));//make_pair函数用于将两个值组合成一个pair对象,key是uid，value是conn
+            get_shard(uid).hall_user.insert(uid, conn);
         }
         void enter_game_room(uint64_t uid,   wsserver_t::connection_ptr &conn) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _room_user.insert(std::make_pair(uid, conn));
+            get_shard(uid).room_user.insert(uid, conn);
+        }
+        //用新连接顶替用户已有的房间连接，顶替过程中用户始终在线，返回被顶替的旧连接（没有则为空）
+        wsserver_t::connection_ptr replace_game_room(uint64_t uid, wsserver_t::connection_ptr &conn) {
+            wsserver_t::connection_ptr old;
+            get_shard(uid).room_user.replace(uid, conn, &old);
+            return old;
         }
         //websocket连接断开的时候，才会移除游戏大厅&游戏房间在线用户管理
         void exit_game_hall(uint64_t uid) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _hall_user.erase(uid);//erase函数用于删除指定的元素
+            get_shard(uid).hall_user.erase(uid);
         }
         void exit_game_room(uint64_t uid) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _room_user.erase(uid);
+            get_shard(uid).room_user.erase(uid);
         }
         //判断当前指定用户是否在游戏大厅/游戏房间
         bool is_in_game_hall(uint64_t uid) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _hall_user.find(uid);//find函数用于查找指定的元素,it是一个迭代器，指向查找的元素,it初始值为hall_user的开始位置
-            //如果没有找到指定的元素，返回false
-            if (it == _hall_user.end()) {
-                return false;
-            }
-            return true;
+            return get_shard(uid).hall_user.find(uid, nullptr);
         }
         bool is_in_game_room(uint64_t uid) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _room_user.find(uid);
-            if (it == _room_user.end()) {
-                return false;
-            }
-            return true;
+            return get_shard(uid).room_user.find(uid, nullptr);
         }
-        //通过用户ID在游戏大厅/游戏房间用户管理中获取对应的通信连接
+        //通过用户ID在游戏大厅/游戏房间用户管理中获取对应的通信连接，不存在则返回一个空的连接
         wsserver_t::connection_ptr get_conn_from_hall(uint64_t uid) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _hall_user.find(uid);
-            if (it == _hall_user.end()) {//如果没有找到指定的元素，返回一个空的连接
-                return wsserver_t::connection_ptr();//返回一个空的连接
-            }
-            return it->second;//it->second表示迭代器指向的元素的第二个值,即conn
+            wsserver_t::connection_ptr conn;
+            get_shard(uid).hall_user.find(uid, &conn);
+            return conn;
         }
         wsserver_t::connection_ptr get_conn_from_room(uint64_t uid) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _room_user.find(uid);
-            if (it == _room_user.end()) {
-                return wsserver_t::connection_ptr();
-            }
-            return it->second;
+            wsserver_t::connection_ptr conn;
+            get_shard(uid).room_user.find(uid, &conn);
+            return conn;
         }
 };
 
-#endif
\ No newline at end of file
+#endif
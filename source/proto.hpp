@@ -0,0 +1,128 @@
+#ifndef __M_PROTO_H__
+#define __M_PROTO_H__
+#include "util.hpp"
+
+#define GOBANG_BIN_PROTO "gobang.bin.v1" //房间二进制子协议名称，握手时客户端请求了该子协议才使用二进制帧
+#define PROTO_MOVE 0x01         //客户端->服务器：走棋
+#define PROTO_MOVE_RESULT 0x81  //服务器->客户端：走棋结果
+#define PROTO_MOVE_LEN 4
+#define PROTO_MOVE_RESULT_LEN 24
+/*走棋结果状态码，二进制帧中直接发送状态码，由客户端自己映射成提示文字*/
+typedef enum {
+    MOVE_OK = 0,           //走棋成功，游戏继续
+    MOVE_WIN,              //走棋成功，五星连珠
+    MOVE_OFFLINE_WIN,      //对方不在房间中，不战而胜
+    MOVE_EXIT_WIN,         //对方退出房间，不战而胜
+    MOVE_OCCUPIED,         //位置已经被占用
+    MOVE_ROOM_MISMATCH,    //房间号不匹配
+    MOVE_BAD_FRAME,        //请求帧格式错误
+    MOVE_NOT_YOUR_TURN,    //还没有轮到该玩家
+    MOVE_OUT_OF_RANGE,     //坐标超出棋盘
+    MOVE_FORBIDDEN,        //禁手（开启禁手规则时）
+    MOVE_GAME_OVER,        //对局已经结束
+    MOVE_NOT_PLAYER,       //不是房间中的对局者
+    MOVE_DRAW,             //走棋成功，棋盘已满，和棋
+}move_status;
+/*一次走棋的结果，JSON和二进制两种编码都由它生成*/
+struct move_result {
+    move_status status;
+    uint64_t uid;     //走棋的玩家
+    int row;
+    int col;
+    int color;        //落子颜色，没有落子时为0
+    int move_no;      //这一步是第几手（从1开始），没有落子时为0
+    uint64_t winner;  //胜利者，游戏继续时为0
+};
+/*房间走棋的二进制帧（网络字节序）：
+ *  走棋请求 4字节:  [0]type=PROTO_MOVE [1]row [2]col [3]保留
+ *  走棋结果 24字节: [0]type=PROTO_MOVE_RESULT [1]status [2]row [3]col（int8，退出时为-1） [4]color [5-6]move_no [7]保留
+ *                   [8-15]uid [16-23]winner*/
+class proto_util{
+    private:
+        static void put_u64(char *p, uint64_t val) {
+            for (int i = 7; i >= 0; i--) {
+                p[i] = (char)(val & 0xFF);
+                val >>= 8;
+            }
+        }
+    public:
+        static bool success(move_status status) {
+            return status == MOVE_OK || status == MOVE_WIN ||
+                   status == MOVE_OFFLINE_WIN || status == MOVE_EXIT_WIN || status == MOVE_DRAW;
+        }
+        static const char *reason(move_status status) {
+            switch (status) {
+                case MOVE_OK: return "";
+                case MOVE_WIN: return "五星连珠，战无敌！";
+                case MOVE_OFFLINE_WIN: return "运气真好！对方掉线，不战而胜！";
+                case MOVE_EXIT_WIN: return "对方掉线，不战而胜！";
+                case MOVE_OCCUPIED: return "当前位置已经有了其他棋子！";
+                case MOVE_ROOM_MISMATCH: return "房间号不匹配！";
+                case MOVE_BAD_FRAME: return "请求解析失败";
+                case MOVE_NOT_YOUR_TURN: return "还没有轮到你！";
+                case MOVE_OUT_OF_RANGE: return "位置超出棋盘范围！";
+                case MOVE_FORBIDDEN: return "禁手！";
+                case MOVE_GAME_OVER: return "对局已经结束！";
+                case MOVE_NOT_PLAYER: return "你不是本房间的对局者！";
+                case MOVE_DRAW: return "棋盘已满，和棋！";
+            }
+            return "";
+        }
+        /*解析走棋请求帧，长度或类型不对返回false*/
+        static bool decode_move(const std::string &frame, int &row, int &col) {
+            if (frame.size() != PROTO_MOVE_LEN || (uint8_t)frame[0] != PROTO_MOVE) {
+                return false;
+            }
+            row = (uint8_t)frame[1];
+            col = (uint8_t)frame[2];
+            return true;
+        }
+        static void encode_move_result(const move_result &mr, std::string &frame) {
+            frame.assign(PROTO_MOVE_RESULT_LEN, '\0');
+            char *p = &frame[0];
+            p[0] = (char)PROTO_MOVE_RESULT;
+            p[1] = (char)mr.status;
+            p[2] = (char)(int8_t)mr.row;
+            p[3] = (char)(int8_t)mr.col;
+            p[4] = (char)mr.color;
+            p[5] = (char)((mr.move_no >> 8) & 0xFF);
+            p[6] = (char)(mr.move_no & 0xFF);
+            put_u64(p + 8, mr.uid);
+            put_u64(p + 16, mr.winner);
+        }
+        /*JSON编码，字段与原来的put_chess响应保持一致，只是不再回显整个请求*/
+        static void move_result_json(const move_result &mr, uint64_t room_id, Json::Value &resp) {
+            resp["optype"] = "put_chess";
+            resp["result"] = success(mr.status);
+            if (mr.status != MOVE_OK) {
+                resp["reason"] = reason(mr.status);
+            }
+            resp["room_id"] = (Json::UInt64)room_id;
+            resp["uid"] = (Json::UInt64)mr.uid;
+            resp["row"] = mr.row;
+            resp["col"] = mr.col;
+            resp["winner"] = (Json::UInt64)mr.winner;
+            if (mr.color != 0) {
+                resp["chess_color"] = mr.color;
+                resp["move_no"] = mr.move_no;
+            }
+        }
+        /*被拒绝的走棋只回复给走棋的玩家，内容只和状态码有关，每种状态预先序列化一次*/
+        static const std::string &reject_json(move_status status) {
+            static const std::vector<std::string> bodies = [] {
+                std::vector<std::string> v;
+                for (int s = 0; s <= MOVE_DRAW; s++) {
+                    Json::Value resp;
+                    resp["optype"] = "put_chess";
+                    resp["result"] = false;
+                    resp["reason"] = reason((move_status)s);
+                    std::string body;
+                    json_util::serialize(resp, body);
+                    v.push_back(body);
+                }
+                return v;
+            }();
+            return bodies[status];
+        }
+};
+#endif
@@ -0,0 +1,150 @@
+#ifndef __M_RCU_H__
+#define __M_RCU_H__
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#define RCU_BUCKETS 256 //哈希表默认的桶数量（固定，不扩容）
+#define RCU_RETIRE_BATCH 64 //摘除的节点攒够这么多再统一等待读者离开后释放
+/*读多写少的哈希表：固定数量的桶，每个桶是一条原子指针链表
+ *  读：不加锁，进入时在当前纪元对应的读者计数上+1，离开时-1
+ *  写：表内互斥；插入直接挂到链表头；删除只把节点从链表摘下放入待释放列表，
+ *      攒够一批后翻转两次纪元，每次等待上一个纪元的读者计数归零（类似SRCU），此时已经没有读者能看到这些节点，再统一释放*/
+template <class V, size_t BUCKETS = RCU_BUCKETS>
+class rcu_map {
+    private:
+        struct node {
+            uint64_t key;
+            V val;
+            std::atomic<node *> next;
+        };
+        std::mutex _mutex;//写者互斥
+        std::atomic<node *> _buckets[BUCKETS];
+        std::atomic<unsigned> _epoch;
+        std::atomic<int> _readers[2];
+        std::vector<node *> _retired;//已经摘除、等待释放的节点
+    private:
+        //乘法散列，分片之后同一张表内的key同余，直接取模会集中在少数几个桶上
+        std::atomic<node *> &bucket(uint64_t key) {
+            return _buckets[(key * 0x9E3779B97F4A7C15ULL >> 32) % BUCKETS];
+        }
+        void synchronize() {
+            for (int i = 0; i < 2; i++) {
+                unsigned old = _epoch.fetch_add(1);
+                while (_readers[old & 1].load() != 0) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        void reclaim() {
+            synchronize();
+            for (auto n : _retired) {
+                delete n;
+            }
+            _retired.clear();
+        }
+    public:
+        rcu_map(): _epoch(0) {
+            for (size_t i = 0; i < BUCKETS; i++) {
+                _buckets[i] = nullptr;
+            }
+            _readers[0] = 0;
+            _readers[1] = 0;
+        }
+        ~rcu_map() {
+            for (size_t i = 0; i < BUCKETS; i++) {
+                node *n = _buckets[i].load();
+                while (n != nullptr) {
+                    node *next = n->next.load();
+                    delete n;
+                    n = next;
+                }
+            }
+            for (auto n : _retired) {
+                delete n;
+            }
+        }
+        /*查找，找到则把值复制到val中（val可以为空）*/
+        bool find(uint64_t key, V *val) {
+            unsigned e = _epoch.load() & 1;
+            _readers[e]++;
+            bool found = false;
+            for (node *n = bucket(key).load(); n != nullptr; n = n->next.load()) {
+                if (n->key == key) {
+                    found = true;
+                    if (val != nullptr) {
+                        *val = n->val;
+                    }
+                    break;
+                }
+            }
+            _readers[e]--;
+            return found;
+        }
+        /*插入，key已经存在时不覆盖，返回是否插入成功*/
+        bool insert(uint64_t key, const V &val) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            std::atomic<node *> &head = bucket(key);
+            for (node *n = head.load(); n != nullptr; n = n->next.load()) {
+                if (n->key == key) {
+                    return false;
+                }
+            }
+            node *n = new node;
+            n->key = key;
+            n->val = val;
+            n->next = head.load();
+            head.store(n);//节点内容写完之后才发布给读者
+            return true;
+        }
+        /*插入或覆盖：key已经存在时用新节点整体替换旧节点，读者看到的要么是旧值要么是新值，中间不会出现key不存在；
+         *old不为空时返回被替换的旧值，返回key之前是否存在*/
+        bool replace(uint64_t key, const V &val, V *old) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            std::atomic<node *> *prev = &bucket(key);
+            for (node *n = prev->load(); n != nullptr; n = n->next.load()) {
+                if (n->key == key) {
+                    node *r = new node;
+                    r->key = key;
+                    r->val = val;
+                    r->next = n->next.load();
+                    prev->store(r);
+                    if (old != nullptr) {
+                        *old = n->val;
+                    }
+                    _retired.push_back(n);
+                    if (_retired.size() >= RCU_RETIRE_BATCH) {
+                        reclaim();
+                    }
+                    return true;
+                }
+                prev = &n->next;
+            }
+            node *n = new node;
+            n->key = key;
+            n->val = val;
+            n->next = bucket(key).load();
+            bucket(key).store(n);
+            return false;
+        }
+        /*删除，返回key是否存在*/
+        bool erase(uint64_t key) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            std::atomic<node *> *prev = &bucket(key);
+            for (node *n = prev->load(); n != nullptr; n = n->next.load()) {
+                if (n->key == key) {
+                    prev->store(n->next.load());
+                    _retired.push_back(n);
+                    if (_retired.size() >= RCU_RETIRE_BATCH) {
+                        reclaim();
+                    }
+                    return true;
+                }
+                prev = &n->next;
+            }
+            return false;
+        }
+};
+#endif
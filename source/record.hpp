@@ -0,0 +1,423 @@
+#ifndef __M_RECORD_H__
+#define __M_RECORD_H__
+#include "util.hpp"
+#include "board.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <algorithm>
+
+#define RECORD_DIR "./records"                  //棋谱段文件所在目录
+#define RECORD_MAGIC "GBREC001"
+#define RECORD_SEGMENT_BYTES (64 * 1024 * 1024) //段文件超过这个大小时切换到新的段
+#define RECORD_USER_GAMES 50                    //按用户查询时最多返回最近的对局数
+#define RECORD_RETRY_MS 1000                    //写盘失败后的重试间隔
+
+/*棋谱格式：
+ *  记录保存在只追加的段文件 records/000001.rec、000002.rec ... 中，每个段16字节段头 + 若干条记录；
+ *  每条记录 40字节记录头 + 每手1字节（row*BOARD_COL+col，白棋先行，颜色由奇偶决定），不对齐、紧密排列；
+ *  记录头中的校验覆盖除校验字段之外的整条记录，启动扫描时据此识别崩溃时写了一半的尾部记录（扫描到此为止，
+ *  重启之后的记录总是写入新的段，不会接在残缺的尾部后面）*/
+struct record_segment_header {
+    char magic[8];
+    uint32_t seq;     //段序号，与文件名一致
+    uint32_t reserved;
+};
+struct record_header {
+    uint32_t check;   //FNV-1a校验
+    uint16_t size;    //整条记录的字节数（记录头+着法）
+    uint8_t result;   //0和棋 1白胜 2黑胜
+    uint8_t reason;   //结束原因，走棋结果的状态码（五连/掉线/退出/和棋）
+    uint64_t id;      //对局ID，全局递增，重启后从已有记录的最大值继续
+    uint64_t white;
+    uint64_t black;
+    uint32_t start;   //开局时间（unix秒）
+    uint16_t seconds; //对局时长
+    uint8_t moves;    //手数
+    uint8_t flags;    //RECORD_RENJU | RECORD_VS_AI
+};
+#define RECORD_RENJU 0x01
+#define RECORD_VS_AI 0x02
+
+/*棋谱的编码/解码，服务器和离线分析工具共用*/
+class record_util {
+    public:
+        static uint32_t fnv1a(const char *p, size_t len) {
+            uint32_t h = 2166136261u;
+            for (size_t i = 0; i < len; i++) {
+                h ^= (uint8_t)p[i];
+                h *= 16777619u;
+            }
+            return h;
+        }
+        /*把记录头和着法编码成一条记录，追加到out*/
+        static void encode(record_header hdr, const std::vector<uint8_t> &moves, std::string &out) {
+            hdr.moves = (uint8_t)moves.size();
+            hdr.size = (uint16_t)(sizeof(record_header) + moves.size());
+            size_t pos = out.size();
+            out.append((const char *)&hdr, sizeof(hdr));
+            out.append((const char *)moves.data(), moves.size());
+            uint32_t check = fnv1a(&out[pos] + sizeof(uint32_t), hdr.size - sizeof(uint32_t));
+            memcpy(&out[pos], &check, sizeof(check));
+        }
+        /*从p开始解析一条记录，长度/校验不对返回false；记录在文件中不对齐，用memcpy取记录头*/
+        static bool parse(const char *p, size_t len, record_header &hdr) {
+            if (len < sizeof(record_header)) {
+                return false;
+            }
+            memcpy(&hdr, p, sizeof(hdr));
+            if (hdr.size < sizeof(record_header) || hdr.size > len ||
+                hdr.size != sizeof(record_header) + hdr.moves || hdr.moves > BOARD_ROW * BOARD_COL) {
+                return false;
+            }
+            return hdr.check == fnv1a(p + sizeof(uint32_t), hdr.size - sizeof(uint32_t));
+        }
+        static void to_json(const record_header &hdr, const char *moves, Json::Value &val) {
+            val["id"] = (Json::UInt64)hdr.id;
+            val["white_id"] = (Json::UInt64)hdr.white;
+            val["black_id"] = (Json::UInt64)hdr.black;
+            val["result"] = hdr.result;
+            val["reason"] = hdr.reason;
+            val["start"] = hdr.start;
+            val["seconds"] = hdr.seconds;
+            val["renju"] = (hdr.flags & RECORD_RENJU) != 0;
+            val["vs_ai"] = (hdr.flags & RECORD_VS_AI) != 0;
+            Json::Value &arr = val["moves"];
+            arr = Json::Value(Json::arrayValue);
+            for (int i = 0; i < hdr.moves; i++) {
+                arr.append((uint8_t)moves[i]);
+            }
+        }
+        static std::string segment_path(const std::string &dir, uint32_t seq) {
+            char name[32];
+            snprintf(name, sizeof(name), "/%06u.rec", seq);
+            return dir + name;
+        }
+        /*目录中已有的段序号，升序*/
+        static void list_segments(const std::string &dir, std::vector<uint32_t> &seqs) {
+            DIR *dp = opendir(dir.c_str());
+            if (dp == nullptr) {
+                return;
+            }
+            struct dirent *de;
+            while ((de = readdir(dp)) != nullptr) {
+                unsigned seq;
+                char tail[8];
+                if (sscanf(de->d_name, "%u.%7s", &seq, tail) == 2 && strcmp(tail, "rec") == 0) {
+                    seqs.push_back(seq);
+                }
+            }
+            closedir(dp);
+            std::sort(seqs.begin(), seqs.end());
+        }
+        /*把整个段映射到内存，校验段头；返回映射长度，失败返回0*/
+        static size_t map_segment(const std::string &path, const char *&base) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return 0;
+            }
+            struct stat st;
+            if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(record_segment_header)) {
+                close(fd);
+                return 0;
+            }
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (p == MAP_FAILED) {
+                return 0;
+            }
+            if (memcmp(p, RECORD_MAGIC, 8) != 0) {
+                munmap(p, st.st_size);
+                return 0;
+            }
+            base = (const char *)p;
+            return st.st_size;
+        }
+};
+
+/*对局记录存储：
+ *  对局结束时房间在自己的锁内只把记录编码后放入待写队列（分配对局ID），不做磁盘IO；
+ *  后台线程批量追加到当前段文件，每批一次fdatasync，段写满后切换新段；写盘失败时截掉写了一半的数据，整批放回队首稍后重试，
+ *  已经分配出去的对局ID最终都能回放；
+ *  内存中维护 对局ID->(段,偏移,长度) 和 用户ID->对局ID列表 两个索引，启动时扫描所有段重建；
+ *  回放时按索引从段文件pread出原始记录，不需要解析整段*/
+class record_store {
+    private:
+        struct location {
+            uint32_t seq;
+            uint32_t size;
+            uint64_t offset;
+        };
+        std::string _dir;
+        size_t _segment_bytes;
+        std::atomic<uint64_t> _next_id;
+        //写线程
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        std::vector<std::string> _pending;//编码好的记录
+        bool _stop;
+        std::thread _worker;
+        int _fd;//当前段，只有写线程访问
+        std::atomic<uint32_t> _seq;
+        uint64_t _seg_size;
+        //索引
+        std::mutex _index_mutex;
+        std::unordered_map<uint64_t, location> _games;
+        std::unordered_map<uint64_t, std::vector<uint64_t>> _users;
+        std::unordered_map<uint32_t, int> _readers;//段序号 -> 只读文件描述符
+        //统计信息
+        std::atomic<uint64_t> _written;
+        std::atomic<uint64_t> _bytes;
+        std::atomic<uint64_t> _batches;
+        std::atomic<uint64_t> _failures;
+    private:
+        void index(uint32_t seq, uint64_t offset, const record_header &hdr) {
+            location loc;
+            loc.seq = seq;
+            loc.size = hdr.size;
+            loc.offset = offset;
+            _games[hdr.id] = loc;
+            _users[hdr.white].push_back(hdr.id);
+            _users[hdr.black].push_back(hdr.id);
+        }
+        /*扫描一个段，建立索引，返回最后一条完整记录之后的偏移*/
+        uint64_t scan(uint32_t seq, uint64_t &max_id) {
+            const char *base;
+            size_t len = record_util::map_segment(record_util::segment_path(_dir, seq), base);
+            if (len == 0) {
+                ELOG("棋谱段 %06u 无法读取，跳过", seq);
+                return 0;
+            }
+            uint64_t off = sizeof(record_segment_header);
+            record_header hdr;
+            while (record_util::parse(base + off, len - off, hdr)) {
+                index(seq, off, hdr);
+                max_id = std::max(max_id, hdr.id);
+                off += hdr.size;
+            }
+            if (off != len) {
+                ELOG("棋谱段 %06u 在偏移%lu处有%lu字节不完整的记录", seq, off, len - off);
+            }
+            munmap((void *)base, len);
+            return off;
+        }
+        bool open_segment(uint32_t seq) {
+            std::string path = record_util::segment_path(_dir, seq);
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+            if (fd < 0) {
+                ELOG("创建棋谱段失败: %s %s", path.c_str(), strerror(errno));
+                return false;
+            }
+            record_segment_header sh;
+            memcpy(sh.magic, RECORD_MAGIC, 8);
+            sh.seq = seq;
+            sh.reserved = 0;
+            if (write(fd, &sh, sizeof(sh)) != sizeof(sh)) {
+                close(fd);
+                return false;
+            }
+            if (_fd >= 0) {
+                close(_fd);
+            }
+            _fd = fd;
+            _seq = seq;
+            _seg_size = sizeof(sh);
+            return true;
+        }
+        /*一批记录写盘失败：截掉这一批已经写入的部分，整批重试时不会重复；截不掉的段不能继续追加，
+         *关闭后下一批写到新段，残缺的尾部在启动扫描时被跳过*/
+        void discard() {
+            if (ftruncate(_fd, _seg_size) == 0) {
+                return;
+            }
+            ELOG("截断棋谱段 %06u 失败: %s，之后写入新段", (uint32_t)_seq, strerror(errno));
+            close(_fd);
+            _fd = -1;
+        }
+        /*把一批记录追加到当前段，写满则先切换段；一批记录不跨段*/
+        bool append(std::vector<std::string> &batch) {
+            size_t total = 0;
+            for (auto &p : batch) {
+                total += p.size();
+            }
+            if (_fd < 0 || (_seg_size > sizeof(record_segment_header) && _seg_size + total > _segment_bytes)) {
+                if (open_segment(_seq + 1) == false) {
+                    return false;
+                }
+            }
+            std::string buf;
+            buf.reserve(total);
+            for (auto &p : batch) {
+                buf += p;
+            }
+            size_t done = 0;
+            while (done < buf.size()) {
+                ssize_t n = write(_fd, buf.data() + done, buf.size() - done);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    ELOG("写入棋谱段失败: %s", strerror(errno));
+                    discard();
+                    return false;
+                }
+                done += n;
+            }
+            if (fdatasync(_fd) != 0) {
+                ELOG("棋谱段同步失败: %s", strerror(errno));
+                discard();
+                return false;
+            }
+            std::unique_lock<std::mutex> lock(_index_mutex);
+            uint64_t off = _seg_size;
+            for (auto &p : batch) {
+                record_header hdr;
+                memcpy(&hdr, p.data(), sizeof(hdr));
+                index(_seq, off, hdr);
+                off += p.size();
+            }
+            _seg_size = off;
+            return true;
+        }
+        void worker_entry() {
+            std::vector<std::string> batch;
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true) {
+                _cond.wait(lock, [this]() { return _stop || !_pending.empty(); });
+                if (_pending.empty()) {
+                    break;//已经停止且没有待写的记录
+                }
+                batch.swap(_pending);
+                lock.unlock();
+                bool ret = append(batch);
+                lock.lock();
+                if (ret == false) {
+                    //写盘失败，整批放回队首，稍后重试，停止时不再等待
+                    _failures++;
+                    _pending.insert(_pending.begin(), std::make_move_iterator(batch.begin()),
+                                    std::make_move_iterator(batch.end()));
+                    batch.clear();
+                    if (_stop) {
+                        ELOG("对局记录模块停止，%lu局对局记录没有写盘", _pending.size());
+                        break;
+                    }
+                    ELOG("对局记录写入失败，%lu局对局记录等待重试", _pending.size());
+                    _cond.wait_for(lock, std::chrono::milliseconds(RECORD_RETRY_MS));
+                    continue;
+                }
+                _written += batch.size();
+                _batches++;
+                for (auto &p : batch) {
+                    _bytes += p.size();
+                }
+                batch.clear();
+            }
+        }
+        int reader(uint32_t seq) {
+            auto it = _readers.find(seq);
+            if (it != _readers.end()) {
+                return it->second;
+            }
+            int fd = open(record_util::segment_path(_dir, seq).c_str(), O_RDONLY);
+            if (fd >= 0) {
+                _readers[seq] = fd;
+            }
+            return fd;
+        }
+    public:
+        /*扫描已有的段重建索引，之后的记录写入新的段（最后一个段的残缺尾部不再追加）*/
+        record_store(const std::string &dir = RECORD_DIR, size_t segment_bytes = RECORD_SEGMENT_BYTES):
+            _dir(dir), _segment_bytes(segment_bytes), _next_id(1), _stop(false), _fd(-1), _seq(0), _seg_size(0),
+            _written(0), _bytes(0), _batches(0), _failures(0) {
+            mkdir(_dir.c_str(), 0755);
+            std::vector<uint32_t> seqs;
+            record_util::list_segments(_dir, seqs);
+            uint64_t max_id = 0, start = time_util::now_us();
+            for (uint32_t seq : seqs) {
+                scan(seq, max_id);
+                _seq = seq;
+            }
+            _next_id = max_id + 1;
+            ILOG("对局记录模块初始化完毕: %lu个段 %lu局对局 用时%lums", seqs.size(), _games.size(),
+                 (time_util::now_us() - start) / 1000);
+            _worker = std::thread(&record_store::worker_entry, this);
+        }
+        ~record_store() {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+                _cond.notify_all();
+            }
+            _worker.join();
+            if (_fd >= 0) {
+                close(_fd);
+            }
+            for (auto &it : _readers) {
+                close(it.second);
+            }
+        }
+        /*提交一局对局记录，不等待写盘，返回分配的对局ID*/
+        uint64_t push(record_header hdr, const std::vector<uint8_t> &moves) {
+            hdr.id = _next_id++;
+            std::string data;
+            record_util::encode(hdr, moves, data);
+            std::unique_lock<std::mutex> lock(_mutex);
+            _pending.push_back(std::move(data));
+            _cond.notify_one();
+            return hdr.id;
+        }
+        /*按对局ID读取原始记录（已经写盘的），不存在返回false*/
+        bool read(uint64_t id, std::string &rec) {
+            std::unique_lock<std::mutex> lock(_index_mutex);
+            auto it = _games.find(id);
+            if (it == _games.end()) {
+                return false;
+            }
+            location loc = it->second;
+            int fd = reader(loc.seq);
+            lock.unlock();
+            if (fd < 0) {
+                return false;
+            }
+            rec.resize(loc.size);
+            if (pread(fd, &rec[0], loc.size, loc.offset) != (ssize_t)loc.size) {
+                return false;
+            }
+            record_header hdr;
+            return record_util::parse(rec.data(), rec.size(), hdr) && hdr.id == id;
+        }
+        /*用户最近的对局ID，新的在前*/
+        void games_of(uint64_t uid, std::vector<uint64_t> &ids, size_t limit = RECORD_USER_GAMES) {
+            std::unique_lock<std::mutex> lock(_index_mutex);
+            auto it = _users.find(uid);
+            if (it == _users.end()) {
+                return;
+            }
+            const std::vector<uint64_t> &all = it->second;
+            for (size_t i = all.size(); i > 0 && ids.size() < limit; i--) {
+                ids.push_back(all[i - 1]);
+            }
+        }
+        const std::string &dir() { return _dir; }
+        void stats(Json::Value &val) {
+            val["written"] = (Json::UInt64)_written;
+            val["bytes"] = (Json::UInt64)_bytes;
+            val["batches"] = (Json::UInt64)_batches;
+            val["failures"] = (Json::UInt64)_failures;
+            {
+                std::unique_lock<std::mutex> lock(_index_mutex);
+                val["games"] = (Json::UInt64)_games.size();
+            }
+            val["segment"] = (uint32_t)_seq;
+            std::unique_lock<std::mutex> lock(_mutex);
+            val["pending"] = (Json::UInt64)_pending.size();
+        }
+};
+#endif
@@ -4,65 +4,111 @@
 #include "logger.hpp"
 #include "online.hpp"
 #include "db.hpp"
-#define BOARD_ROW 15
-#define BOARD_COL 15
-#define CHESS_WHITE 1
-#define CHESS_BLACK 2
+#include "settle.hpp"
+#include "board.hpp"
+#include "proto.hpp"
+#include "ai_pool.hpp"
+#include "rules.hpp"
+#include "watch.hpp"
+#include "record.hpp"
+#define ROOM_RENJU false           //是否对先手（白棋）启用禁手规则
+#define ROOM_FRAME_INTERVAL_MS 100 //每个玩家平均每100ms最多处理一帧房间消息
+#define ROOM_FRAME_BURST 10        //允许连续突发的帧数
+#define ROOM_MAX_FRAME 4096        //房间消息的最大长度，超过的在解析之前丢弃
+#define ROOM_RECONNECT_MS 20000    //对局中断线后保留座位的时间，超时才判负（不超过SESSION_TIMEOUT，重连时会话仍然有效）
 typedef enum { GAME_START, GAME_OVER }room_statu;//房间状态,enum可以用来表示一组相关的常量，roome_statu是一个枚举类型，表示房间的状态
-class room {
+class room;
+using room_ptr = std::shared_ptr<room>;//定义一个智能指针，指向一个房间对象，room_ptr是一个智能指针类型，用于管理房间对象的生命周期
+class room : public std::enable_shared_from_this<room> {
     private:
         uint64_t _room_id;
         room_statu _statu;
         int _player_count;
         uint64_t _white_id;
         uint64_t _black_id;
-        user_table *_tb_user;
+        settle_queue *_settle;
         online_manager *_online_user;
-        std::vector<std::vector<int>> _board;
+        ai_pool *_ai;
+        record_store *_records;//对局结束时写入棋谱，为空则不记录
+        uint32_t _start;//开局时间（unix秒）
+        board _board;//位棋盘，直接内嵌在房间对象中
+        int _turn;//轮到哪种颜色走棋，白棋先行
+        int _move_no;//已经走了多少手
+        bool _renju;
+        rate_limiter _limit[2];//每个玩家（连接）一个限流器，0白 1黑
+        std::vector<uint8_t> _moves;//按顺序记录的着法 row*BOARD_COL+col，白棋先行，颜色由奇偶决定
+        uint64_t _winner;
+        watch_group _watchers;
+        std::function<void(int, const std::function<void()> &)> _timer;//有慢观战者时定期补发快照，为空则只在下一步棋时补发
+        std::atomic<bool> _resync_armed;
+        bool _away[2];//断线、等待重连中，0白 1黑
+        uint64_t _away_gen[2];//每次断线/重连+1，过期定时器据此判断自己是否已经失效
+        std::mutex _mutex;//房间内请求可能来自不同的事件循环线程，串行处理房间内的动作
     private:
-        bool five(int row, int col, int row_off, int col_off, int color) {
-            //row和col是下棋位置，  row_off和col_off是偏移量，也是方向
-            int count = 1;
-            int search_row = row + row_off;
-            int search_col = col + col_off;
-            while(search_row >= 0 && search_row < BOARD_ROW &&
-                  search_col >= 0 && search_col < BOARD_COL &&
-                  _board[search_row][search_col] == color) {
-                //同色棋子数量++
-                count++;
-                //检索位置继续向后偏移
-                search_row += row_off;
-                search_col += col_off;
-            }
-            search_row = row - row_off;
-            search_col = col - col_off;
-            while(search_row >= 0 && search_row < BOARD_ROW &&
-                  search_col >= 0 && search_col < BOARD_COL &&
-                  _board[search_row][search_col] == color) {
-                //同色棋子数量++
-                count++;
-                //检索位置继续向后偏移
-                search_row -= row_off;
-                search_col -= col_off;
-            }
-            return (count >= 5);
+        //人机对战房间中AI一方始终在线，对局结果不计入天梯
+        bool vs_ai() { return _white_id == AI_UID || _black_id == AI_UID; }
+        //断线等待重连的玩家仍然算在线，宽限期结束由定时器判负
+        bool is_online(uint64_t uid) {
+            return uid == AI_UID || _online_user->is_in_game_room(uid) || _away[uid == _white_id ? 0 : 1];
         }
         uint64_t check_win(int row, int col, int color) {
             // 从下棋位置的四个不同方向上检测是否出现了5个及以上相同颜色的棋子（横行，纵列，正斜，反斜）
-            if (five(row, col, 0, 1, color) || 
-                five(row, col, 1, 0, color) ||
-                five(row, col, -1, 1, color)||
-                five(row, col, -1, -1, color)) {
+            if (_board.five(row, col, color)) {
                 //任意一个方向上出现了true也就是五星连珠，则设置返回值
                 return color == CHESS_WHITE ? _white_id : _black_id;//返回胜利者的ID，CHESS_WHITE表示白棋，CHESS_BLACK表示黑棋
             }
             return 0;
         }
+        int color_of(uint64_t uid) {
+            if (uid == _white_id) return CHESS_WHITE;
+            if (uid == _black_id) return CHESS_BLACK;
+            return 0;
+        }
+        /*被拒绝的走棋只回复给走棋的玩家，不广播*/
+        void reject(const move_result &mr) {
+            wsserver_t::connection_ptr conn = _online_user->get_conn_from_room(mr.uid);
+            if (conn.get() != nullptr) {
+                send_reject(conn, mr);
+            }
+        }
+        void reject_move(uint64_t uid, move_status status) {
+            move_result mr;
+            mr.status = status;
+            mr.uid = uid;
+            mr.row = mr.col = -1;
+            mr.color = 0;
+            mr.move_no = 0;
+            mr.winner = 0;
+            reject(mr);
+        }
+        /*观战快照（调用者持有房间锁）：双方、状态和完整的着法序列，之后的增量按move_no去重*/
+        void snapshot_locked(std::string &body) {
+            Json::Value snap;
+            snap["optype"] = "watch_snapshot";
+            snap["result"] = true;
+            snap["room_id"] = (Json::UInt64)_room_id;
+            snap["white_id"] = (Json::UInt64)_white_id;
+            snap["black_id"] = (Json::UInt64)_black_id;
+            snap["over"] = _statu == GAME_OVER;
+            snap["winner"] = (Json::UInt64)_winner;
+            snap["move_no"] = _move_no;
+            Json::Value &moves = snap["moves"];
+            moves = Json::Value(Json::arrayValue);
+            for (uint8_t m : _moves) {
+                moves.append(m);
+            }
+            json_util::serialize(snap, body);
+        }
     public:
-        room(uint64_t room_id, user_table *tb_user, online_manager *online_user):
+        room(uint64_t room_id, settle_queue *settle, online_manager *online_user, ai_pool *ai,
+             record_store *records = nullptr):
             _room_id(room_id), _statu(GAME_START), _player_count(0),
-            _tb_user(tb_user), _online_user(online_user),
-            _board(BOARD_ROW, std::vector<int>(BOARD_COL, 0)){
+            _settle(settle), _online_user(online_user), _ai(ai), _records(records), _start((uint32_t)time(nullptr)),
+            _turn(CHESS_WHITE), _move_no(0), _renju(ROOM_RENJU),
+            _limit{{ROOM_FRAME_INTERVAL_MS * 1000, ROOM_FRAME_BURST}, {ROOM_FRAME_INTERVAL_MS * 1000, ROOM_FRAME_BURST}},
+            _winner(0), _watchers(room_id), _resync_armed(false) {
+            _away[0] = _away[1] = false;
+            _away_gen[0] = _away_gen[1] = 0;
             DLOG("%lu 房间创建成功!!", _room_id);
         }
         ~room() {
@@ -70,52 +116,155 @@ class room {
         }
         uint64_t id() { return _room_id; }//获取房间ID ,函数名id()是一个成员函数，返回值是一个无符号整数类型
         room_statu statu() { return _statu; }
-        int player_count() { return _player_count; }
+        int player_count() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _player_count;
+        }
         void add_white_user(uint64_t uid) { _white_id = uid; _player_count++; }
         void add_black_user(uint64_t uid) { _black_id = uid; _player_count++; }
+        /*AI执黑，不占用房间玩家数量，真人玩家退出后房间即可销毁*/
+        void add_ai_user() { _black_id = AI_UID; }
         uint64_t get_white_user() { return _white_id; }
         uint64_t get_black_user() { return _black_id; }
+        void set_renju(bool renju) { _renju = renju; }
+        void set_timer(const std::function<void(int, const std::function<void()> &)> &timer) { _timer = timer; }
+        /*房间消息限流：在解码/解析之前调用，返回false的帧直接丢弃，不做任何响应*/
+        bool admit(uint64_t uid) {
+            int color = color_of(uid);
+            if (color == 0) {
+                return false;
+            }
+            return _limit[color == CHESS_WHITE ? 0 : 1].allow(time_util::now_us());
+        }
+        /*回复一个被拒绝的走棋：二进制连接直接编码状态码，JSON连接使用预先序列化好的响应*/
+        static void send_reject(const wsserver_t::connection_ptr &conn, const move_result &mr) {
+            if (conn->get_subprotocol() == GOBANG_BIN_PROTO) {
+                std::string frame;
+                proto_util::encode_move_result(mr, frame);
+                conn->send(frame, websocketpp::frame::opcode::binary);
+            }else {
+                conn->send(proto_util::reject_json(mr.status), websocketpp::frame::opcode::text);
+            }
+        }
 
-        /*处理下棋动作*/
-        Json::Value handle_chess(Json::Value &req) {
-            Json::Value json_resp = req;//响应信息,json_resp是一个Json::Value类型的对象，用于存储响应信息
+        /*处理下棋动作，结果写入mr，由调用者负责结算和广播
+         *状态机：对局进行中 -> 对局者 -> 坐标合法 -> 双方在线 -> 轮到该颜色 -> 位置为空 -> 不是禁手，全部是常数时间的检查*/
+        void handle_chess(uint64_t cur_uid, int chess_row, int chess_col, move_result &mr) {
+            mr.uid = cur_uid;
+            mr.row = chess_row;
+            mr.col = chess_col;
+            mr.color = 0;
+            mr.move_no = 0;
+            mr.winner = 0;
+            // 1. 校验对局状态、玩家身份和坐标，坐标合法之前不访问棋盘
+            if (_statu != GAME_START) {
+                mr.status = MOVE_GAME_OVER;
+                return;
+            }
+            int cur_color = color_of(cur_uid);
+            if (cur_color == 0) {
+                mr.status = MOVE_NOT_PLAYER;
+                return;
+            }
+            if (board::in_range(chess_row, chess_col) == false) {
+                mr.status = MOVE_OUT_OF_RANGE;
+                return;
+            }
             // 2. 判断房间中两个玩家是否都在线，任意一个不在线，就是另一方胜利。
-            int chess_row = req["row"].asInt();//获取当前下棋的行数，req["row"].asInt()表示获取row的值，asInt()表示将值转换为整数类型,req["row"]是一个Json::Value类型的对象
-            int chess_col = req["col"].asInt();
-            uint64_t cur_uid = req["uid"].asUInt64();//获取当前下棋的用户ID，req["uid"].asUInt64()表示获取uid的值,uinit64_t是一个无符号整数类型
-            if (_online_user->is_in_game_room(_white_id) == false) {
-                json_resp["result"] = true;
-                json_resp["reason"] = "运气真好！对方掉线，不战而胜！";
-                json_resp["winner"] = (Json::UInt64)_black_id;
-                return json_resp;//返回响应信息,返回值是一个Json::Value类型的对象
-            }
-            if (_online_user->is_in_game_room(_black_id) == false) {
-                json_resp["result"] = true;
-                json_resp["reason"] = "运气真好！对方掉线，不战而胜！";
-                json_resp["winner"] = (Json::UInt64)_white_id;
-                return json_resp;
+            if (is_online(_white_id) == false) {
+                mr.status = MOVE_OFFLINE_WIN;
+                mr.winner = _black_id;
+                return;
             }
-            // 3. 获取走棋位置，判断当前走棋是否合理（位置是否已经被占用）
-            if (_board[chess_row][chess_col] != 0) {
-                json_resp["result"] = false;
-                json_resp["reason"] = "当前位置已经有了其他棋子！";
-                return json_resp;
+            if (is_online(_black_id) == false) {
+                mr.status = MOVE_OFFLINE_WIN;
+                mr.winner = _white_id;
+                return;
             }
-            int cur_color = cur_uid == _white_id ? CHESS_WHITE : CHESS_BLACK;
-            printf("颜色判断: cur_uid=%lu, _white_id=%lu, _black_id=%lu, cur_color=%d\n", cur_uid, _white_id, _black_id, cur_color);
-            fflush(stdout);
-            _board[chess_row][chess_col] = cur_color;
-            // 4. 判断是否有玩家胜利（从当前走棋位置开始判断是否存在五星连珠）
-            uint64_t winner_id = check_win(chess_row, chess_col, cur_color);
-            if (winner_id != 0) {
-                json_resp["reason"] = "五星连珠，战无敌！";
+            // 3. 判断是否轮到该玩家，走棋位置是否已经被占用
+            if (cur_color != _turn) {
+                mr.status = MOVE_NOT_YOUR_TURN;
+                return;
             }
-            json_resp["result"] = true;
-            json_resp["winner"] = (Json::UInt64)winner_id;
-            json_resp["chess_color"] = cur_color;  // 添加棋子颜色信息
-            json_resp["white_id"] = (Json::UInt64)_white_id;  // 添加白棋玩家ID
-            json_resp["black_id"] = (Json::UInt64)_black_id;  // 添加黑棋玩家ID
-            return json_resp;
+            if (_board.empty(chess_row, chess_col) == false) {
+                mr.status = MOVE_OCCUPIED;
+                return;
+            }
+            _board.put(chess_row, chess_col, cur_color);
+            // 4. 禁手只约束先手一方，是禁手则撤回这一子
+            if (_renju && cur_color == CHESS_WHITE && renju::forbidden(_board, chess_row, chess_col, cur_color)) {
+                _board.take(chess_row, chess_col);
+                mr.status = MOVE_FORBIDDEN;
+                return;
+            }
+            _move_no++;
+            _moves.push_back((uint8_t)(chess_row * BOARD_COL + chess_col));
+            _turn = cur_color == CHESS_WHITE ? CHESS_BLACK : CHESS_WHITE;
+            mr.color = cur_color;
+            mr.move_no = _move_no;
+            // 5. 判断是否有玩家胜利（从当前走棋位置开始判断是否存在五星连珠），棋盘下满则和棋
+            mr.winner = check_win(chess_row, chess_col, cur_color);
+            if (mr.winner != 0) {
+                mr.status = MOVE_WIN;
+            }else {
+                mr.status = _board.full() ? MOVE_DRAW : MOVE_OK;
+            }
+        }
+        /*对局结束：把着法序列交给对局记录存储（只入队，不写盘），调用者持有房间锁*/
+        void record(const move_result &mr) {
+            if (_records == nullptr) {
+                return;
+            }
+            record_header hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.result = mr.winner == 0 ? 0 : (mr.winner == _white_id ? CHESS_WHITE : CHESS_BLACK);
+            hdr.reason = (uint8_t)mr.status;
+            hdr.white = _white_id;
+            hdr.black = _black_id;
+            hdr.start = _start;
+            hdr.seconds = (uint16_t)std::min<uint32_t>((uint32_t)time(nullptr) - _start, UINT16_MAX);
+            hdr.flags = (_renju ? RECORD_RENJU : 0) | (vs_ai() ? RECORD_VS_AI : 0);
+            uint64_t game_id = _records->push(hdr, _moves);
+            DLOG("房间:%lu 对局结束，棋谱ID:%lu %lu手", _room_id, game_id, _moves.size());
+        }
+        /*走棋：处理、结算并广播结果，调用者持有房间锁*/
+        void play(uint64_t uid, int row, int col) {
+            move_result mr;
+            handle_chess(uid, row, col, mr);
+            if (proto_util::success(mr.status) == false) {
+                DLOG("房间:%lu 拒绝走棋 用户:%lu (%d,%d) 状态:%d", _room_id, uid, row, col, (int)mr.status);
+                return reject(mr);
+            }
+            if (mr.status == MOVE_DRAW) {
+                _statu = GAME_OVER;
+            }
+            if (mr.winner != 0) {
+                _winner = mr.winner;//如果赢家不为0，说明游戏结束了,有人胜利
+                uint64_t loser_id = mr.winner == _white_id ? _black_id : _white_id;
+                if (vs_ai() == false) {
+                    _settle->push(mr.winner, loser_id);//异步结算，不阻塞广播
+                }
+                _statu = GAME_OVER;
+            }
+            if (_statu == GAME_OVER) {
+                record(mr);
+            }
+            broadcast_move(mr);
+            //人机对战：玩家走棋成功后由AI应着
+            if (mr.status == MOVE_OK && uid != AI_UID && vs_ai()) {
+                ai_play();
+            }
+        }
+        /*把当前棋盘交给AI线程池思考，不阻塞事件循环；房间已经销毁时结果被丢弃*/
+        void ai_play() {
+            int color = _white_id == AI_UID ? CHESS_WHITE : CHESS_BLACK;
+            std::weak_ptr<room> wp = shared_from_this();
+            _ai->submit(_room_id, _board, color, AI_TIME_MS, [wp](int row, int col) {
+                room_ptr rp = wp.lock();
+                if (rp.get() != nullptr) {
+                    rp->handle_ai_move(row, col);
+                }
+            });
         }
         /*处理聊天动作*/
         Json::Value handle_chat(Json::Value &req) {
@@ -135,48 +284,61 @@ class room {
         /*处理玩家退出房间动作*/
         void handle_exit(uint64_t uid) {//传入参数uid是一个无符号整数类型，表示用户ID
             //如果是下棋中退出，则对方胜利，否则下棋结束了退出，则是正常退出
-            Json::Value json_resp;
+            std::unique_lock<std::mutex> lock(_mutex);
+            //房间中玩家数量--
+            _player_count--;
             if (_statu == GAME_START) {
-                uint64_t winner_id = (Json::UInt64)(uid == _white_id ? _black_id : _white_id);
-                json_resp["optype"] = "put_chess";
-                json_resp["result"] = true;
-                json_resp["reason"] = "对方掉线，不战而胜！";
-                json_resp["room_id"] = (Json::UInt64)_room_id;
-                json_resp["uid"] = (Json::UInt64)uid;
-                json_resp["row"] = -1;
-                json_resp["col"] = -1;
-                json_resp["winner"] = (Json::UInt64)winner_id;
-                uint64_t loser_id = winner_id == _white_id ? _black_id : _white_id;
-                _tb_user->win(winner_id);
-                _tb_user->lose(loser_id);
+                move_result mr;
+                mr.status = MOVE_EXIT_WIN;
+                mr.uid = uid;
+                mr.row = -1;
+                mr.col = -1;
+                mr.color = 0;
+                mr.move_no = 0;
+                mr.winner = uid == _white_id ? _black_id : _white_id;
+                _winner = mr.winner;
+                uint64_t loser_id = mr.winner == _white_id ? _black_id : _white_id;
+                if (vs_ai() == false) {
+                    _settle->push(mr.winner, loser_id);//异步结算，不阻塞广播
+                }
                 _statu = GAME_OVER;
-                broadcast(json_resp);//广播消息,broadcast函数是一个成员函数，用于将消息广播给房间中的所有用户
+                record(mr);
+                broadcast_move(mr);
             }
-            //房间中玩家数量--
-            _player_count--;
-            return;
+            lock.unlock();
+            flush_watchers();
         }
         /*总的请求处理函数，在函数内部，区分请求类型，根据不同的请求调用不同的处理函数，得到响应进行广播*/
         void handle_request(Json::Value &req) {//req是一个Json::Value类型的对象，用于存储请求信息,传入
-            //1. 校验房间号是否匹配
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                dispatch(req);
+            }
+            flush_watchers();
+        }
+        void dispatch(Json::Value &req) {
+            //1. 校验请求格式和房间号，格式错误的帧不做任何响应
+            if (req["optype"].isString() == false) {
+                DLOG("房间:%lu 请求类型格式错误", _room_id);
+                return;
+            }
             Json::Value json_resp;
-            uint64_t room_id = req["room_id"].asUInt64();
-            if (room_id != _room_id) {
+            bool is_move = req["optype"].asString() == "put_chess";
+            if (req["room_id"].isUInt64() == false || req["room_id"].asUInt64() != _room_id) {
+                if (is_move) {
+                    return reject_move(req["uid"].asUInt64(), MOVE_ROOM_MISMATCH);
+                }
                 json_resp["optype"] = req["optype"].asString();
                 json_resp["result"] = false;
                 json_resp["reason"] = "房间号不匹配！";
                 return broadcast(json_resp);
             }
             //2. 根据不同的请求类型调用不同的处理函数
-            if (req["optype"].asString() == "put_chess") {
-                json_resp = handle_chess(req);//处理下棋动作，json_resp是一个Json::Value类型的对象，用于存储响应信息
-                if (json_resp["winner"].asUInt64() != 0) {//如果赢家不为0，说明游戏结束了,有人胜利
-                    uint64_t winner_id = json_resp["winner"].asUInt64();//asUInt64()表示将值转换为无符号整数类型,json_resp["winner"]是一个Json::Value类型的对象
-                    uint64_t loser_id = winner_id == _white_id ? _black_id : _white_id;
-                    _tb_user->win(winner_id);
-                    _tb_user->lose(loser_id);
-                    _statu = GAME_OVER;
+            if (is_move) {
+                if (req["row"].isInt() == false || req["col"].isInt() == false) {
+                    return reject_move(req["uid"].asUInt64(), MOVE_BAD_FRAME);
                 }
+                return play(req["uid"].asUInt64(), req["row"].asInt(), req["col"].asInt());
             }else if (req["optype"].asString() == "chat") {
                 json_resp = handle_chat(req);
             }else {
@@ -184,52 +346,231 @@ class room {
                 json_resp["result"] = false;
                 json_resp["reason"] = "未知请求类型";
             }
-            std::string body;
-            json_util::serialize(json_resp, body);
-            DLOG("房间-广播动作: %s", body.c_str());
             return broadcast(json_resp);//广播消息,broadcast函数是一个成员函数，用于将消息广播给房间中的所有用户
         }
-        /*将指定的信息广播给房间中所有玩家*/
-        void broadcast(Json::Value &rsp) {
-            //1. 对要响应的信息进行序列化，将Json::Value中的数据序列化成为json格式字符串
+        /*二进制子协议的走棋请求，uid由服务器根据会话填写*/
+        void handle_move(uint64_t uid, int row, int col) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                play(uid, row, col);
+            }
+            flush_watchers();
+        }
+        /*AI线程池的思考结果，在事件循环线程中执行*/
+        void handle_ai_move(int row, int col) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_statu != GAME_START) {
+                    return;//思考期间对局已经结束（玩家退出）
+                }
+                play(AI_UID, row, col);
+            }
+            flush_watchers();
+        }
+        /*观战：在房间锁内先发送快照再加入观战者集合，之后的每一步都会推送给它，观战人数已满返回false*/
+        bool watch(const wsserver_t::connection_ptr &conn) {
+            std::unique_lock<std::mutex> lock(_mutex);
             std::string body;
-            json_util::serialize(rsp, body);
-            //2. 获取房间中所有用户的通信连接
-            //3. 发送响应信息
+            snapshot_locked(body);
+            conn->send(body, websocketpp::frame::opcode::text);
+            return _watchers.add(conn);
+        }
+        void unwatch(const wsserver_t::connection_ptr &conn) { _watchers.remove(conn); }
+        size_t watcher_count() { return _watchers.size(); }
+        void snapshot(std::string &body) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            snapshot_locked(body);
+        }
+        /*玩家的房间连接断开：对局进行中则保留座位并通知对方，返回本次断线的编号（用于宽限期定时器），
+         *对局已经结束（或者不是对局者）返回0，调用者直接让玩家退出房间*/
+        uint64_t leave(uint64_t uid) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            int color = color_of(uid);
+            if (_statu != GAME_START || color == 0) {
+                return 0;
+            }
+            int i = color == CHESS_WHITE ? 0 : 1;
+            _away[i] = true;
+            uint64_t gen = ++_away_gen[i];
+            Json::Value notice;
+            notice["optype"] = "peer_away";
+            notice["result"] = true;
+            notice["uid"] = (Json::UInt64)uid;
+            notice["timeout_ms"] = ROOM_RECONNECT_MS;
+            broadcast(notice);
+            return gen;
+        }
+        /*宽限期定时器到期：玩家仍然处于同一次断线中返回true*/
+        bool away_expired(uint64_t uid, uint64_t gen) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            int color = color_of(uid);
+            if (color == 0) {
+                return false;
+            }
+            int i = color == CHESS_WHITE ? 0 : 1;
+            return _away[i] && _away_gen[i] == gen;
+        }
+        /*玩家是否处于断线重连的宽限期：对局还在进行并且座位还为他保留着*/
+        bool awaiting(uint64_t uid) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            int color = color_of(uid);
+            if (_statu != GAME_START || color == 0) {
+                return false;
+            }
+            return _away[color == CHESS_WHITE ? 0 : 1];
+        }
+        /*玩家（重新）连接到房间：填写room_ready响应，包括到目前为止的着法序列，客户端据此重画棋盘；
+         *如果是断线重连，取消宽限期（定时器到期时发现编号变化直接忽略）并通知对方，返回true*/
+        bool enter(uint64_t uid, Json::Value &resp) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            resp["optype"] = "room_ready";
+            resp["result"] = true;
+            resp["room_id"] = (Json::UInt64)_room_id;
+            resp["uid"] = (Json::UInt64)uid;
+            resp["white_id"] = (Json::UInt64)_white_id;
+            resp["black_id"] = (Json::UInt64)_black_id;
+            resp["move_no"] = _move_no;
+            resp["over"] = _statu == GAME_OVER;
+            Json::Value &moves = resp["moves"];
+            moves = Json::Value(Json::arrayValue);
+            for (uint8_t m : _moves) {
+                moves.append(m);
+            }
+            int color = color_of(uid);
+            bool resumed = false;
+            if (color != 0) {
+                int i = color == CHESS_WHITE ? 0 : 1;
+                resumed = _away[i];
+                _away[i] = false;
+                _away_gen[i]++;
+            }
+            resp["resumed"] = resumed;
+            if (resumed) {
+                Json::Value notice;
+                notice["optype"] = "peer_back";
+                notice["result"] = true;
+                notice["uid"] = (Json::UInt64)uid;
+                broadcast(notice);//此时重连的玩家已经在线，也会收到，客户端忽略自己的
+            }
+            return resumed;
+        }
+        /*在房间锁外把本次处理产生的走棋结果扇出给观战者，有积压的观战者时启动补发检查*/
+        void flush_watchers() {
+            _watchers.flush([this](std::string &body) { snapshot(body); });
+            if (_watchers.stale() != 0) {
+                arm_resync();
+            }
+        }
+        /*WATCH_RESYNC_MS之后检查积压的观战者，同一时刻最多一个检查定时器；房间销毁后定时器什么都不做*/
+        void arm_resync() {
+            if (!_timer || _resync_armed.exchange(true)) {
+                return;
+            }
+            std::weak_ptr<room> wp = shared_from_this();
+            _timer(WATCH_RESYNC_MS, [wp]() {
+                room_ptr rp = wp.lock();
+                if (rp.get() != nullptr) {
+                    rp->resync_watchers();
+                }
+            });
+        }
+        /*缓冲已经排空的观战者补发快照，仍有积压的继续等下一次检查*/
+        void resync_watchers() {
+            _resync_armed = false;
+            if (_watchers.resync([this](std::string &body) { snapshot(body); }) != 0) {
+                arm_resync();
+            }
+        }
+        /*获取房间中所有在线玩家的通信连接*/
+        void get_conns(std::vector<wsserver_t::connection_ptr> &conns) {
             wsserver_t::connection_ptr wconn = _online_user->get_conn_from_room(_white_id);//获取白棋玩家的连接
-            //wsserver_t::connection_ptr是一个智能指针，指向一个连接对象
             if (wconn.get() != nullptr) {
-                wconn->send(body);
+                conns.push_back(wconn);
             }else {
                 DLOG("房间-白棋玩家连接获取失败");
             }
             wsserver_t::connection_ptr bconn = _online_user->get_conn_from_room(_black_id);
             if (bconn.get() != nullptr) {
-                bconn->send(body);
+                conns.push_back(bconn);
             }else {
                 DLOG("房间-黑棋玩家连接获取失败");
             }
+        }
+        /*将指定的信息广播给房间中所有玩家：只序列化一次、组帧一次，所有连接共享同一份消息*/
+        void broadcast(Json::Value &rsp) {
+            //1. 对要响应的信息进行序列化，将Json::Value中的数据序列化成为json格式字符串
+            std::string body;
+            json_util::serialize(rsp, body);
+            DLOG("房间-广播动作: %s", body.c_str());
+            //2. 获取房间中所有用户的通信连接
+            std::vector<wsserver_t::connection_ptr> conns;
+            get_conns(conns);
+            //3. 发送响应信息
+            ws_util::send_all(conns, websocketpp::frame::opcode::text, body);
             return;
         }
+        /*广播走棋结果：按每个连接协商的子协议分组，每种编码最多生成一次*/
+        void broadcast_move(const move_result &mr) {
+            std::vector<wsserver_t::connection_ptr> conns, bin_conns, json_conns;
+            get_conns(conns);
+            for (auto &conn : conns) {
+                if (conn->get_subprotocol() == GOBANG_BIN_PROTO) {
+                    bin_conns.push_back(conn);
+                }else {
+                    json_conns.push_back(conn);
+                }
+            }
+            if (!bin_conns.empty()) {
+                std::string frame;
+                proto_util::encode_move_result(mr, frame);
+                ws_util::send_all(bin_conns, websocketpp::frame::opcode::binary, frame);
+            }
+            if (!json_conns.empty()) {
+                Json::Value rsp;
+                proto_util::move_result_json(mr, _room_id, rsp);
+                std::string body;
+                json_util::serialize(rsp, body);
+                DLOG("房间-广播动作: %s", body.c_str());
+                ws_util::send_all(json_conns, websocketpp::frame::opcode::text, body);
+            }
+            _watchers.push(mr);//玩家先收到，观战者在释放房间锁之后扇出
+        }
 };
 
-using room_ptr = std::shared_ptr<room>;//定义一个智能指针，指向一个房间对象，room_ptr是一个智能指针类型，用于管理房间对象的生命周期
 
 class room_manager{
     private:
         uint64_t _next_rid;
         std::mutex _mutex;
-        user_table *_tb_user;
+        settle_queue *_settle;
         online_manager *_online_user;
+        ai_pool *_ai;
+        record_store *_records;
+        std::function<void(int, const std::function<void()> &)> _timer;//ms毫秒之后在事件循环中执行任务
         std::unordered_map<uint64_t, room_ptr> _rooms;
         std::unordered_map<uint64_t, uint64_t> _users;
+        std::atomic<uint64_t> _away;//断线后进入宽限期的次数
+        std::atomic<uint64_t> _resumed;//宽限期内重连成功的次数
+        std::atomic<uint64_t> _forfeited;//宽限期结束判负的次数
+    private:
+        /*宽限期定时器：玩家仍处于同一次断线中才判负退出*/
+        void reconnect_timeout(uint64_t uid, uint64_t rid, uint64_t gen) {
+            room_ptr rp = get_room_by_uid(uid);
+            if (rp.get() == nullptr || rp->id() != rid || rp->away_expired(uid, gen) == false) {
+                return;
+            }
+            ILOG("房间:%lu 用户:%lu 断线超过%dms，判负退出", rid, uid, ROOM_RECONNECT_MS);
+            _forfeited++;
+            remove_room_user(uid);
+        }
     public:
-        /*初始化房间ID计数器*/
-        room_manager(user_table *ut, online_manager *om):
-            _next_rid(1), _tb_user(ut), _online_user(om) {
-            DLOG("房间管理模块初始化完毕！");
+        /*初始化房间ID计数器，timer用于断线重连的宽限期和观战者的补发检查*/
+        room_manager(settle_queue *sq, online_manager *om, ai_pool *ai, record_store *rs,
+                     const std::function<void(int, const std::function<void()> &)> &timer):
+            _next_rid(1), _settle(sq), _online_user(om), _ai(ai), _records(rs), _timer(timer), _away(0), _resumed(0), _forfeited(0) {
+            ILOG("房间管理模块初始化完毕！");
         }
-        ~room_manager() { DLOG("房间管理模块即将销毁！"); }
+        ~room_manager() { ILOG("房间管理模块即将销毁！"); }
         //为两个用户创建房间，并返回房间的智能指针管理对象
         room_ptr create_room(uint64_t uid1, uint64_t uid2) {
             //两个用户在游戏大厅中进行对战匹配，匹配成功后创建房间
@@ -245,9 +586,14 @@ class room_manager{
             //2. 创建房间，将用户信息添加到房间中
 
             std::unique_lock<std::mutex> lock(_mutex);
-            room_ptr rp(new room(_next_rid, _tb_user, _online_user));
+            if (_users.count(uid1) != 0 || _users.count(uid2) != 0) {
+                DLOG("用户：%lu/%lu 还有未结束的对局，创建房间失败!", uid1, uid2);
+                return room_ptr();
+            }
+            room_ptr rp(new room(_next_rid, _settle, _online_user, _ai, _records));
             rp->add_white_user(uid1);
             rp->add_black_user(uid2);
+            rp->set_timer(_timer);
             //3. 将房间信息管理起来
             _rooms.insert(std::make_pair(_next_rid, rp));
             _users.insert(std::make_pair(uid1, _next_rid));
@@ -256,6 +602,26 @@ class room_manager{
             //4. 返回房间信息
             return rp;
         }
+        /*人机对战：为大厅中的用户创建一个与AI对战的房间，玩家执白先行*/
+        room_ptr create_ai_room(uint64_t uid) {
+            if (_online_user->is_in_game_hall(uid) == false) {
+                DLOG("用户：%lu 不在大厅中，创建房间失败!", uid);
+                return room_ptr();
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_users.count(uid) != 0) {
+                DLOG("用户：%lu 还有未结束的对局，创建房间失败!", uid);
+                return room_ptr();
+            }
+            room_ptr rp(new room(_next_rid, _settle, _online_user, _ai, _records));
+            rp->add_white_user(uid);
+            rp->add_ai_user();
+            rp->set_timer(_timer);
+            _rooms.insert(std::make_pair(_next_rid, rp));
+            _users.insert(std::make_pair(uid, _next_rid));
+            _next_rid++;
+            return rp;
+        }
         /*通过房间ID获取房间信息*/
         room_ptr get_room_by_rid(uint64_t rid) {
             std::unique_lock<std::mutex> lock(_mutex);
@@ -293,20 +659,80 @@ class room_manager{
             //2. 通过房间信息，获取房间中所有用户的ID
             uint64_t uid1 = rp->get_white_user();
             uint64_t uid2 = rp->get_black_user();
-            //3. 移除房间管理中的用户信息
+            //3. 移除房间管理中的用户信息（已经离开的玩家可能已经进入了新的房间，只删除还指向本房间的）
             std::unique_lock<std::mutex> lock(_mutex);
-            _users.erase(uid1);
-            _users.erase(uid2);
+            for (uint64_t uid : {uid1, uid2}) {
+                auto it = _users.find(uid);
+                if (it != _users.end() && it->second == rid) {
+                    _users.erase(it);
+                }
+            }
             //4. 移除房间管理信息
             _rooms.erase(rid);
         }
-        /*删除房间中指定用户，如果房间中没有用户了，则销毁房间，用户连接断开时被调用*/
-        void remove_room_user(uint64_t uid) {
+        /*玩家的房间连接断开：对局进行中则保留座位，ROOM_RECONNECT_MS之后仍未重连才判负退出；否则直接退出房间*/
+        void user_disconnect(uint64_t uid) {
             room_ptr rp = get_room_by_uid(uid);
             if (rp.get() == nullptr) {
                 return;
             }
-            //处理房间中玩家退出动作
+            uint64_t gen = rp->leave(uid);
+            if (gen == 0) {
+                return remove_room_user(uid);
+            }
+            _away++;
+            DLOG("房间:%lu 用户:%lu 断线，等待重连", rp->id(), uid);
+            uint64_t rid = rp->id();
+            _timer(ROOM_RECONNECT_MS, [this, uid, rid, gen]() { reconnect_timeout(uid, rid, gen); });
+        }
+        /*玩家回到大厅或者开始匹配时调用：还在断线宽限期内的对局返回房间，客户端回到房间继续；
+         *对局已经结束说明玩家已经离开了房间，让他退出房间（对方还在时房间保留），返回空*/
+        room_ptr resume_room(uint64_t uid) {
+            room_ptr rp = get_room_by_uid(uid);
+            if (rp.get() == nullptr || rp->awaiting(uid)) {
+                return rp;
+            }
+            if (rp->statu() == GAME_OVER) {
+                remove_room_user(uid);
+            }
+            return room_ptr();
+        }
+        /*玩家连接到房间（首次进入或者断线重连），填写room_ready响应*/
+        void user_enter(const room_ptr &rp, uint64_t uid, Json::Value &resp) {
+            if (rp->enter(uid, resp)) {
+                _resumed++;
+                DLOG("房间:%lu 用户:%lu 重连成功", rp->id(), uid);
+            }
+        }
+        void stats(Json::Value &val) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                val["rooms"] = (Json::UInt64)_rooms.size();
+                val["players"] = (Json::UInt64)_users.size();
+            }
+            val["away"] = (Json::UInt64)_away;
+            val["resumed"] = (Json::UInt64)_resumed;
+            val["forfeited"] = (Json::UInt64)_forfeited;
+        }
+        /*删除房间中指定用户，如果房间中没有用户了，则销毁房间，用户连接断开时被调用*/
+        void remove_room_user(uint64_t uid) {
+            //先解除玩家和房间的关联：玩家随后可以重新匹配，重复调用（断线和宽限期到期同时发生）也不会重复退出
+            room_ptr rp;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto uit = _users.find(uid);
+                if (uit == _users.end()) {
+                    return;
+                }
+                auto rit = _rooms.find(uit->second);
+                _users.erase(uit);
+                if (rit == _rooms.end()) {
+                    return;
+                }
+                rp = rit->second;
+            }
+            //处理房间中玩家退出动作，取消还在排队/思考中的AI任务
+            _ai->cancel(rp->id());
             rp->handle_exit(uid);
             //房间中没有玩家了，则销毁房间
             if (rp->player_count() == 0) {
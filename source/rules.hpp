@@ -0,0 +1,77 @@
+#ifndef __M_RULES_H__
+#define __M_RULES_H__
+#include "board.hpp"
+#include <algorithm>
+
+/*禁手规则（连珠规则的简化版本），只约束先手一方（本项目白棋先行）：
+ *  长连：形成六子及以上连珠
+ *  四四：一步棋同时在两个方向上形成"四"（再下一子即可成五）
+ *  三三：一步棋同时在两个方向上形成"活三"（再下一子即可形成两端都空的活四）
+ *恰好连成五子时不算禁手。每个方向只看经过落子点的一条线，每条线最多检查8个空位，判断是常数时间的；
+ *与完整的连珠规则相比，不区分同一条线上的两个四，也不递归检查活三的成四点本身是否是禁手*/
+class renju {
+    private:
+        //掩码m中包含第p位的连续1的区间[lo, hi]
+        static void run(uint16_t m, int p, int &lo, int &hi) {
+            lo = hi = p;
+            while (lo > 0 && ((m >> (lo - 1)) & 1)) lo--;
+            while (hi < 15 && ((m >> (hi + 1)) & 1)) hi++;
+        }
+        static bool is_empty(uint16_t empty, int p) { return p >= 0 && p < 16 && ((empty >> p) & 1); }
+        static bool is_own(uint16_t own, int p) { return p >= 0 && p < 16 && ((own >> p) & 1); }
+        /*own在第q位补一子后，包含p的连续段恰好是5个*/
+        static bool makes_five(uint16_t own, int p, int q) {
+            int lo, hi;
+            run(own | (uint16_t)(1u << q), p, lo, hi);
+            return hi - lo + 1 == 5;
+        }
+        /*own在第q位补一子后，包含p的连续段是两端都空、且再延长也不会成为长连的活四*/
+        static bool makes_open_four(uint16_t own, uint16_t empty, int p, int q) {
+            int lo, hi;
+            uint16_t m = own | (uint16_t)(1u << q);
+            run(m, p, lo, hi);
+            return hi - lo + 1 == 4 && is_empty(empty, lo - 1) && is_empty(empty, hi + 1) &&
+                   !is_own(m, lo - 2) && !is_own(m, hi + 2);
+        }
+    public:
+        /*(row,col)上刚刚落下color的一子，判断这步棋是否是禁手*/
+        static bool forbidden(const board &b, int row, int col, int color) {
+            int other = color == CHESS_WHITE ? CHESS_BLACK : CHESS_WHITE;
+            int fours = 0, threes = 0;
+            bool overline = false;
+            for (int d = 0; d < LINE_DIRS; d++) {
+                int idx = board::line_index(d, row, col), p = board::line_pos(d, row, col);
+                int lo, hi;
+                board::line_range(d, idx, lo, hi);
+                uint16_t valid = (uint16_t)(((1u << (hi + 1)) - 1) & ~((1u << lo) - 1));
+                uint16_t own = b.line_mask(color, d, idx);
+                uint16_t empty = valid & ~(own | b.line_mask(other, d, idx));
+                int rlo, rhi;
+                run(own, p, rlo, rhi);
+                if (rhi - rlo + 1 == 5) {
+                    return false;//成五优先
+                }
+                if (rhi - rlo + 1 > 5) {
+                    overline = true;
+                    continue;
+                }
+                bool four = false, three = false;
+                for (int q = std::max(lo, p - 4); q <= std::min(hi, p + 4); q++) {
+                    if (!is_empty(empty, q)) {
+                        continue;
+                    }
+                    if (makes_five(own, p, q)) {
+                        four = true;
+                        break;
+                    }
+                    if (!three && makes_open_four(own, empty, p, q)) {
+                        three = true;
+                    }
+                }
+                fours += four;
+                threes += (three && !four);
+            }
+            return overline || fours >= 2 || threes >= 2;
+        }
+};
+#endif
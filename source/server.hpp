@@ -1,25 +1,105 @@
 #ifndef __M_SRV_H__
 #define __M_SRV_H__
 #include "db.hpp"
+#include "cache.hpp"
+#include "settle.hpp"
 #include "matcher.hpp"
 #include "online.hpp"
 #include "room.hpp"
 #include "session.hpp"
+#include "asset.hpp"
 #include "util.hpp"
+#include <atomic>
+#include <thread>
 
 #define WWWROOT "./wwwroot/"
+#define CACHE_WRITE_BEHIND false //用户信息缓存是否使用write-behind模式批量写回战绩
+#define LOOP_PROBE_MS 100       //事件循环延迟探测间隔
+#define LOOP_REPORT_MS 10000    //事件循环延迟统计的输出周期
+/*单个工作线程的事件循环延迟统计，只由所属线程累加，统计输出时被读取并清零*/
+struct loop_stat {
+    std::atomic<uint64_t> samples;   //采样次数
+    std::atomic<uint64_t> total_us;  //累计延迟
+    std::atomic<uint64_t> max_us;    //最大延迟
+    loop_stat(): samples(0), total_us(0), max_us(0) {}
+};
 class gobang_server{
     private:
         std::string _web_root;//静态资源根目录 ./wwwroot/      /register.html ->  ./wwwroot/register.html
+        asset_cache _ac;//静态资源缓存
         wsserver_t _wssrv;
         user_table _ut;
+        user_cache _uc;
+        settle_queue _sq;
         online_manager _om;
+        ai_pool _ap;
+        record_store _rs;
         room_manager _rm;
         matcher _mm;
         session_manager _sm;
+        std::vector<loop_stat> _loop_stats;//每个事件循环线程一份延迟统计
+        std::atomic<uint64_t> _last_report_ms;
     private:
+        //当前线程在事件循环线程池中的编号，不属于线程池的线程为-1
+        static int &loop_index() {
+            static thread_local int idx = -1;
+            return idx;
+        }
+        //把任务交给事件循环线程执行（AI线程池回调结果）
+        void post(const std::function<void()> &task) {
+            _wssrv.get_io_service().post(task);
+        }
+        //ms毫秒之后在事件循环线程中执行任务（断线重连的宽限期）
+        void timer(int ms, const std::function<void()> &task) {
+            _wssrv.set_timer(ms, [task](const websocketpp::lib::error_code &ec) {
+                if (!ec) {
+                    task();
+                }
+            });
+        }
+        void loop_entry(int idx) {
+            loop_index() = idx;
+            //多个线程同时run同一个io_service，连接内的回调由websocketpp的strand串行化
+            //跨连接共享的数据（房间/在线用户/会话）由各模块自己的锁保护
+            _wssrv.run();
+        }
+        //定时器延迟探测：实际触发时间与预期触发时间之差，反映了事件循环中任务的排队时间
+        void loop_probe(uint64_t armed_us, const websocketpp::lib::error_code &ec) {
+            if (ec) {
+                return;
+            }
+            uint64_t now_us = time_util::now_us();
+            uint64_t expect_us = armed_us + LOOP_PROBE_MS * 1000;
+            uint64_t lag_us = now_us > expect_us ? now_us - expect_us : 0;
+            int idx = loop_index();
+            if (idx >= 0 && idx < (int)_loop_stats.size()) {
+                loop_stat &st = _loop_stats[idx];
+                st.samples++;
+                st.total_us += lag_us;
+                if (lag_us > st.max_us) {
+                    st.max_us = lag_us;
+                }
+            }
+            uint64_t last_ms = _last_report_ms;
+            if (now_us / 1000 - last_ms >= LOOP_REPORT_MS &&
+                _last_report_ms.compare_exchange_strong(last_ms, now_us / 1000)) {
+                loop_report();
+            }
+            _wssrv.set_timer(LOOP_PROBE_MS, std::bind(&gobang_server::loop_probe, this,
+                time_util::now_us(), std::placeholders::_1));
+        }
+        void loop_report() {
+            for (size_t i = 0; i < _loop_stats.size(); i++) {
+                loop_stat &st = _loop_stats[i];
+                uint64_t samples = st.samples.exchange(0);
+                uint64_t total_us = st.total_us.exchange(0);
+                uint64_t max_us = st.max_us.exchange(0);
+                ILOG("事件循环线程[%lu] 采样:%lu 平均延迟:%luus 最大延迟:%luus", i, samples,
+                    samples == 0 ? 0 : total_us / samples, max_us);
+            }
+        }
         void file_handler(wsserver_t::connection_ptr &conn) {
-            //静态资源请求的处理
+            //静态资源请求的处理：全部从内存中的静态资源缓存响应，不访问文件系统
             //1. 获取到请求uri-资源路径，了解客户端请求的页面文件名称
             websocketpp::http::parser::request req = conn->get_request();
             std::string uri = req.get_uri();
@@ -28,32 +108,25 @@ class gobang_server{
             if (query_pos != std::string::npos) {
                 uri = uri.substr(0, query_pos);
             }
-            //2. 组合出文件的实际路径   相对根目录 + uri
-            std::string realpath = _web_root + uri;
-            //3. 如果请求的是个目录，增加一个后缀  login.html,    /  ->  /login.html
-            if (realpath.back() == '/') {
-                realpath += "login.html";
+            //2. 如果请求的是个目录，增加一个后缀  login.html,    /  ->  /login.html
+            if (uri.empty() || uri.back() == '/') {
+                uri += "login.html";
             }
-            //4. 读取文件内容
-            Json::Value resp_json;
-            std::string body;
-            bool ret = file_util::read(realpath, body);
-            //  1. 文件不存在，读取文件内容失败，返回404
-            if (ret == false) {
-                body += "<html>";
-                body += "<head>";
-                body += "<meta charset='UTF-8'/>";
-                body += "</head>";
-                body += "<body>";
-                body += "<h1> Not Found </h1>";
-                body += "</body>";
-                conn->set_status(websocketpp::http::status_code::not_found);
-                conn->set_body(body);
+            //3. 从缓存中响应
+            if (_ac.serve(uri, conn)) {
                 return;
             }
-            //5. 设置响应正文
+            //  资源不存在，返回404
+            std::string body;
+            body += "<html>";
+            body += "<head>";
+            body += "<meta charset='UTF-8'/>";
+            body += "</head>";
+            body += "<body>";
+            body += "<h1> Not Found </h1>";
+            body += "</body>";
+            conn->set_status(websocketpp::http::status_code::not_found);
             conn->set_body(body);
-            conn->set_status(websocketpp::http::status_code::ok);
         }
         void http_resp(wsserver_t::connection_ptr &conn, bool result, 
             websocketpp::http::status_code::value code, const std::string &reason) {
@@ -71,7 +144,7 @@ class gobang_server{
             //用户注册功能请求的处理
             websocketpp::http::parser::request req = conn->get_request();
             //1. 获取到请求正文
-            std::string req_body = conn->get_request_body();
+            const std::string &req_body = conn->get_request_body();
             //2. 对正文进行json反序列化，得到用户名和密码
             Json::Value login_info;
             bool ret = json_util::unserialize(req_body, login_info);
@@ -95,7 +168,7 @@ class gobang_server{
         void login(wsserver_t::connection_ptr &conn) {
             //用户登录功能请求的处理
             //1. 获取请求正文，并进行json反序列化，得到用户名和密码
-            std::string req_body = conn->get_request_body();
+            const std::string &req_body = conn->get_request_body();
             Json::Value login_info;
             bool ret = json_util::unserialize(req_body, login_info);
             if (ret == false) {
@@ -120,9 +193,9 @@ class gobang_server{
                 DLOG("创建会话失败");
                 return http_resp(conn, false, websocketpp::http::status_code::internal_server_error , "创建会话失败");
             }
-            _sm.set_session_expire_time(ssp->ssid(), SESSION_TIMEOUT);
+            _sm.set_session_expire_time(ssp, SESSION_TIMEOUT);
             //4. 设置响应头部：Set-Cookie,将sessionid通过cookie返回
-            std::string cookie_ssid = "SSID=" + std::to_string(ssp->ssid());
+            std::string cookie_ssid = "SSID=" + ssp->ssid();
             conn->append_header("Set-Cookie", cookie_ssid);
             return http_resp(conn, true, websocketpp::http::status_code::ok , "登录成功");
         }
@@ -161,7 +234,7 @@ class gobang_server{
                 return http_resp(conn, true, websocketpp::http::status_code::bad_request, "找不到ssid信息，请重新登录");
             }
             // 2. 在session管理中查找对应的会话信息
-            session_ptr ssp = _sm.get_session_by_ssid(std::stol(ssid_str));
+            session_ptr ssp = _sm.get_session_by_ssid(ssid_str);
             if (ssp.get() == nullptr) {
                 //没有找到session，则认为登录已经过期，需要重新登录
                 return http_resp(conn, true, websocketpp::http::status_code::bad_request, "登录过期，请重新登录");
@@ -169,7 +242,7 @@ class gobang_server{
             // 3. 从数据库中取出用户信息，进行序列化发送给客户端
             uint64_t uid = ssp->get_user();
             Json::Value user_info;
-            ret = _ut.select_by_id(uid, user_info);
+            ret = _uc.select_by_id(uid, user_info);
             if (ret == false) {
                 //获取用户信息失败，返回错误：找不到用户信息
                 return http_resp(conn, true, websocketpp::http::status_code::bad_request, "找不到用户信息，请重新登录");
@@ -180,7 +253,83 @@ class gobang_server{
             conn->append_header("Content-Type", "application/json");
             conn->set_status(websocketpp::http::status_code::ok);
             // 4. 刷新session的过期时间
-            _sm.set_session_expire_time(ssp->ssid(), SESSION_TIMEOUT);
+            _sm.set_session_expire_time(ssp, SESSION_TIMEOUT);
+        }
+        void stats(wsserver_t::connection_ptr &conn) {
+            //运行状态统计：各事件循环线程当前统计周期内的延迟
+            Json::Value stats_json;
+            for (size_t i = 0; i < _loop_stats.size(); i++) {
+                loop_stat &st = _loop_stats[i];
+                Json::Value loop;
+                uint64_t samples = st.samples;
+                loop["samples"] = (Json::UInt64)samples;
+                loop["avg_us"] = (Json::UInt64)(samples == 0 ? 0 : st.total_us / samples);
+                loop["max_us"] = (Json::UInt64)st.max_us;
+                stats_json["loop"].append(loop);
+            }
+            _uc.stats(stats_json["user_cache"]);
+            _sq.stats(stats_json["settle"]);
+            _ac.stats(stats_json["assets"]);
+            _sm.stats(stats_json["session"]);
+            _ap.stats(stats_json["ai"]);
+            watch_group::stats(stats_json["watch"]);
+            _rm.stats(stats_json["room"]);
+            _rs.stats(stats_json["record"]);
+            _mm.stats(stats_json["match"]);
+            stats_json["log"]["written"] = (Json::UInt64)async_logger::instance().written();
+            stats_json["log"]["dropped"] = (Json::UInt64)async_logger::instance().dropped();
+            std::string body;
+            json_util::serialize(stats_json, body);
+            conn->set_body(body);
+            conn->append_header("Content-Type", "application/json");
+            conn->set_status(websocketpp::http::status_code::ok);
+        }
+        /*从URI的查询参数中取出一个整数参数，不存在返回false*/
+        static bool query_u64(const std::string &uri, const std::string &key, uint64_t &val) {
+            size_t pos = uri.find('?');
+            while (pos != std::string::npos) {
+                pos++;
+                if (uri.compare(pos, key.size(), key) == 0 && pos + key.size() < uri.size() && uri[pos + key.size()] == '=') {
+                    val = strtoull(uri.c_str() + pos + key.size() + 1, nullptr, 10);
+                    return true;
+                }
+                pos = uri.find('&', pos);
+            }
+            return false;
+        }
+        /*棋谱回放：
+         *  /replay?id=N  返回对局N的原始棋谱记录（application/octet-stream，格式见record.hpp）
+         *  /replay?uid=N 返回用户N最近对局的ID列表（JSON）*/
+        void replay(wsserver_t::connection_ptr &conn, const std::string &uri) {
+            uint64_t id = 0;
+            if (query_u64(uri, "id", id)) {
+                std::string rec;
+                if (_rs.read(id, rec) == false) {
+                    return http_resp(conn, false, websocketpp::http::status_code::not_found, "对局记录不存在");
+                }
+                conn->set_body(std::move(rec));
+                conn->append_header("Content-Type", "application/octet-stream");
+                conn->append_header("Cache-Control", "public, max-age=31536000, immutable");//棋谱写入之后不会再改变
+                conn->set_status(websocketpp::http::status_code::ok);
+                return;
+            }
+            if (query_u64(uri, "uid", id)) {
+                std::vector<uint64_t> ids;
+                _rs.games_of(id, ids);
+                Json::Value resp_json;
+                resp_json["result"] = true;
+                resp_json["games"] = Json::Value(Json::arrayValue);
+                for (uint64_t gid : ids) {
+                    resp_json["games"].append((Json::UInt64)gid);
+                }
+                std::string body;
+                json_util::serialize(resp_json, body);
+                conn->set_body(body);
+                conn->append_header("Content-Type", "application/json");
+                conn->set_status(websocketpp::http::status_code::ok);
+                return;
+            }
+            return http_resp(conn, false, websocketpp::http::status_code::bad_request, "缺少参数id或uid");
         }
         void http_callback(websocketpp::connection_hdl hdl) {
             wsserver_t::connection_ptr conn = _wssrv.get_con_from_hdl(hdl);
@@ -193,6 +342,10 @@ class gobang_server{
                 return login(conn);
             }else if (method == "GET" && uri == "/info") {
                 return info(conn);
+            }else if (method == "GET" && uri == "/stats") {
+                return stats(conn);
+            }else if (method == "GET" && uri.compare(0, 8, "/replay?") == 0) {
+                return replay(conn, uri);
             }else {
                 return file_handler(conn);
             }
@@ -203,6 +356,10 @@ class gobang_server{
             conn->send(body);
         }
         session_ptr get_session_by_cookie(wsserver_t::connection_ptr conn) {
+            // 0. websocket连接建立时已经解析过cookie并把session缓存在连接上，之后的消息直接使用
+            if (conn->ssp.get() != nullptr) {
+                return conn->ssp;
+            }
             Json::Value err_resp;
             // 1. 获取请求信息中的Cookie，从Cookie中获取ssid
             std::string cookie_str = conn->get_request_header("Cookie");
@@ -226,7 +383,7 @@ class gobang_server{
                 return session_ptr();
             }
             // 2. 在session管理中查找对应的会话信息
-            session_ptr ssp = _sm.get_session_by_ssid(std::stol(ssid_str));
+            session_ptr ssp = _sm.get_session_by_ssid(ssid_str);
             if (ssp.get() == nullptr) {
                 //没有找到session，则认为登录已经过期，需要重新登录
                 err_resp["optype"] = "hall_ready";
@@ -235,6 +392,7 @@ class gobang_server{
                 ws_resp(conn, err_resp);
                 return session_ptr();
             }
+            conn->ssp = ssp;
             return ssp;
         }
         void wsopen_game_hall(wsserver_t::connection_ptr conn) {
@@ -254,12 +412,16 @@ class gobang_server{
             }
             //3. 将当前客户端以及连接加入到游戏大厅
             _om.enter_game_hall(ssp->get_user(), conn);
-            //4. 给客户端响应游戏大厅连接建立成功
+            //4. 给客户端响应游戏大厅连接建立成功，还在断线宽限期内的对局带上房间号，客户端回到房间继续对局
             resp_json["optype"] = "hall_ready";
             resp_json["result"] = true;
+            room_ptr rp = _rm.resume_room(ssp->get_user());
+            if (rp.get() != nullptr) {
+                resp_json["room_id"] = (Json::UInt64)rp->id();
+            }
             ws_resp(conn, resp_json);
             //5. 记得将session设置为永久存在
-            _sm.set_session_expire_time(ssp->ssid(), SESSION_FOREVER);
+            _sm.set_session_expire_time(ssp, SESSION_FOREVER);
         }
         void wsopen_game_room(wsserver_t::connection_ptr conn) {
             Json::Value resp_json;
@@ -276,30 +438,73 @@ class gobang_server{
                 resp_json["result"] = false;
                 return ws_resp(conn, resp_json);
             }
-            //3. 检查用户是否已经在游戏房间中（避免重复连接）
-            if (_om.is_in_game_room(ssp->get_user())) {
-                resp_json["optype"] = "room_ready";
-                resp_json["reason"] = "玩家已经在游戏房间中！";
-                resp_json["result"] = false;
-                return ws_resp(conn, resp_json);
-            }
-            //4. 如果用户在游戏大厅中，先将其从大厅移除
+            //3. 如果用户在游戏大厅中，先将其从大厅移除
             if (_om.is_in_game_hall(ssp->get_user())) {
                 _om.exit_game_hall(ssp->get_user());
             }
-            //5. 将当前用户添加到在线用户管理的游戏房间中
-            _om.enter_game_room(ssp->get_user(), conn);
+            //4. 将当前用户添加到在线用户管理的游戏房间中：已经有房间连接（断线还没有被检测到、或者在别的页面重新打开了房间）时
+            //   原地替换成新连接，替换过程中玩家一直在线，对手此时落子不会判为掉线胜；
+            //   替换之后再关闭旧连接，旧连接关闭时发现自己已经被顶替，不会再把玩家移出房间
+            wsserver_t::connection_ptr old = _om.replace_game_room(ssp->get_user(), conn);
+            if (old.get() != nullptr && old != conn) {
+                DLOG("房间:%lu 用户:%lu 新连接顶替旧连接", rp->id(), ssp->get_user());
+                websocketpp::lib::error_code ec;
+                old->close(websocketpp::close::status::going_away, "replaced", ec);
+            }
             //5. 将session重新设置为永久存在
-            _sm.set_session_expire_time(ssp->ssid(), SESSION_FOREVER);
-            //6. 回复房间准备完毕
-            resp_json["optype"] = "room_ready";
-            resp_json["result"] = true;
-            resp_json["room_id"] = (Json::UInt64)rp->id();
-            resp_json["uid"] = (Json::UInt64)ssp->get_user();
-            resp_json["white_id"] = (Json::UInt64)rp->get_white_user();
-            resp_json["black_id"] = (Json::UInt64)rp->get_black_user();
+            _sm.set_session_expire_time(ssp, SESSION_FOREVER);
+            //6. 回复房间准备完毕，断线重连时同时带上当前的棋局
+            _rm.user_enter(rp, ssp->get_user(), resp_json);
             return ws_resp(conn, resp_json);
         }
+        /*观战连接 /watch?room_id=N，返回房间ID，格式不对返回0*/
+        static uint64_t watch_room_id(const std::string &uri) {
+            const std::string prefix = "/watch?room_id=";
+            if (uri.compare(0, prefix.size(), prefix) != 0) {
+                return 0;
+            }
+            return strtoull(uri.c_str() + prefix.size(), nullptr, 10);
+        }
+        static bool is_watch(const std::string &uri) {
+            return uri == "/watch" || uri.compare(0, 7, "/watch?") == 0;
+        }
+        /*观战不需要登录：房间存在就发送快照并加入观战者集合，之后的每一步都会推送过来*/
+        void wsopen_watch(wsserver_t::connection_ptr conn, const std::string &uri) {
+            room_ptr rp = _rm.get_room_by_rid(watch_room_id(uri));
+            if (rp.get() == nullptr) {
+                Json::Value resp_json;
+                resp_json["optype"] = "watch_snapshot";
+                resp_json["result"] = false;
+                resp_json["reason"] = "房间不存在或者对局已经结束";
+                return ws_resp(conn, resp_json);
+            }
+            if (rp->watch(conn) == false) {
+                Json::Value resp_json;
+                resp_json["optype"] = "watch_snapshot";
+                resp_json["result"] = false;
+                resp_json["reason"] = "观战人数已满";
+                return ws_resp(conn, resp_json);
+            }
+            DLOG("房间:%lu 新的观战者, 当前观战人数:%lu", rp->id(), rp->watcher_count());
+        }
+        void wsclose_watch(wsserver_t::connection_ptr conn, const std::string &uri) {
+            room_ptr rp = _rm.get_room_by_rid(watch_room_id(uri));
+            if (rp.get() != nullptr) {
+                rp->unwatch(conn);
+            }
+        }
+        bool wsvalidate_callback(websocketpp::connection_hdl hdl) {
+            //握手阶段协商子协议：房间连接请求了二进制子协议则选用，否则使用默认的JSON文本帧
+            wsserver_t::connection_ptr conn = _wssrv.get_con_from_hdl(hdl);
+            const std::vector<std::string> &protos = conn->get_requested_subprotocols();
+            for (auto &proto : protos) {
+                if (proto == GOBANG_BIN_PROTO) {
+                    conn->select_subprotocol(proto);
+                    break;
+                }
+            }
+            return true;
+        }
         void wsopen_callback(websocketpp::connection_hdl hdl) {
             //websocket长连接建立成功之后的处理函数
             wsserver_t::connection_ptr conn = _wssrv.get_con_from_hdl(hdl);
@@ -311,6 +516,9 @@ class gobang_server{
             }else if (uri == "/room") {
                 //建立了游戏房间的长连接
                 return wsopen_game_room(conn);
+            }else if (is_watch(uri)) {
+                //建立了观战的长连接
+                return wsopen_watch(conn, uri);
             }
         }
         void wsclose_game_hall(wsserver_t::connection_ptr conn) {
@@ -323,7 +531,7 @@ class gobang_server{
             //1. 将玩家从游戏大厅中移除
             _om.exit_game_hall(ssp->get_user());
             //2. 将session恢复生命周期的管理，设置定时销毁
-            _sm.set_session_expire_time(ssp->ssid(), SESSION_TIMEOUT);
+            _sm.set_session_expire_time(ssp, SESSION_TIMEOUT);
         }
         void wsclose_game_room(wsserver_t::connection_ptr conn) {
             //获取会话信息，识别客户端
@@ -331,12 +539,16 @@ class gobang_server{
             if (ssp.get() == nullptr) {
                 return;
             }
+            //已经被新连接顶替的旧连接，什么都不用做
+            if (_om.get_conn_from_room(ssp->get_user()) != conn) {
+                return;
+            }
             //1. 将玩家从在线用户管理中移除
             _om.exit_game_room(ssp->get_user());
             //2. 将session回复生命周期的管理，设置定时销毁
-            _sm.set_session_expire_time(ssp->ssid(), SESSION_TIMEOUT);
-            //3. 将玩家从游戏房间中移除，房间中所有用户退出了就会销毁房间
-            _rm.remove_room_user(ssp->get_user());
+            _sm.set_session_expire_time(ssp, SESSION_TIMEOUT);
+            //3. 对局进行中则保留座位等待重连，超时未重连才判负；否则直接退出房间，房间中所有用户退出了就会销毁房间
+            _rm.user_disconnect(ssp->get_user());
         }
         void wsclose_callback(websocketpp::connection_hdl hdl) {
             //websocket连接断开前的处理
@@ -349,6 +561,8 @@ class gobang_server{
             }else if (uri == "/room") {
                 //建立了游戏房间的长连接
                 return wsclose_game_room(conn);
+            }else if (is_watch(uri)) {
+                return wsclose_watch(conn, uri);
             }
         }
         void wsmsg_game_hall(wsserver_t::connection_ptr conn, wsserver_t::message_ptr msg) {
@@ -360,7 +574,7 @@ class gobang_server{
                 return;
             }
             //2. 获取请求信息
-            std::string req_body = msg->get_payload();
+            const std::string &req_body = msg->get_payload();
             Json::Value req_json;
             bool ret = json_util::unserialize(req_body, req_json);
             if (ret == false) {
@@ -369,11 +583,34 @@ class gobang_server{
                 return ws_resp(conn, resp_json);
             }
             //3. 对于请求进行处理：
+            //有未结束的对局（断线重连宽限期内）时不能开始新的匹配，直接回到原来的房间
+            room_ptr cur = _rm.resume_room(ssp->get_user());
+            if (cur.get() != nullptr && !req_json["optype"].isNull() &&
+                (req_json["optype"].asString() == "match_start" || req_json["optype"].asString() == "match_ai")) {
+                resp_json["optype"] = "match_success";
+                resp_json["result"] = true;
+                resp_json["room_id"] = (Json::UInt64)cur->id();
+                return ws_resp(conn, resp_json);
+            }
             if (!req_json["optype"].isNull() && req_json["optype"].asString() == "match_start"){
                 //  开始对战匹配：通过匹配模块，将用户添加到匹配队列中
-                _mm.add(ssp->get_user());
                 resp_json["optype"] = "match_start";
-                resp_json["result"] = true;
+                resp_json["result"] = _mm.add(ssp->get_user());
+                if (resp_json["result"].asBool() == false) {
+                    resp_json["reason"] = "加入匹配失败，请稍后重试";
+                }
+                return ws_resp(conn, resp_json);
+            }else if (!req_json["optype"].isNull() && req_json["optype"].asString() == "match_ai") {
+                //  人机对战：不经过匹配队列，直接创建与AI对战的房间
+                _mm.del(ssp->get_user());
+                room_ptr rp = _rm.create_ai_room(ssp->get_user());
+                resp_json["optype"] = "match_success";
+                resp_json["result"] = rp.get() != nullptr;
+                if (rp.get() == nullptr) {
+                    resp_json["reason"] = "创建人机对战房间失败";
+                }else {
+                    resp_json["room_id"] = (Json::UInt64)rp->id();
+                }
                 return ws_resp(conn, resp_json);
             }else if (!req_json["optype"].isNull() && req_json["optype"].asString() == "match_stop") {
                 //  停止对战匹配：通过匹配模块，将用户从匹配队列中移除
@@ -404,9 +641,34 @@ class gobang_server{
                 DLOG("房间-没有找到玩家房间信息");
                 return ws_resp(conn, resp_json);
             }
-            //3. 对消息进行反序列化
+            //3. 限流和长度检查在解码/解析之前进行，刷屏或者超长的帧直接丢弃，不构造任何响应
+            if (rp->admit(ssp->get_user()) == false) {
+                DLOG("房间-用户:%lu 消息过于频繁，丢弃", ssp->get_user());
+                return;
+            }
+            if (msg->get_payload().size() > ROOM_MAX_FRAME) {
+                DLOG("房间-用户:%lu 消息过长，丢弃", ssp->get_user());
+                return;
+            }
+            //4. 协商了二进制子协议的客户端，走棋请求是固定格式的二进制帧，不经过JSON
+            if (msg->get_opcode() == websocketpp::frame::opcode::binary) {
+                int row, col;
+                if (proto_util::decode_move(msg->get_payload(), row, col) == false) {
+                    move_result mr;
+                    mr.status = MOVE_BAD_FRAME;
+                    mr.uid = ssp->get_user();
+                    mr.row = mr.col = -1;
+                    mr.color = 0;
+                    mr.move_no = 0;
+                    mr.winner = 0;
+                    DLOG("房间-二进制请求格式错误");
+                    return room::send_reject(conn, mr);
+                }
+                return rp->handle_move(ssp->get_user(), row, col);
+            }
+            //5. 对消息进行反序列化
             Json::Value req_json;
-            std::string req_body = msg->get_payload();
+            const std::string &req_body = msg->get_payload();
             bool ret = json_util::unserialize(req_body, req_json);
             if (ret == false) {
                 resp_json["optype"] = "unknow";
@@ -416,9 +678,9 @@ class gobang_server{
                 return ws_resp(conn, resp_json);
             }
             DLOG("房间：收到房间请求，开始处理....");
-            //4. 将真实的用户ID添加到请求中
+            //6. 将真实的用户ID添加到请求中
             req_json["uid"] = (Json::UInt64)ssp->get_user();
-            //5. 通过房间模块进行消息请求的处理
+            //7. 通过房间模块进行消息请求的处理
             return rp->handle_request(req_json);
         }
         void wsmsg_callback(websocketpp::connection_hdl hdl, wsserver_t::message_ptr msg) {
@@ -442,21 +704,44 @@ class gobang_server{
                const std::string &dbname,
                uint16_t port = 3306,
                const std::string &wwwroot = WWWROOT):
-               _web_root(wwwroot), _ut(host, user, pass, dbname, port),
-               _rm(&_ut, &_om), _sm(&_wssrv), _mm(&_rm, &_ut, &_om) {
+               _web_root(wwwroot), _ac(wwwroot), _ut(host, user, pass, dbname, port), _uc(&_ut, CACHE_WRITE_BEHIND),
+               _sq(&_uc),
+               _ap(std::bind(&gobang_server::post, this, std::placeholders::_1)), _rm(&_sq, &_om, &_ap, &_rs, std::bind(&gobang_server::timer, this, std::placeholders::_1, std::placeholders::_2)), _mm(&_rm, &_uc, &_om), _last_report_ms(0) {
             _wssrv.set_access_channels(websocketpp::log::alevel::none);
             _wssrv.init_asio();
             _wssrv.set_reuse_addr(true);
             _wssrv.set_http_handler(std::bind(&gobang_server::http_callback, this, std::placeholders::_1));
+            _wssrv.set_validate_handler(std::bind(&gobang_server::wsvalidate_callback, this, std::placeholders::_1));
             _wssrv.set_open_handler(std::bind(&gobang_server::wsopen_callback, this, std::placeholders::_1));
             _wssrv.set_close_handler(std::bind(&gobang_server::wsclose_callback, this, std::placeholders::_1));
             _wssrv.set_message_handler(std::bind(&gobang_server::wsmsg_callback, this, std::placeholders::_1, std::placeholders::_2));
         }
-        /*启动服务器*/
-        void start(int port) {
+        /*启动服务器，threads为事件循环线程数量，<=0则使用CPU核心数*/
+        void start(int port, int threads = 0) {
+            if (threads <= 0) {
+                threads = std::thread::hardware_concurrency();
+            }
+            if (threads <= 0) {
+                threads = 1;
+            }
             _wssrv.listen(port);
             _wssrv.start_accept();
-            _wssrv.run();
+            _loop_stats = std::vector<loop_stat>(threads);
+            _last_report_ms = time_util::now_ms();
+            //每个线程一个探测定时器，哪个线程执行了探测回调，延迟就记在哪个线程上
+            for (int i = 0; i < threads; i++) {
+                _wssrv.set_timer(LOOP_PROBE_MS, std::bind(&gobang_server::loop_probe, this,
+                    time_util::now_us(), std::placeholders::_1));
+            }
+            ILOG("事件循环线程数量: %d", threads);
+            std::vector<std::thread> workers;
+            for (int i = 1; i < threads; i++) {
+                workers.push_back(std::thread(&gobang_server::loop_entry, this, i));
+            }
+            loop_entry(0);
+            for (auto &th : workers) {
+                th.join();
+            }
         }
 };
 #endif
\ No newline at end of file
@@ -1,111 +1,272 @@
 #ifndef __M_SS_H__//为了防止头文件被重复包含
 #define __M_SS_H__
 #include "util.hpp"
-#include <unordered_map>
+#include "rcu.hpp"
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <sys/random.h>
 #include <websocketpp/server.hpp>
 #include <websocketpp/config/asio_no_tls.hpp>
 
+#define SSID_LEN 32 //ssid是128位随机数的16进制字符串
+/*session标识：128位随机数，lo用于分片和表内查找，hi用于校验*/
+struct ss_key {
+    uint64_t hi;
+    uint64_t lo;
+    bool operator==(const ss_key &o) const { return hi == o.hi && lo == o.lo; }
+};
 typedef enum {UNLOGIN, LOGIN} ss_statu;
 class session {
     private:
-        uint64_t _ssid;//标识符
+        ss_key _key;
+        std::string _ssid;//标识符，_key的16进制表示，放在cookie中
         uint64_t _uid;//session对应的用户ID
         ss_statu _statu;//用户状态：未登录，已登录
-        wsserver_t::timer_ptr _tp;//session关联的定时器
+        std::atomic<uint64_t> _expire_ms;//过期时间，0表示永久存在
+        std::atomic<bool> _in_wheel;//是否已经挂在时间轮上
     public:
-        session(uint64_t ssid): _ssid(ssid){ DLOG("SESSION %p 被创建！！", this); }//构造函数
+        session(const ss_key &key): _key(key), _expire_ms(0), _in_wheel(false) {
+            static const char hex[] = "0123456789abcdef";
+            _ssid.resize(SSID_LEN);
+            for (int i = 0; i < 16; i++) {
+                _ssid[i] = hex[(key.hi >> (60 - 4 * i)) & 0xF];
+                _ssid[16 + i] = hex[(key.lo >> (60 - 4 * i)) & 0xF];
+            }
+            DLOG("SESSION %p 被创建！！", this);
+        }//构造函数
         ~session() { DLOG("SESSION %p 被释放！！", this); }
-        uint64_t ssid() { return _ssid; }//返回ssid
+        const std::string &ssid() { return _ssid; }//返回ssid
+        const ss_key &key() { return _key; }
         void set_statu(ss_statu statu) { _statu = statu; }//设置状态
         void set_user(uint64_t uid) { _uid = uid; }//设置用户id
         uint64_t get_user() { return _uid; }//获取用户id
         bool is_login() { return (_statu == LOGIN); }//是否登录
-        void set_timer(const wsserver_t::timer_ptr &tp) { _tp = tp;}//设置定时器
-        wsserver_t::timer_ptr& get_timer() { return _tp; }
+        uint64_t expire_ms() { return _expire_ms; }
+        void set_expire_ms(uint64_t ms) { _expire_ms = ms; }
+        //标记挂到时间轮上，返回之前是否已经挂上
+        bool mark_in_wheel() { return _in_wheel.exchange(true); }
+        void clear_in_wheel() { _in_wheel = false; }
 };
 
 #define SESSION_TIMEOUT 30000
 #define SESSION_FOREVER -1
+#define SESSION_SHARDS 32        //session表按ssid分片的数量
+#define SESSION_BUCKETS 4096     //每个分片的桶数量，session数量远多于在线用户，链表保持在几个节点以内
+#define SESSION_TICK_MS 1000     //时间轮一格的时间，session的过期时间精度
+#define SESSION_WHEEL_SLOTS 64   //时间轮的格数，超过一圈的过期时间转到时留在轮上等下一圈
 using session_ptr = std::shared_ptr<session>;//智能指针，using关键字类似于typedef
+/*session管理：ssid是不可猜测的128位随机数，session按ssid分片保存在读无锁的哈希表中
+ *所有session的过期时间由一个时间轮统一管理，不再为每个session创建定时器
+ *  刷新：只修改session中的过期时间，session已经在轮上时不需要任何加锁/重新挂接，O(1)
+ *  过期：后台线程每格转动一次，取出这一格上的所有session，真正到期的批量删除，
+ *        过期时间被刷新过的挂到新的格上，已经设置为永久存在的从轮上摘下*/
 class session_manager {
     private:
-        uint64_t _next_ssid;
-        std::mutex _mutex;
-        std::unordered_map<uint64_t, session_ptr> _session;
-        wsserver_t *_server;//管理定时任务的wsserver对象
+        rcu_map<session_ptr, SESSION_BUCKETS> _shards[SESSION_SHARDS];
+        std::atomic<uint64_t> _count;
+        std::mutex _wheel_mutex;
+        std::vector<ss_key> _wheel[SESSION_WHEEL_SLOTS];//每一格上挂的session
+        uint64_t _next_tick;//下一个要处理的格对应的时刻编号（时间/SESSION_TICK_MS）
+        bool _stop;
+        std::condition_variable _cond;
+        std::thread _ticker;
+        //统计信息
+        std::atomic<uint64_t> _expired;
+        std::atomic<uint64_t> _last_batch;
+    private:
+        rcu_map<session_ptr, SESSION_BUCKETS> &get_shard(const ss_key &key) { return _shards[key.lo % SESSION_SHARDS]; }
+        static bool random_key(ss_key &key) {
+            uint64_t buf[2];
+            size_t got = 0;
+            while (got < sizeof(buf)) {
+                ssize_t ret = getrandom((char *)buf + got, sizeof(buf) - got, 0);
+                if (ret < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    ELOG("获取随机数失败: %s", strerror(errno));
+                    return false;
+                }
+                got += ret;
+            }
+            key.hi = buf[0];
+            key.lo = buf[1];
+            return true;
+        }
+        //解析32位16进制的ssid，格式不对返回false
+        static bool parse_ssid(const char *str, size_t len, ss_key &key) {
+            if (len != SSID_LEN) {
+                return false;
+            }
+            uint64_t v[2] = {0, 0};
+            for (int i = 0; i < SSID_LEN; i++) {
+                char c = str[i];
+                int d;
+                if (c >= '0' && c <= '9') d = c - '0';
+                else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+                else return false;
+                v[i / 16] = (v[i / 16] << 4) | d;
+            }
+            key.hi = v[0];
+            key.lo = v[1];
+            return true;
+        }
+        session_ptr find(const ss_key &key) {
+            session_ptr ssp;
+            if (get_shard(key).find(key.lo, &ssp) == false || !(ssp->key() == key)) {
+                return session_ptr();
+            }
+            return ssp;
+        }
+        bool erase(const ss_key &key) {
+            if (get_shard(key).erase(key.lo) == false) {
+                return false;
+            }
+            _count--;
+            return true;
+        }
+        //挂到过期时间所在的格上（向上取整，转到这一格时一定已经到期），调用者持有_wheel_mutex
+        void schedule(const ss_key &key, uint64_t expire_ms) {
+            uint64_t tick = (expire_ms + SESSION_TICK_MS - 1) / SESSION_TICK_MS;
+            if (tick < _next_tick) {
+                tick = _next_tick;
+            }
+            _wheel[tick % SESSION_WHEEL_SLOTS].push_back(key);
+        }
+        //处理一格：到期的批量删除，刷新过的重新挂接
+        void advance(uint64_t tick, uint64_t now) {
+            std::vector<ss_key> slot;
+            {
+                std::unique_lock<std::mutex> lock(_wheel_mutex);
+                slot.swap(_wheel[tick % SESSION_WHEEL_SLOTS]);
+                _next_tick = tick + 1;
+            }
+            if (slot.empty()) {
+                return;
+            }
+            std::vector<std::pair<ss_key, uint64_t>> again;//(session, 过期时间)
+            size_t expired = 0;
+            for (auto &key : slot) {
+                session_ptr ssp = find(key);
+                if (ssp.get() == nullptr) {
+                    continue;
+                }
+                uint64_t expire = ssp->expire_ms();
+                if (expire == 0) {
+                    //已经设置为永久存在，从轮上摘下；摘下之后如果又被设置了过期时间，由这里重新挂上
+                    ssp->clear_in_wheel();
+                    expire = ssp->expire_ms();
+                    if (expire == 0 || ssp->mark_in_wheel()) {
+                        continue;
+                    }
+                }
+                if (expire > now) {
+                    again.push_back(std::make_pair(key, expire));
+                    continue;
+                }
+                expired += erase(key);
+            }
+            if (!again.empty()) {
+                std::unique_lock<std::mutex> lock(_wheel_mutex);
+                for (auto &e : again) {
+                    schedule(e.first, e.second);
+                }
+            }
+            if (expired > 0) {
+                _expired += expired;
+                _last_batch = expired;
+            }
+        }
+        void ticker_entry() {
+            std::unique_lock<std::mutex> lock(_wheel_mutex);
+            while (_stop == false) {
+                //睡到下一格开始的时刻
+                uint64_t now = time_util::now_ms();
+                uint64_t next_ms = _next_tick * SESSION_TICK_MS;
+                if (next_ms > now) {
+                    _cond.wait_for(lock, std::chrono::milliseconds(next_ms - now));
+                }
+                now = time_util::now_ms();
+                uint64_t cur = now / SESSION_TICK_MS;
+                //线程被延迟时把错过的格补上
+                while (_stop == false && _next_tick <= cur) {
+                    uint64_t tick = _next_tick;
+                    lock.unlock();
+                    advance(tick, now);
+                    lock.lock();
+                }
+            }
+        }
     public:
-        session_manager(wsserver_t *srv): _next_ssid(1), _server(srv){
-            DLOG("session管理器初始化完毕！");
+        session_manager(): _count(0), _next_tick(time_util::now_ms() / SESSION_TICK_MS),
+            _stop(false), _expired(0), _last_batch(0) {
+            _ticker = std::thread(&session_manager::ticker_entry, this);
+            ILOG("session管理器初始化完毕！");
+        }
+        ~session_manager() {
+            {
+                std::unique_lock<std::mutex> lock(_wheel_mutex);
+                _stop = true;
+                _cond.notify_all();
+            }
+            _ticker.join();
+            ILOG("session管理器即将销毁！");
         }
-        ~session_manager() { DLOG("session管理器即将销毁！"); }
         session_ptr create_session(uint64_t uid, ss_statu statu) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            session_ptr ssp(new session(_next_ssid));//使用智能指针来管理每一个新创建的session
+            ss_key key;
+            do {
+                if (random_key(key) == false) {
+                    return session_ptr();
+                }
+            }while (find(key).get() != nullptr);
+            session_ptr ssp(new session(key));//使用智能指针来管理每一个新创建的session
             ssp->set_statu(statu);
             ssp->set_user(uid);
-            _session.insert(std::make_pair(_next_ssid, ssp));
-            _next_ssid++;
+            if (get_shard(key).insert(key.lo, ssp) == false) {
+                return session_ptr();//极小概率与其他session的低64位相同，让客户端重新登录
+            }
+            _count++;
             return ssp;
         }
-        //添加一个已有的session
-        void append_session(const session_ptr &ssp) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _session.insert(std::make_pair(ssp->ssid(), ssp));
-        }
-        //通过ssid来查找session
-        session_ptr get_session_by_ssid(uint64_t ssid) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _session.find(ssid);
-            if (it == _session.end()) {
+        //通过ssid来查找session，读路径不加锁
+        session_ptr get_session_by_ssid(const std::string &ssid) {
+            ss_key key;
+            if (parse_ssid(ssid.c_str(), ssid.size(), key) == false) {
                 return session_ptr();
             }
-            return it->second;
+            return find(key);
         }
         //销毁
-        void remove_session(uint64_t ssid) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _session.erase(ssid);
+        void remove_session(const session_ptr &ssp) {
+            erase(ssp->key());
         }
         //设置一个过期时间
-        void set_session_expire_time(uint64_t ssid, int ms) {
-            //依赖于websocketpp的定时器来完成session生命周期的管理。
+        void set_session_expire_time(const session_ptr &ssp, int ms) {
             // 登录之后，创建session，session需要在指定时间无通信后删除
             // 但是进入游戏大厅，或者游戏房间，这个session就应该永久存在
             // 等到退出游戏大厅，或者游戏房间，这个session应该被重新设置为临时，在长时间无通信后被删除
-            session_ptr ssp = get_session_by_ssid(ssid);
-            if (ssp.get() == nullptr) {
+            if (ms == SESSION_FOREVER) {
+                //永久存在：只清除过期时间，时间轮转到时会把它摘下
+                ssp->set_expire_ms(0);
                 return;
             }
-            wsserver_t::timer_ptr tp = ssp->get_timer();
-            if (tp.get() == nullptr && ms == SESSION_FOREVER) {
-                // 1. 在session永久存在的情况下，设置永久存在
-                return ;
-            }else if (tp.get() == nullptr && ms != SESSION_FOREVER) {
-                // 2. 在session永久存在的情况下，设置指定时间之后被删除的定时任务
-                wsserver_t::timer_ptr tmp_tp = _server->set_timer(ms, 
-                    std::bind(&session_manager::remove_session, this, ssid));
-                ssp->set_timer(tmp_tp);
-            }else if (tp.get() != nullptr && ms == SESSION_FOREVER) {
-                // 3. 在session设置了定时删除的情况下，将session设置为永久存在
-                // 删除定时任务--- stready_timer删除定时任务会导致任务直接被执行
-                tp->cancel();//因为这个取消定时任务并不是立即取消的
-                //因此重新给session管理器中，添加一个session信息, 且添加的时候需要使用定时器，而不是立即添加（否则可能出现先添加后删除的情况）
-                ssp->set_timer(wsserver_t::timer_ptr());//将session关联的定时器设置为空（为空即代表永久存在）
-                _server->set_timer(0, std::bind(&session_manager::append_session, this, ssp));
-            }else if (tp.get() != nullptr && ms != SESSION_FOREVER) {
-                // 4. 在session设置了定时删除的情况下，将session重置删除时间。
-                tp->cancel();//因为这个取消定时任务并不是立即取消的
-                ssp->set_timer(wsserver_t::timer_ptr());
-                _server->set_timer(0, std::bind(&session_manager::append_session, this, ssp));
-
-                //重新给session添加定时销毁任务
-                wsserver_t::timer_ptr tmp_tp  = _server->set_timer(ms, 
-                    std::bind(&session_manager::remove_session, this, ssp->ssid()));
-                //重新设置session关联的定时器
-                ssp->set_timer(tmp_tp);
+            uint64_t expire = time_util::now_ms() + ms;
+            ssp->set_expire_ms(expire);
+            if (ssp->mark_in_wheel() == false) {
+                //第一次设置过期时间（或者之前已经从轮上摘下），挂到时间轮上；已经在轮上的由时间轮转到时重新挂接
+                std::unique_lock<std::mutex> lock(_wheel_mutex);
+                schedule(ssp->key(), expire);
             }
         }
+        void stats(Json::Value &val) {
+            val["sessions"] = (Json::UInt64)_count;
+            val["expired"] = (Json::UInt64)_expired;
+            val["last_batch"] = (Json::UInt64)_last_batch;
+        }
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,151 @@
+#ifndef __M_SETTLE_H__
+#define __M_SETTLE_H__
+#include "util.hpp"
+#include "cache.hpp"
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+
+#define SETTLE_RETRY_MS 1000 //结算失败后的重试间隔
+#define SETTLE_MAX_FAILURES 5 //同一局在其他对局能结算成功时仍然失败的次数上限，超过后移出队列，记入错误日志
+/*对局结算队列：房间在对局结束时只把结果放入队列就立即返回（继续广播），
+ *由专门的结算线程把队列中积累的所有结果一次性取出，在一个事务中提交，负载越高单次提交合并的对局越多；
+ *整批提交失败时逐局重新提交，只有失败的对局放回队首重试，一局坏数据不会挡住其他对局；
+ *一局对局在别的对局都能提交时反复失败（而不是数据库不可用），超过上限后移出队列并记入错误日志；
+ *write-behind模式下结算只修改缓存，一批中成功的对局已经生效，直接逐局提交*/
+class settle_queue {
+    private:
+        struct entry {
+            game_result result;
+            int failures;
+        };
+        user_cache *_uc;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        std::vector<entry> _pending;
+        bool _stop;
+        std::thread _worker;
+        //统计信息
+        std::atomic<uint64_t> _settled;
+        std::atomic<uint64_t> _commits;
+        std::atomic<uint64_t> _failures;
+        std::atomic<uint64_t> _last_batch;
+        std::atomic<uint64_t> _max_batch;
+        std::atomic<uint64_t> _dropped;//超过失败上限被移出队列的对局
+    private:
+        bool commit(const std::vector<entry> &batch) {
+            std::vector<game_result> results;
+            results.reserve(batch.size());
+            for (auto &e : batch) {
+                results.push_back(e.result);
+            }
+            if (_uc->settle(results) == false) {
+                return false;
+            }
+            _commits++;
+            return true;
+        }
+        /*整批提交失败后逐局提交，失败的对局放入failed，返回提交成功的局数；有对局提交成功说明数据库可用，
+         *失败的对局记一次失败，超过上限的不再重试；全部失败时多半是数据库不可用，不计入*/
+        size_t commit_each(const std::vector<entry> &batch, std::vector<entry> &failed) {
+            for (auto &e : batch) {
+                if (commit(std::vector<entry>(1, e)) == false) {
+                    failed.push_back(e);
+                }
+            }
+            size_t ok = batch.size() - failed.size();
+            if (ok == 0) {
+                return 0;
+            }
+            size_t keep = 0;
+            for (auto &e : failed) {
+                if (++e.failures >= SETTLE_MAX_FAILURES) {
+                    _dropped++;
+                    ELOG("对局结算连续失败%d次，放弃结算: 胜者:%lu 败者:%lu", e.failures, e.result.winner, e.result.loser);
+                    continue;
+                }
+                failed[keep++] = e;
+            }
+            failed.resize(keep);
+            return ok;
+        }
+        void worker_entry() {
+            std::vector<entry> batch, failed;
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true) {
+                _cond.wait(lock, [this]() { return _stop || !_pending.empty(); });
+                if (_pending.empty()) {
+                    break;//已经停止且没有待结算的对局
+                }
+                batch.swap(_pending);
+                lock.unlock();
+                size_t ok = batch.size();
+                if (_uc->write_behind()) {
+                    ok = commit_each(batch, failed);
+                }else if (commit(batch) == false) {
+                    if (batch.size() > 1) {
+                        ok = commit_each(batch, failed);
+                    }else {
+                        ok = 0;
+                        failed = batch;
+                    }
+                }
+                lock.lock();
+                _settled += ok;
+                if (!failed.empty()) {
+                    //失败的对局放回队首，稍后重试，停止时不再等待
+                    _failures++;
+                    ELOG("对局结算失败，%lu局对局等待重试", failed.size());
+                    _pending.insert(_pending.begin(), failed.begin(), failed.end());
+                    batch.clear();
+                    failed.clear();
+                    if (_stop) {
+                        break;
+                    }
+                    _cond.wait_for(lock, std::chrono::milliseconds(SETTLE_RETRY_MS));
+                    continue;
+                }
+                _last_batch = batch.size();
+                if (batch.size() > _max_batch) {
+                    _max_batch = batch.size();
+                }
+                batch.clear();
+            }
+        }
+    public:
+        settle_queue(user_cache *uc): _uc(uc), _stop(false), _settled(0), _commits(0),
+            _failures(0), _last_batch(0), _max_batch(0), _dropped(0) {
+            _worker = std::thread(&settle_queue::worker_entry, this);
+            ILOG("对局结算模块初始化完毕....");
+        }
+        ~settle_queue() {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+                _cond.notify_all();
+            }
+            _worker.join();
+        }
+        /*提交一局对局结果，不等待数据库写入*/
+        void push(uint64_t winner, uint64_t loser) {
+            entry e;
+            e.result.winner = winner;
+            e.result.loser = loser;
+            e.failures = 0;
+            std::unique_lock<std::mutex> lock(_mutex);
+            _pending.push_back(e);
+            _cond.notify_one();
+        }
+        void stats(Json::Value &val) {
+            val["settled"] = (Json::UInt64)_settled;
+            val["commits"] = (Json::UInt64)_commits;
+            val["failures"] = (Json::UInt64)_failures;
+            val["last_batch"] = (Json::UInt64)_last_batch;
+            val["max_batch"] = (Json::UInt64)_max_batch;
+            val["dropped"] = (Json::UInt64)_dropped;
+            std::unique_lock<std::mutex> lock(_mutex);
+            val["pending"] = (Json::UInt64)_pending.size();
+        }
+};
+#endif
@@ -0,0 +1,108 @@
+#ifndef __M_TT_H__
+#define __M_TT_H__
+#include "board.hpp"
+#include <atomic>
+#include <vector>
+
+#define TT_NO_MOVE 255 //没有着法，着法编号为row*BOARD_COL+col
+typedef enum { TT_EXACT = 0, TT_LOWER, TT_UPPER } tt_flag;
+
+/*Zobrist哈希：每种颜色每个位置一个64位随机数，固定种子保证不同进程、不同时间生成的键相同（开局库依赖这一点）*/
+class zobrist_util {
+    public:
+        static uint64_t key(int color, int row, int col) {
+            return table()[(color == CHESS_WHITE ? 0 : 1) * BOARD_ROW * BOARD_COL + row * BOARD_COL + col];
+        }
+        static uint64_t hash(const board &b) {
+            uint64_t h = 0;
+            for (int r = 0; r < BOARD_ROW; r++) {
+                for (int c = 0; c < BOARD_COL; c++) {
+                    int color = b.get(r, c);
+                    if (color != 0) {
+                        h ^= key(color, r, c);
+                    }
+                }
+            }
+            return h;
+        }
+    private:
+        static const uint64_t *table() {
+            static uint64_t table[2 * BOARD_ROW * BOARD_COL];
+            static bool inited = [] {
+                uint64_t x = 0x9E3779B97F4A7C15ULL;
+                for (int i = 0; i < 2 * BOARD_ROW * BOARD_COL; i++) {
+                    //splitmix64
+                    uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+                    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                    table[i] = z ^ (z >> 31);
+                }
+                return true;
+            }();
+            (void)inited;
+            return table;
+        }
+};
+
+/*置换表中的一项*/
+struct tt_data {
+    int score;
+    int depth;
+    tt_flag flag;
+    int move;//TT_NO_MOVE表示没有
+    int extra;//调用者自定义的8位信息（例如求解方式）
+};
+
+/*可以被多个线程同时读写的置换表：
+ *  每个槽位保存 data 和 key^data 两个64位字，写入时先写data再写校验字，读取时 check^data==key 才算命中，
+ *  两个线程同时写同一个槽位造成的撕裂只会表现为未命中，不需要加锁
+ *同一个进程中所有搜索线程共享一张表，一个线程搜索过的局面（包括其他房间走到的相同局面）其他线程直接复用*/
+class shared_tt {
+    private:
+        struct slot {
+            std::atomic<uint64_t> check;
+            std::atomic<uint64_t> data;
+        };
+        std::vector<slot> _slots;
+        uint64_t _mask;
+    private:
+        static uint64_t pack(const tt_data &d) {
+            return (uint64_t)(uint32_t)d.score | ((uint64_t)(uint8_t)d.depth << 32) | ((uint64_t)(uint8_t)d.flag << 40) |
+                   ((uint64_t)(uint8_t)d.move << 48) | ((uint64_t)(uint8_t)d.extra << 56);
+        }
+        static void unpack(uint64_t v, tt_data &d) {
+            d.score = (int32_t)(uint32_t)v;
+            d.depth = (int8_t)(v >> 32);
+            d.flag = (tt_flag)(uint8_t)(v >> 40);
+            d.move = (uint8_t)(v >> 48);
+            d.extra = (uint8_t)(v >> 56);
+        }
+    public:
+        shared_tt(int bits): _slots((size_t)1 << bits), _mask(((uint64_t)1 << bits) - 1) {
+            clear();
+        }
+        void clear() {
+            for (auto &s : _slots) {
+                s.check.store(0, std::memory_order_relaxed);
+                s.data.store(0, std::memory_order_relaxed);
+            }
+        }
+        size_t size() { return _slots.size(); }
+        bool probe(uint64_t key, tt_data &d) {
+            slot &s = _slots[key & _mask];
+            uint64_t data = s.data.load(std::memory_order_relaxed);
+            uint64_t check = s.check.load(std::memory_order_relaxed);
+            if ((check ^ data) != key || (check | data) == 0) {
+                return false;
+            }
+            unpack(data, d);
+            return true;
+        }
+        void store(uint64_t key, const tt_data &d) {
+            slot &s = _slots[key & _mask];
+            uint64_t data = pack(d);
+            s.data.store(data, std::memory_order_relaxed);
+            s.check.store(key ^ data, std::memory_order_relaxed);
+        }
+};
+#endif
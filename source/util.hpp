@@ -4,15 +4,26 @@
 #include <iostream>
 #include <string>
 #include <mysql/mysql.h>
+#include <string.h>
 #include <memory>
 #include <jsoncpp/json/json.h>
 #include <sstream>
 #include <vector>
 #include <fstream>
+#include <chrono>
+#include <atomic>
 #include<websocketpp/server.hpp>
 #include<websocketpp/config/asio_no_tls.hpp>
 
-typedef websocketpp::server<websocketpp::config::asio> wsserver_t;//
+class session;
+/*在websocketpp默认asio配置的基础上给每个连接附加一个session指针：
+ *websocket连接建立时解析一次cookie找到session并缓存在连接上，之后这个连接上的每条消息直接使用*/
+struct gobang_ws_config : public websocketpp::config::asio {
+    struct connection_base {
+        std::shared_ptr<session> ssp;
+    };
+};
+typedef websocketpp::server<gobang_ws_config> wsserver_t;//
 
 class mysql_util{
     public:
@@ -55,7 +66,7 @@ class mysql_util{
             if(ret!=0){
                 ELOG("%s\n",sql.c_str());//日志输出
                 ELOG("query error: %s\n",mysql_error(mysql));
-                mysql_close(mysql);
+                //句柄由调用者管理，执行失败时不能在这里关闭，否则调用者后续会使用一个已释放的句柄
                 return false;
             }
             return true;
@@ -68,51 +79,170 @@ class mysql_util{
             return;
    
         }//定义一个静态函数，用来销毁mysql
+        //预处理语句的参数/结果绑定，buffer指向的内存在语句执行期间必须有效
+        static void bind_u64(MYSQL_BIND &bind, uint64_t *val){
+            memset(&bind, 0, sizeof(bind));
+            bind.buffer_type = MYSQL_TYPE_LONGLONG;
+            bind.buffer = val;
+            bind.is_unsigned = true;
+        }
+        static void bind_int(MYSQL_BIND &bind, int *val){
+            memset(&bind, 0, sizeof(bind));
+            bind.buffer_type = MYSQL_TYPE_LONG;
+            bind.buffer = val;
+        }
+        static void bind_str(MYSQL_BIND &bind, char *buf, unsigned long cap, unsigned long *len){
+            memset(&bind, 0, sizeof(bind));
+            bind.buffer_type = MYSQL_TYPE_STRING;
+            bind.buffer = buf;
+            bind.buffer_length = cap;
+            bind.length = len;
+        }
 
 
 };
 
-class json_util{
+/*直接追加到调用者提供的字符串中的输出流缓冲区，序列化时不再经过stringstream再拷贝一次*/
+class string_sink : public std::streambuf {
+    private:
+        std::string *_out;
+    protected:
+        int_type overflow(int_type ch) override {
+            if (ch != traits_type::eof()) {
+                _out->push_back((char)ch);
+            }
+            return ch;
+        }
+        std::streamsize xsputn(const char *s, std::streamsize n) override {
+            _out->append(s, n);
+            return n;
+        }
     public:
-        static bool serialize(const Json::Value &root, std::string&string){
-                 //2.实例化一个StreamWriterBuilder工厂类对象并设置属性
-                Json::StreamWriterBuilder swb;//StreamWriterBuilder是一个工厂类，用于创建StreamWriter对象
-                //关键设置：禁用Unicode转义
-                swb.settings_["emitUTF8"]=true;//直接输出UTF-8字符
-                swb.settings_["indentation"]="    ";//保持美观缩进
-                //3.通过StreamWriterBuilder工厂类对象生产一个StreamWriter对象
-                //Json::StreamWriter *sw=swb.newStreamWriter();//创建一个StreamWriter对象,用于序列化,StreamWriter对象是一个抽象类,不能直接实例化,只能通过工厂类创建
-                std::unique_ptr<Json::StreamWriter> sw(swb.newStreamWriter());//创建一个StreamWriter对象,用于序列化,StreamWriter对象是一个抽象类,不能直接实例化,只能只能通过工厂类创建
-                //4.使用StreamWriter对象，对Json::Value中存储的数据进行序列化
-                std::stringstream ss;//用于存储序列化后的数据,ss是一个内存流对象
-                // 关键修改1: StreamWriter::write() 无返回值，删除错误的条件判断
-                sw->write(root, &ss);  // 直接写入数据，无需检查返回值
-
-                /*int ret=sw->write(root,&ss);//序列化
-                if(ret!=0){
-                    std::cout<<"序列化失败"<<std::endl;
-                    return;
-                }*///Json::StreamWriter::write() 函数返回类型为 void，原代码中 if (ret != 0) 的条件判断是冗余的，直接删除即可。
-         //       std::cout<<ss.str()<<std::endl;//输出序列化后的数据
-                string = ss.str();
-                return true;
-
+        string_sink(std::string *out): _out(out) {}
+        void reset(std::string *out) { _out = out; }
+};
+/*JSON编解码：每个线程缓存一个Writer/Reader，默认紧凑输出，结果直接写入调用者的字符串
+ *所有成员都是字符串/整数/布尔的扁平对象（put_chess、chat、match_*、hall_ready、room_ready等消息）
+ *直接拼接输出，不经过jsoncpp的Writer，其他结构仍然交给jsoncpp*/
+class json_util{
+    private:
+        static Json::StreamWriter *writer(bool pretty) {
+            static thread_local std::unique_ptr<Json::StreamWriter> compact_sw, pretty_sw;
+            std::unique_ptr<Json::StreamWriter> &sw = pretty ? pretty_sw : compact_sw;
+            if (!sw) {
+                Json::StreamWriterBuilder swb;
+                swb.settings_["emitUTF8"] = true;//直接输出UTF-8字符，不转义成\u
+                swb.settings_["indentation"] = pretty ? "    " : "";
+                sw.reset(swb.newStreamWriter());
+            }
+            return sw.get();
         }
-        static bool unserialize(const std::string &str, Json::Value &root){//&str是一个引用，将其如果传递给函数，会将str的地址传递给函数，这样函数中对str的修改会影响到外部的str
-                //1.实例化一个CharReaderBuilder工厂类
+        static Json::CharReader *reader() {
+            static thread_local std::unique_ptr<Json::CharReader> cr;
+            if (!cr) {
                 Json::CharReaderBuilder crb;
-                //2.使用CharReaderBuilder工厂类对象创建一个CharReader对象
-               // Json::CharReader *cr=crb.newCharReader();//创建一个CharReader对象，用于反序列化  
-                std::unique_ptr<Json::CharReader> cr(crb.newCharReader());//创建一个CharReader对象，用于反序列化
-                //4.使用CharReader对象，对json字符串进行反序列化
-                std::string err;//用于存储错误信息
-                //parse(char *start,char *end,Json::Value *val， string *errs),第一个参数是json字符串的起始地址，第二个参数是json字符串的结束地址，第三个参数是用于存储反序列化后的数据，第四个参数是用于存储错误信息
-                bool ret =cr->parse(str.c_str(),str.c_str()+str.size(),&root,&err);//反序列化,参数为json字符串的起始地址，json字符串的结束地址，用于存储反序列化后的数据，用于存储错误信息
-                if(ret==false){
-                    ELOG("json unserialize failed: %s", err.c_str());//打印错误信息
+                cr.reset(crb.newCharReader());
+            }
+            return cr.get();
+        }
+        static void append_string(const char *str, size_t len, std::string &out) {
+            static const char hex[] = "0123456789abcdef";
+            out.push_back('"');
+            for (size_t i = 0; i < len; i++) {
+                unsigned char c = str[i];
+                switch (c) {
+                    case '"': out.append("\\\""); break;
+                    case '\\': out.append("\\\\"); break;
+                    case '\b': out.append("\\b"); break;
+                    case '\f': out.append("\\f"); break;
+                    case '\n': out.append("\\n"); break;
+                    case '\r': out.append("\\r"); break;
+                    case '\t': out.append("\\t"); break;
+                    default:
+                        if (c < 0x20) {
+                            out.append("\\u00");
+                            out.push_back(hex[c >> 4]);
+                            out.push_back(hex[c & 0xF]);
+                        }else {
+                            out.push_back((char)c);
+                        }
+                }
+            }
+            out.push_back('"');
+        }
+        //扁平对象的快速路径，遇到嵌套对象/数组/浮点数返回false，由jsoncpp处理
+        static bool serialize_flat(const Json::Value &root, std::string &out) {
+            if (root.type() != Json::objectValue) {
+                return false;
+            }
+            for (auto it = root.begin(); it != root.end(); ++it) {
+                Json::ValueType t = it->type();
+                if (t != Json::stringValue && t != Json::intValue && t != Json::uintValue &&
+                    t != Json::booleanValue && t != Json::nullValue) {
                     return false;
                 }
+            }
+            out.push_back('{');
+            bool first = true;
+            for (auto it = root.begin(); it != root.end(); ++it) {
+                if (first == false) {
+                    out.push_back(',');
+                }
+                first = false;
+                const char *end;
+                const char *key = it.memberName(&end);
+                append_string(key, end - key, out);
+                out.push_back(':');
+                char num[24];
+                switch (it->type()) {
+                    case Json::stringValue: {
+                        const char *begin;
+                        it->getString(&begin, &end);
+                        append_string(begin, end - begin, out);
+                        break;
+                    }
+                    case Json::intValue:
+                        out.append(num, snprintf(num, sizeof(num), "%lld", (long long)it->asLargestInt()));
+                        break;
+                    case Json::uintValue:
+                        out.append(num, snprintf(num, sizeof(num), "%llu", (unsigned long long)it->asLargestUInt()));
+                        break;
+                    case Json::booleanValue:
+                        out.append(it->asBool() ? "true" : "false");
+                        break;
+                    default:
+                        out.append("null");
+                }
+            }
+            out.push_back('}');
+            return true;
+        }
+    public:
+        /*序列化到string中（覆盖原有内容），pretty为true时按4空格缩进输出，便于调试*/
+        static bool serialize(const Json::Value &root, std::string &string, bool pretty = false){
+            string.clear();
+            if (pretty == false && serialize_flat(root, string)) {
                 return true;
+            }
+            string.clear();
+            static thread_local string_sink sink(nullptr);
+            static thread_local std::ostream os(&sink);
+            sink.reset(&string);
+            writer(pretty)->write(root, &os);
+            return true;
+        }
+        static bool unserialize(const std::string &str, Json::Value &root){
+            return unserialize(str.c_str(), str.size(), root);
+        }
+        /*直接从调用者的缓冲区（例如websocket消息正文）反序列化，不需要先拷贝成string*/
+        static bool unserialize(const char *str, size_t len, Json::Value &root){
+            std::string err;//用于存储错误信息
+            bool ret = reader()->parse(str, str + len, &root, &err);
+            if(ret==false){
+                ELOG("json unserialize failed: %s", err.c_str());//打印错误信息
+                return false;
+            }
+            return true;
         }
 };
 //定义一个字符串工具类,实现字符串的分割，三个参数分别是源字符串，分隔符，存储分割后的结果
@@ -169,4 +299,87 @@ class file_util{
        } 
         
 };
+//websocket帧工具：服务端发出的帧不需要掩码，组好帧头的消息标记为已准备好，
+//websocketpp发送时不会再为每个连接重新组帧/拷贝正文，同一条消息可以直接交给多个连接发送
+class ws_util{
+    public:
+        static wsserver_t::message_ptr make_frame(const wsserver_t::connection_ptr &conn,
+            websocketpp::frame::opcode::value op, std::string &payload){
+            wsserver_t::message_ptr msg = conn->get_message(op, 0);
+            if (!msg) {
+                return msg;
+            }
+            uint64_t len = payload.size();
+            std::string header;
+            header.push_back((char)(0x80 | op));//FIN + opcode
+            if (len < 126) {
+                header.push_back((char)len);
+            }else if (len <= 0xFFFF) {
+                header.push_back((char)126);
+                header.push_back((char)(len >> 8));
+                header.push_back((char)(len & 0xFF));
+            }else {
+                header.push_back((char)127);
+                for (int i = 7; i >= 0; i--) {
+                    header.push_back((char)((len >> (8 * i)) & 0xFF));
+                }
+            }
+            msg->get_raw_payload().swap(payload);//正文的内存直接转交给消息，不拷贝
+            msg->set_header(header);
+            msg->set_prepared(true);
+            return msg;
+        }
+        //把同一条消息发送给多个连接，空连接跳过
+        static void send_all(const std::vector<wsserver_t::connection_ptr> &conns,
+            websocketpp::frame::opcode::value op, std::string &payload){
+            wsserver_t::message_ptr msg;
+            for (auto &conn : conns) {
+                if (conn.get() == nullptr) {
+                    continue;
+                }
+                if (!msg) {
+                    msg = make_frame(conn, op, payload);
+                    if (!msg) {
+                        return;
+                    }
+                }
+                conn->send(msg);
+            }
+        }
+};
+//时间工具类，统一使用单调时钟，用于计算耗时/延迟，不受系统时间调整影响
+class time_util{
+    public:
+        static uint64_t now_us(){
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+        static uint64_t now_ms(){
+            return now_us() / 1000;
+        }
+};
+/*限流器（GCRA）：只保存一个"理论到达时间"，平均每interval_us放行一次，允许连续突发burst次，
+ *判断和更新是一次CAS，不需要加锁，不需要定时补充令牌*/
+class rate_limiter{
+    private:
+        std::atomic<uint64_t> _tat;
+        uint64_t _interval_us;
+        uint64_t _burst_us;
+    public:
+        rate_limiter(uint64_t interval_us, int burst):
+            _tat(0), _interval_us(interval_us), _burst_us(interval_us * (burst > 1 ? burst - 1 : 0)) {}
+        bool allow(uint64_t now_us) {
+            uint64_t tat = _tat.load(std::memory_order_relaxed);
+            while (true) {
+                uint64_t base = tat > now_us ? tat : now_us;
+                if (base - now_us > _burst_us) {
+                    return false;
+                }
+                if (_tat.compare_exchange_weak(tat, base + _interval_us, std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+        }
+        void reset() { _tat = 0; }
+};
 #endif
\ No newline at end of file
@@ -0,0 +1,231 @@
+#ifndef __M_WATCH_H__
+#define __M_WATCH_H__
+#include "util.hpp"
+#include "proto.hpp"
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+
+#define WATCH_MAX_PER_ROOM 10000        //每个房间最多的观战连接数量
+#define WATCH_MAX_BUFFERED (64 * 1024)  //观战连接未发出的数据超过该值视为慢连接，跳过增量，追上后补发一次快照
+#define WATCH_RESYNC_MS 200             //有慢连接时定期检查缓冲是否排空，不依赖下一步棋触发补发
+
+/*观战者集合：
+ *  房间在自己的锁内只把走棋结果追加到队列（拷贝一个定长结构体），释放房间锁之后再调用flush扇出，
+ *  扇出时每一步棋每种编码（二进制/JSON）只编码、组帧一次，所有观战连接共享同一条已组帧的消息；
+ *  同一时刻只有一个线程在扇出（其他线程看到有人在扇出就直接返回，由扇出线程代为发送），保证增量的顺序
+ *  慢连接（发送缓冲积压）不会拖慢玩家：积压时丢弃增量并标记为过期，缓冲排空后用一次快照代替所有丢掉的增量，
+ *  补发由下一次扇出或者房间的定时检查（resync）触发，最后一步棋时落后的连接也能追上；
+ *  客户端按move_no忽略不比快照新的增量*/
+class watch_group {
+    private:
+        struct observer {
+            wsserver_t::connection_ptr conn;
+            bool binary;//协商了二进制子协议
+            bool stale;//丢过增量，需要补发快照
+        };
+        std::mutex _mutex;//观战者列表
+        std::vector<observer> _observers;
+        std::unordered_map<void *, size_t> _index;//连接 -> _observers中的下标，删除时与末尾交换
+        std::mutex _queue_mutex;
+        std::deque<move_result> _queue;
+        std::mutex _flush_mutex;
+        std::atomic<size_t> _size;//没有观战者时push直接返回
+        std::atomic<size_t> _stale;//等待补发快照的连接数
+        uint64_t _room_id;
+    public:
+        /*所有房间累计的扇出统计*/
+        struct totals {
+            std::atomic<uint64_t> observers;
+            std::atomic<uint64_t> delivered;//发出的增量帧
+            std::atomic<uint64_t> dropped;//因为积压丢弃的增量帧
+            std::atomic<uint64_t> resynced;//补发的快照
+            std::atomic<uint64_t> fanout_us;//扇出总耗时
+            std::atomic<uint64_t> max_fanout_us;
+        };
+        static totals &stats() {
+            static totals t = {{0}, {0}, {0}, {0}, {0}, {0}};
+            return t;
+        }
+        static void stats(Json::Value &val) {
+            totals &t = stats();
+            val["observers"] = (Json::UInt64)t.observers;
+            val["delivered"] = (Json::UInt64)t.delivered;
+            val["dropped"] = (Json::UInt64)t.dropped;
+            val["resynced"] = (Json::UInt64)t.resynced;
+            val["fanout_us"] = (Json::UInt64)t.fanout_us;
+            val["max_fanout_us"] = (Json::UInt64)t.max_fanout_us;
+        }
+    private:
+        static void update_max(std::atomic<uint64_t> &m, uint64_t v) {
+            uint64_t cur = m;
+            while (v > cur && !m.compare_exchange_weak(cur, v)) {}
+        }
+        /*给缓冲已经排空的过期连接补发快照，调用者持有扇出锁；snapshot要加房间锁，在观战者锁之外生成*/
+        void send_resync(std::vector<wsserver_t::connection_ptr> &resync, std::string &body,
+                         const std::function<void(std::string &)> &snapshot) {
+            if (resync.empty()) {
+                return;
+            }
+            snapshot(body);
+            ws_util::send_all(resync, websocketpp::frame::opcode::text, body);
+            stats().resynced += resync.size();
+        }
+        bool pop(move_result &mr) {
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            if (_queue.empty()) {
+                return false;
+            }
+            mr = _queue.front();
+            _queue.pop_front();
+            return true;
+        }
+        /*把一步棋扇出给所有观战者；需要补发快照的连接先记下来，释放观战者锁之后再生成快照
+         *（生成快照要加房间锁，而加入观战时是先持有房间锁再加观战者锁，这里不能反过来）*/
+        void fanout(const move_result &mr, const std::function<void(std::string &)> &snapshot) {
+            totals &t = stats();
+            uint64_t start = time_util::now_us();
+            wsserver_t::message_ptr bin_msg, json_msg;
+            std::vector<wsserver_t::connection_ptr> resync;
+            std::string body;
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (auto &ob : _observers) {
+                if (ob.conn->get_buffered_amount() > WATCH_MAX_BUFFERED) {
+                    if (ob.stale == false) {
+                        ob.stale = true;
+                        _stale++;
+                    }
+                    t.dropped++;
+                    continue;
+                }
+                if (ob.stale) {
+                    ob.stale = false;
+                    _stale--;
+                    resync.push_back(ob.conn);
+                    continue;
+                }
+                wsserver_t::message_ptr &msg = ob.binary ? bin_msg : json_msg;
+                if (!msg) {
+                    if (ob.binary) {
+                        proto_util::encode_move_result(mr, body);
+                        msg = ws_util::make_frame(ob.conn, websocketpp::frame::opcode::binary, body);
+                    }else {
+                        Json::Value rsp;
+                        proto_util::move_result_json(mr, _room_id, rsp);
+                        json_util::serialize(rsp, body);
+                        msg = ws_util::make_frame(ob.conn, websocketpp::frame::opcode::text, body);
+                    }
+                }
+                if (msg) {
+                    ob.conn->send(msg);
+                    t.delivered++;
+                }
+            }
+            lock.unlock();
+            send_resync(resync, body, snapshot);
+            uint64_t us = time_util::now_us() - start;
+            t.fanout_us += us;
+            update_max(t.max_fanout_us, us);
+        }
+    public:
+        watch_group(uint64_t room_id): _size(0), _stale(0), _room_id(room_id) {}
+        ~watch_group() {
+            stats().observers -= _observers.size();
+        }
+        /*加入观战，调用者先发送快照再加入（都在房间锁内），之后的增量不会遗漏*/
+        bool add(const wsserver_t::connection_ptr &conn) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_observers.size() >= WATCH_MAX_PER_ROOM || _index.count(conn.get()) != 0) {
+                return false;
+            }
+            observer ob;
+            ob.conn = conn;
+            ob.binary = conn->get_subprotocol() == GOBANG_BIN_PROTO;
+            ob.stale = false;
+            _index[conn.get()] = _observers.size();
+            _observers.push_back(ob);
+            _size++;
+            stats().observers++;
+            return true;
+        }
+        void remove(const wsserver_t::connection_ptr &conn) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _index.find(conn.get());
+            if (it == _index.end()) {
+                return;
+            }
+            size_t i = it->second;
+            _index.erase(it);
+            if (_observers[i].stale) {
+                _stale--;
+            }
+            if (i != _observers.size() - 1) {
+                _observers[i] = _observers.back();
+                _index[_observers[i].conn.get()] = i;
+            }
+            _observers.pop_back();
+            _size--;
+            stats().observers--;
+        }
+        size_t size() { return _size; }
+        size_t stale() { return _stale; }
+        /*在房间锁内调用：只记录走棋结果*/
+        void push(const move_result &mr) {
+            if (_size == 0) {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            _queue.push_back(mr);
+        }
+        /*在房间锁外调用：扇出队列中所有的走棋结果；已经有线程在扇出时直接返回，
+         *扇出线程释放扇出锁之后会再检查一次队列，不会有结果滞留在队列中*/
+        void flush(const std::function<void(std::string &)> &snapshot) {
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> fl(_flush_mutex, std::try_to_lock);
+                    if (!fl.owns_lock()) {
+                        return;
+                    }
+                    move_result mr;
+                    while (pop(mr)) {
+                        fanout(mr, snapshot);
+                    }
+                }
+                std::unique_lock<std::mutex> lock(_queue_mutex);
+                if (_queue.empty()) {
+                    return;
+                }
+            }
+        }
+        /*在房间锁外定时调用：给缓冲已经排空的过期连接补发快照，返回仍在等待补发的连接数，不为0时调用者稍后再检查；
+         *有线程正在扇出时直接返回，由扇出线程处理*/
+        size_t resync(const std::function<void(std::string &)> &snapshot) {
+            if (_stale == 0) {
+                return 0;
+            }
+            {
+                std::unique_lock<std::mutex> fl(_flush_mutex, std::try_to_lock);
+                if (!fl.owns_lock()) {
+                    return _stale;
+                }
+                std::vector<wsserver_t::connection_ptr> resync;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    for (auto &ob : _observers) {
+                        if (ob.stale && ob.conn->get_buffered_amount() <= WATCH_MAX_BUFFERED) {
+                            ob.stale = false;
+                            _stale--;
+                            resync.push_back(ob.conn);
+                        }
+                    }
+                }
+                std::string body;
+                send_resync(resync, body, snapshot);
+            }
+            flush(snapshot);//持有扇出锁期间入队的走棋结果
+            return _stale;
+        }
+};
+#endif